@@ -2,21 +2,15 @@
 * Dependencies:
 * PerView CBuffer
 * MeshBuffer CBuffer
-* DepthCubemap CBuffer
 */
 
 #include "globals.hlsl"
 #include "CubemapUtils.hlsli"
 
 /**
-* Shader can be used for rendering into a CubemapTextureArray
-* g_cubemapPosition - viewMatrix position
-* g_cubemapId - cubemap offset in the array
+* Shader can be used for rendering into a CubemapTextureArray.
+* Every instance is rendered into a single face, so casters of all faces of all cubemaps go in one draw
 */
-cbuffer DepthCubemapBuffer : register(CBUFFER_DEPTH_CUBEMAP) {
-  float3 g_cubemapPosition;
-  uint g_cubemapId;
-};
 
 struct VSInput {
   // MeshSpace
@@ -29,10 +23,15 @@ struct VSInput {
 
   // Instance buffer
   float4x4 modelMatrix : MODEL;
+  // Second instance buffer: viewMatrix position and cubemapId * 6 + faceId
+  float3 cubemapPosition : CUBEMAP_POSITION;
+  uint arrayId : ARRAY_ID;
 };
 
 struct GSInput {
   float4 positionWS : POSITION_WS;
+  float3 cubemapPosition : CUBEMAP_POSITION;
+  nointerpolation uint arrayId : ARRAY_ID;
 };
 
 struct PSInput {
@@ -45,25 +44,22 @@ struct PSInput {
 GSInput VSMain(VSInput input) {
   GSInput result;
   result.positionWS = mul(input.modelMatrix, mul(g_meshToModel, float4(input.position, 1.0)));
+  result.cubemapPosition = input.cubemapPosition;
+  result.arrayId = input.arrayId;
   return result;
 }
 
 /* Geometry */
 
-// 3 vertices * 6 sides
-[maxvertexcount(18)]
+// 3 vertices * 1 side
+[maxvertexcount(3)]
 void GSMain(triangle GSInput input[3], inout TriangleStream<PSInput> output) {
   PSInput result;
+  float4x4 WStoVS = GetViewMatrix(input[0].arrayId % 6, input[0].cubemapPosition);
 
-  for (uint faceId = 0; faceId < 6; ++faceId) {
-    float4x4 WStoVS = GetViewMatrix(faceId, g_cubemapPosition);
-
-    for (uint vertexId = 0; vertexId < 3; ++vertexId) {
-      result.positionProj = mul(g_projectionMatrix, mul(WStoVS, input[vertexId].positionWS));
-      result.arrayId = g_cubemapId * 6 + faceId;
-      output.Append(result);
-    }
-
-    output.RestartStrip();
+  for (uint vertexId = 0; vertexId < 3; ++vertexId) {
+    result.positionProj = mul(g_projectionMatrix, mul(WStoVS, input[vertexId].positionWS));
+    result.arrayId = input[0].arrayId;
+    output.Append(result);
   }
 }
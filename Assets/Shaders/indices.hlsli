@@ -6,6 +6,4 @@
 #define CBUFFER_LIGHT b2
 #define CBUFFER_MESH b3
 
-#define CBUFFER_DEPTH_CUBEMAP b4
-
 #endif
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "Flame/engine/Mesh.h"
+#include "Flame/utils/Timer.h"
+
+/// \return Best of repeatsCount runs of func, in seconds
+template <typename Func>
+double MeasureBest(uint32_t repeatsCount, Func&& func) {
+  double best = 0.0;
+  for (uint32_t repeat = 0; repeat < repeatsCount; ++repeat) {
+    Flame::Timer timer;
+    func();
+    double time = timer.GetTimeSinceTick();
+    best = repeat == 0 ? time : std::min(best, time);
+  }
+
+  return best;
+}
+
+/// Random small triangles in a 20x4x4 box around the origin, dense enough for most rays to hit something
+inline void GenerateTriangleSoup(Flame::Mesh& mesh, uint32_t trianglesCount, std::mt19937& generator) {
+  std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+  auto random = [&] {
+    return glm::vec3(distribution(generator), distribution(generator), distribution(generator));
+  };
+
+  for (uint32_t i = 0; i < trianglesCount; ++i) {
+    glm::vec3 center = random() * glm::vec3(10.0f, 2.0f, 2.0f);
+    uint32_t firstId = static_cast<uint32_t>(mesh.vertices.size());
+    for (uint32_t j = 0; j < 3; ++j) {
+      mesh.vertices.emplace_back(center + random() * 0.2f);
+      mesh.normals.emplace_back(0.0f, 1.0f, 0.0f);
+    }
+    mesh.faces.emplace_back(Flame::Face { { firstId, firstId + 1, firstId + 2 } });
+  }
+}
+
+/// Rays from random points of a slightly bigger box in random directions, with random lengths up to maxDistance
+inline void GenerateRandomRays(std::vector<Flame::Ray>& rays, std::vector<float>& distances, uint32_t raysCount, float maxDistance, std::mt19937& generator) {
+  std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+  rays.reserve(raysCount);
+  distances.reserve(raysCount);
+  for (uint32_t i = 0; i < raysCount; ++i) {
+    glm::vec3 origin(distribution(generator) * 12.0f, distribution(generator) * 3.0f, distribution(generator) * 3.0f);
+    glm::vec3 direction(distribution(generator), distribution(generator), distribution(generator));
+    rays.emplace_back(origin, glm::normalize(direction));
+    distances.emplace_back(std::abs(distribution(generator)) * maxDistance);
+  }
+}
+
+/// What a tree answers for every ray, so that different trees over the same faces can be checked against each other
+struct RayAnswers final {
+  // Closest hit time, or -1 for rays that miss
+  std::vector<float> times;
+  std::vector<uint8_t> occluded;
+};
+
+/// Every face of the mesh tested one by one, with the same culling and range rules as MeshBvh. Ground truth for the trees
+struct BruteForceFaces final {
+  bool Hit(const Flame::Ray& r, Flame::HitRecord<const Flame::Mesh*>& record, float tMin, float tMax) const {
+    bool isHit = false;
+    for (const Flame::Face& face : mesh->faces) {
+      float time;
+      if (Intersect(face, r, tMin, tMax, time)) {
+        tMax = time;
+        record.time = time;
+        record.point = r.AtParameter(time);
+        isHit = true;
+      }
+    }
+
+    return isHit;
+  }
+
+  bool Occluded(const Flame::Ray& r, float tMin, float tMax) const {
+    float time;
+    return std::any_of(mesh->faces.begin(), mesh->faces.end(), [&](const Flame::Face& face) {
+      return Intersect(face, r, tMin, tMax, time);
+    });
+  }
+
+  /// Same Moller-Trumbore as MeshBvh::IntersectTriangle()
+  bool Intersect(const Flame::Face& face, const Flame::Ray& r, float tMin, float tMax, float& time) const {
+    glm::vec3 v0 = mesh->vertices[face.indices[0]];
+    glm::vec3 e1 = mesh->vertices[face.indices[1]] - v0;
+    glm::vec3 e2 = mesh->vertices[face.indices[2]] - v0;
+
+    glm::vec3 pvec = glm::cross(r.direction, e2);
+    float det = glm::dot(e1, pvec);
+    if (det < 0.00001f) {
+      return false;
+    }
+
+    float invDet = 1.0f / det;
+    glm::vec3 tvec = r.origin - v0;
+    float u = glm::dot(tvec, pvec) * invDet;
+    if (u < 0.0f || u > 1.0f) {
+      return false;
+    }
+
+    glm::vec3 qvec = glm::cross(tvec, e1);
+    float v = glm::dot(r.direction, qvec) * invDet;
+    if (v < 0.0f || u + v > 1.0f) {
+      return false;
+    }
+
+    time = glm::dot(e2, qvec) * invDet;
+    return time > tMin && time < tMax;
+  }
+
+public:
+  const Flame::Mesh* mesh;
+};
+
+/// Works for MeshBvh, MeshWideBvh, Mesh and BruteForceFaces alike
+template <typename Bvh>
+void TraceAnswers(const Bvh& bvh, const std::vector<Flame::Ray>& rays, const std::vector<float>& distances, RayAnswers& answers) {
+  answers.times.resize(rays.size());
+  answers.occluded.resize(rays.size());
+  for (size_t i = 0; i < rays.size(); ++i) {
+    Flame::HitRecord<const Flame::Mesh*> record;
+    answers.times[i] = bvh.Hit(rays[i], record, 0.0f, distances[i]) ? record.time : -1.0f;
+    answers.occluded[i] = bvh.Occluded(rays[i], 0.0f, distances[i]);
+  }
+}
+
+/**
+ * Trees differ in traversal order and SIMD width, so the same face may be hit at a slightly different time
+ * \return Number of rays with a different closest hit, or whose Occluded() disagrees with either closest hit
+ */
+inline uint32_t CountMismatches(const RayAnswers& expected, const RayAnswers& actual) {
+  constexpr float kTimeTolerance = 1e-4f;
+  uint32_t mismatchesCount = 0;
+  for (size_t i = 0; i < expected.times.size(); ++i) {
+    bool isExpectedHit = expected.times[i] >= 0.0f;
+    bool isActualHit = actual.times[i] >= 0.0f;
+    bool isMatching = isExpectedHit == isActualHit
+      && std::abs(expected.times[i] - actual.times[i]) <= kTimeTolerance * std::max(1.0f, expected.times[i])
+      && (expected.occluded[i] != 0) == isExpectedHit
+      && (actual.occluded[i] != 0) == isActualHit;
+    mismatchesCount += !isMatching;
+  }
+
+  return mismatchesCount;
+}
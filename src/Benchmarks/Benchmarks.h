@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/// Every benchmark gets the arguments following its name and returns the process exit code
+using BenchmarkFunc = int (*)(const std::vector<std::string>& args);
+
+int RunParallelForBenchmark(const std::vector<std::string>& args);
+int RunOcclusionBenchmark(const std::vector<std::string>& args);
+int RunTrianglesBenchmark(const std::vector<std::string>& args);
+int RunRefitBenchmark(const std::vector<std::string>& args);
+int RunBvhBuildBenchmark(const std::vector<std::string>& args);
+int RunBvhStatsBenchmark(const std::vector<std::string>& args);
+int RunInstancePackingBenchmark(const std::vector<std::string>& args);
+int RunFrustumCullingBenchmark(const std::vector<std::string>& args);
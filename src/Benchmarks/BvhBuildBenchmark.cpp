@@ -0,0 +1,134 @@
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "BenchmarkUtils.h"
+#include "Benchmarks.h"
+#include "Flame/utils/TaskScheduler.h"
+
+namespace {
+  constexpr uint32_t kDefaultTrianglesCount = 1000000;
+  constexpr uint32_t kRaysCount = 1 << 17;
+  constexpr uint32_t kRepeatsCount = 3;
+  // Brute force tests every face for every ray, so it gets a mesh of its own
+  constexpr uint32_t kBruteForceTrianglesCount = 20000;
+  constexpr uint32_t kBruteForceRaysCount = 1 << 12;
+
+  struct BuildModeEntry final {
+    const char* name;
+    Flame::MeshBvh::BuildMode mode;
+  };
+
+  const BuildModeEntry kBuildModes[] = {
+    { "centroid average", Flame::MeshBvh::BuildMode::CENTROID_AVERAGE },
+    { "binned sah", Flame::MeshBvh::BuildMode::BINNED_SAH },
+    { "linear morton", Flame::MeshBvh::BuildMode::LINEAR_MORTON },
+    { "spatial sah", Flame::MeshBvh::BuildMode::SPATIAL_SAH },
+  };
+
+  /// Long thin slabs across the whole soup, like floors and walls, whose boxes overlap every object split
+  void GenerateLargeTriangles(Flame::Mesh& mesh, uint32_t trianglesCount, std::mt19937& generator) {
+    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+    for (uint32_t i = 0; i < trianglesCount; ++i) {
+      float y = distribution(generator) * 2.0f;
+      float z = distribution(generator) * 2.0f;
+      uint32_t firstId = static_cast<uint32_t>(mesh.vertices.size());
+      mesh.vertices.emplace_back(-10.0f, y, z);
+      mesh.vertices.emplace_back(10.0f, y + distribution(generator), z + 0.5f);
+      mesh.vertices.emplace_back(10.0f, y - 0.5f, z + distribution(generator));
+      mesh.normals.insert(mesh.normals.end(), 3, glm::vec3(0.0f, 1.0f, 0.0f));
+      mesh.faces.emplace_back(Flame::Face { { firstId, firstId + 1, firstId + 2 } });
+    }
+  }
+
+  /// Wide trees of every width are checked, not only the MeshBvhWide of this build
+  template <uint32_t Width>
+  uint32_t CountWideMismatches(const Flame::Mesh& mesh, const std::vector<Flame::Ray>& rays, const std::vector<float>& distances, const RayAnswers& expected) {
+    Flame::MeshWideBvh<Width> wideBvh(&mesh);
+    wideBvh.Build();
+    RayAnswers answers;
+    TraceAnswers(wideBvh, rays, distances, answers);
+    return CountMismatches(expected, answers);
+  }
+}
+
+int RunBvhBuildBenchmark(const std::vector<std::string>& args) {
+  uint32_t trianglesCount = args.empty() ? kDefaultTrianglesCount : static_cast<uint32_t>(std::stoul(args[0]));
+  uint32_t largeTrianglesCount = args.size() < 2 ? trianglesCount / 20 : static_cast<uint32_t>(std::stoul(args[1]));
+  Flame::TaskScheduler* scheduler = Flame::TaskScheduler::Get();
+  std::mt19937 generator(1);
+  Flame::Mesh mesh;
+  GenerateTriangleSoup(mesh, trianglesCount, generator);
+  GenerateLargeTriangles(mesh, largeTrianglesCount, generator);
+
+  std::vector<Flame::Ray> rays;
+  std::vector<float> distances;
+  GenerateRandomRays(rays, distances, kRaysCount, 20.0f, generator);
+
+  std::cout << "BVH build: " << trianglesCount << " + " << largeTrianglesCount << " large triangles, " << scheduler->GetThreadsCount() << " threads" << '\n';
+
+  // Every tree, binary or collapsed, has to answer the rays the same way as the first one
+  RayAnswers expected;
+  RayAnswers answers;
+  uint32_t mismatchesCount = 0;
+  for (const BuildModeEntry& entry : kBuildModes) {
+    mesh.bvh.SetBuildMode(entry.mode);
+    double serialTime = MeasureBest(kRepeatsCount, [&] {
+      mesh.bvh.Build();
+    });
+    double parallelTime = MeasureBest(kRepeatsCount, [&] {
+      mesh.bvh.Build(scheduler);
+    });
+
+    // Tree quality as seen by queries, not only by the SAH estimate
+    double traceTime = MeasureBest(kRepeatsCount, [&] {
+      for (uint32_t i = 0; i < kRaysCount; ++i) {
+        Flame::HitRecord<const Flame::Mesh*> record;
+        mesh.bvh.Hit(rays[i], record, 0.0f, distances[i]);
+      }
+    });
+
+    std::cout << std::left << std::setw(18) << entry.name << std::fixed << std::setprecision(3)
+      << "build " << serialTime * 1000.0 << " ms, parallel " << parallelTime * 1000.0 << " ms, "
+      << "sah " << mesh.bvh.GetSahCost() << ", "
+      << "trace " << traceTime * 1000.0 << " ms, "
+      << mesh.bvh.GetFaceIds().size() << " references, " << mesh.bvh.GetMemoryUsage() / 1024 << " KiB" << '\n';
+
+    RayAnswers& binaryAnswers = &entry == kBuildModes ? expected : answers;
+    TraceAnswers(mesh.bvh, rays, distances, binaryAnswers);
+    uint32_t binaryMismatchesCount = CountMismatches(expected, binaryAnswers);
+
+    mesh.wideBvh.Build();
+    TraceAnswers(mesh.wideBvh, rays, distances, answers);
+    uint32_t wideMismatchesCount = CountMismatches(expected, answers);
+    mesh.wideBvh.Reset();
+
+    std::cout << std::left << std::setw(18) << "" << "mismatches " << binaryMismatchesCount << ", wide " << wideMismatchesCount << '\n';
+    mismatchesCount += binaryMismatchesCount + wideMismatchesCount;
+  }
+
+  // The trees above are only checked against each other, this checks them against every face
+  Flame::Mesh smallMesh;
+  GenerateTriangleSoup(smallMesh, kBruteForceTrianglesCount, generator);
+  GenerateLargeTriangles(smallMesh, kBruteForceTrianglesCount / 20, generator);
+  smallMesh.bvh.Build();
+  std::vector<Flame::Ray> smallRays;
+  std::vector<float> smallDistances;
+  GenerateRandomRays(smallRays, smallDistances, kBruteForceRaysCount, 20.0f, generator);
+
+  TraceAnswers(BruteForceFaces { &smallMesh }, smallRays, smallDistances, expected);
+  TraceAnswers(smallMesh.bvh, smallRays, smallDistances, answers);
+  uint32_t binaryMismatchesCount = CountMismatches(expected, answers);
+  uint32_t bvh4MismatchesCount = CountWideMismatches<4>(smallMesh, smallRays, smallDistances, expected);
+  std::cout << std::left << std::setw(18) << "brute force" << "mismatches " << binaryMismatchesCount << ", bvh4 " << bvh4MismatchesCount;
+  mismatchesCount += binaryMismatchesCount + bvh4MismatchesCount;
+#if defined(__AVX__)
+  uint32_t bvh8MismatchesCount = CountWideMismatches<8>(smallMesh, smallRays, smallDistances, expected);
+  std::cout << ", bvh8 " << bvh8MismatchesCount;
+  mismatchesCount += bvh8MismatchesCount;
+#endif
+  std::cout << '\n';
+
+  return mismatchesCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#include <cctype>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include "BenchmarkUtils.h"
+#include "Benchmarks.h"
+#include "Flame/engine/BvhStats.h"
+#include "Flame/utils/TaskScheduler.h"
+
+namespace {
+  constexpr uint32_t kDefaultTrianglesCount = 200000;
+  constexpr uint32_t kRaysCount = 1 << 16;
+
+  struct BuildModeEntry final {
+    const char* name;
+    Flame::MeshBvh::BuildMode mode;
+  };
+
+  const BuildModeEntry kBuildModes[] = {
+    { "centroid average", Flame::MeshBvh::BuildMode::CENTROID_AVERAGE },
+    { "binned sah", Flame::MeshBvh::BuildMode::BINNED_SAH },
+    { "linear morton", Flame::MeshBvh::BuildMode::LINEAR_MORTON },
+    { "spatial sah", Flame::MeshBvh::BuildMode::SPATIAL_SAH },
+  };
+
+  /// Only what Mesh::Parse() needs, no materials or textures
+  constexpr uint32_t kLoadFlags = aiProcess_JoinIdenticalVertices
+    | aiProcess_Triangulate
+    | aiProcess_GenBoundingBoxes
+    | aiProcess_GenNormals
+    | aiProcess_GenUVCoords
+    | aiProcess_CalcTangentSpace;
+
+  bool LoadMeshes(const std::string& path, std::vector<std::unique_ptr<Flame::Mesh>>& meshes) {
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFile(path.c_str(), kLoadFlags);
+    if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)) {
+      std::cout << "Failed to load " << path << ": " << importer.GetErrorString() << '\n';
+      return false;
+    }
+
+    for (uint32_t i = 0; i < scene->mNumMeshes; ++i) {
+      auto& mesh = meshes.emplace_back(std::make_unique<Flame::Mesh>());
+      mesh->Parse(*scene->mMeshes[i]);
+    }
+
+    return true;
+  }
+
+  /// Rays between random points of the mesh bounds, so that every mesh gets a similar share of hits regardless of its size
+  void GenerateBoundsRays(const Flame::Aabb& box, std::vector<Flame::Ray>& rays, std::vector<float>& distances, std::mt19937& generator) {
+    std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+    auto random = [&] {
+      return box.Min() + (box.Max() - box.Min()) * glm::vec3(distribution(generator), distribution(generator), distribution(generator));
+    };
+
+    rays.clear();
+    distances.clear();
+    for (uint32_t i = 0; i < kRaysCount; ++i) {
+      glm::vec3 origin = random();
+      glm::vec3 target = random();
+      float distance = glm::length(target - origin);
+      if (distance <= 0.0f) {
+        continue;
+      }
+
+      rays.emplace_back(origin, (target - origin) / distance);
+      distances.emplace_back(distance);
+    }
+  }
+
+  void ReportMesh(Flame::Mesh& mesh, Flame::TaskScheduler* scheduler, std::mt19937& generator) {
+    std::vector<Flame::Ray> rays;
+    std::vector<float> distances;
+
+    for (const BuildModeEntry& entry : kBuildModes) {
+      mesh.bvh.SetBuildMode(entry.mode);
+      mesh.bvh.Build(scheduler);
+      if (rays.empty()) {
+        GenerateBoundsRays(mesh.bvh.GetBounds(), rays, distances, generator);
+      }
+
+      // Same rays through the SIMD collapse of the same tree
+      mesh.wideBvh.Build();
+
+      Flame::BvhQueryStats hitStats;
+      Flame::BvhQueryStats occludedStats;
+      Flame::BvhQueryStats wideHitStats;
+      Flame::HitRecord<const Flame::Mesh*> record;
+      for (size_t i = 0; i < rays.size(); ++i) {
+        Flame::BvhQueryStats::Local() = {};
+        mesh.bvh.Hit(rays[i], record, 0.0f, distances[i]);
+        hitStats += Flame::BvhQueryStats::Local();
+
+        Flame::BvhQueryStats::Local() = {};
+        mesh.bvh.Occluded(rays[i], 0.0f, distances[i]);
+        occludedStats += Flame::BvhQueryStats::Local();
+
+        Flame::BvhQueryStats::Local() = {};
+        mesh.wideBvh.Hit(rays[i], record, 0.0f, distances[i]);
+        wideHitStats += Flame::BvhQueryStats::Local();
+      }
+
+      std::cout << "-- " << entry.name << '\n'
+        << mesh.bvh.CalculateBuildStats()
+        << "hit: " << hitStats
+        << "occluded: " << occludedStats
+        << "wide hit: " << wideHitStats;
+    }
+  }
+}
+
+int RunBvhStatsBenchmark(const std::vector<std::string>& args) {
+  Flame::TaskScheduler* scheduler = Flame::TaskScheduler::Get();
+  std::mt19937 generator(1);
+  std::vector<std::unique_ptr<Flame::Mesh>> meshes;
+
+  // A number builds a triangle soup of that size, anything else is a model path
+  if (args.empty() || std::isdigit(static_cast<unsigned char>(args[0][0]))) {
+    uint32_t trianglesCount = args.empty() ? kDefaultTrianglesCount : static_cast<uint32_t>(std::stoul(args[0]));
+    auto& mesh = meshes.emplace_back(std::make_unique<Flame::Mesh>());
+    GenerateTriangleSoup(*mesh, trianglesCount, generator);
+    mesh->name = "triangle soup";
+  } else if (!LoadMeshes(args[0], meshes)) {
+    return 1;
+  }
+
+  for (const auto& mesh : meshes) {
+    std::cout << "== " << mesh->name << '\n';
+    ReportMesh(*mesh, scheduler, generator);
+  }
+
+  return 0;
+}
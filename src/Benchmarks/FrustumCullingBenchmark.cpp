@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "BenchmarkUtils.h"
+#include "Benchmarks.h"
+#include "Flame/engine/TransformSystem.h"
+#include "Flame/graphics/groups/ShaderGroup.h"
+#include "Flame/math/Frustum.h"
+#include "Flame/math/MathUtils.h"
+#include "Flame/utils/TaskScheduler.h"
+
+namespace {
+  constexpr uint32_t kDefaultInstancesCount = 100000;
+  constexpr uint32_t kModelsCount = 4;
+  constexpr uint32_t kMeshesCount = 3;
+  constexpr uint32_t kMaterialsCount = 2;
+  constexpr uint32_t kFrustumsCount = 32;
+  constexpr uint32_t kMovingCount = 100;
+  constexpr uint32_t kChurnCount = 100;
+  constexpr uint32_t kPointLightsCount = 8;
+  constexpr uint32_t kCubeFacesCount = 6;
+  constexpr float kSceneSize = 200.0f;
+
+  struct InstanceData final {
+    uint32_t transformId;
+  };
+
+  struct MaterialData final {
+  };
+
+  using Group = Flame::ShaderGroup<InstanceData, MaterialData>;
+
+  /// Instance as draggers and hit results refer to it
+  struct InstanceHandle final {
+    Group::PerMaterial* perMaterial;
+    uint32_t instanceId;
+    uint32_t transformId;
+  };
+
+  /// Camera somewhere in the scene looking in a random direction, the same projection the renderer uses
+  glm::mat4 RandomViewProjection(std::mt19937& generator) {
+    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+    glm::vec3 position = glm::vec3(distribution(generator), distribution(generator), distribution(generator)) * kSceneSize * 0.5f;
+    glm::quat rotation = glm::normalize(glm::quat(distribution(generator), distribution(generator), distribution(generator), distribution(generator)));
+
+    glm::mat4 inverseView = glm::translate(glm::mat4(1.0f), position) * glm::mat4(rotation);
+    glm::mat4 projection = Flame::MathUtils::Perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, kSceneSize);
+    return projection * glm::inverse(inverseView);
+  }
+
+  /// Same corners as AlignedCamera::GetFrustumCornersWS()
+  std::array<glm::vec4, 8> GetCorners(const glm::mat4& viewProjection) {
+    glm::mat4 inverse = glm::inverse(viewProjection);
+    const glm::vec3 ndcCorners[] = {
+      { -1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, { 1.0f, -1.0f, 1.0f }, { -1.0f, -1.0f, 1.0f },
+      { -1.0f, 1.0f, 0.0f }, { 1.0f, 1.0f, 0.0f }, { 1.0f, -1.0f, 0.0f }, { -1.0f, -1.0f, 0.0f },
+    };
+
+    std::array<glm::vec4, 8> corners;
+    for (uint32_t i = 0; i < 8; ++i) {
+      corners[i] = inverse * glm::vec4(ndcCorners[i], 1.0f);
+      corners[i] /= corners[i].w;
+    }
+
+    return corners;
+  }
+
+  /// Scalar reference: bounds recomputed from the hierarchy and tested one by one
+  void CullBruteForce(const Group& group, const Flame::Frustum& frustum, std::vector<uint32_t>& visibleIds) {
+    visibleIds.clear();
+    for (const auto& perModel : group.GetModels()) {
+      const auto& model = perModel->GetModel();
+      for (uint32_t meshId = 0; meshId < perModel->GetMeshes().size(); ++meshId) {
+        const Flame::Mesh& mesh = model->m_meshes[meshId];
+        for (const auto& perMaterial : perModel->GetMeshes()[meshId]->GetMaterials()) {
+          auto instances = perMaterial->GetInstances();
+          for (uint32_t i = 0; i < instances.size(); ++i) {
+            glm::mat4 meshToWorld = mesh.GetMeshToWorld(Flame::TransformSystem::Get()->GetMat(instances[i].GetData().transformId));
+            if (frustum.Intersects(mesh.box.Transformed(meshToWorld))) {
+              visibleIds.emplace_back(perMaterial->GetInstanceOffset() + i);
+            }
+          }
+        }
+      }
+    }
+
+    std::sort(visibleIds.begin(), visibleIds.end());
+  }
+
+  /// \return Whether the list matches the reference, both as a whole and per material bucket
+  bool IsMatching(const Group& group, const Flame::InstanceList& list, const std::vector<uint32_t>& expectedIds) {
+    if (list.ids != expectedIds || list.bucketOffsets.size() != group.GetBucketsCount() + 1) {
+      return false;
+    }
+
+    for (const auto& perModel : group.GetModels()) {
+      for (const auto& perMesh : perModel->GetMeshes()) {
+        for (const auto& perMaterial : perMesh->GetMaterials()) {
+          uint32_t begin = perMaterial->GetInstanceOffset();
+          uint32_t end = begin + static_cast<uint32_t>(perMaterial->GetInstances().size());
+          uint32_t bucketId = perMaterial->GetBucketId();
+          for (uint32_t i = list.GetOffset(bucketId); i < list.GetOffset(bucketId) + list.GetCount(bucketId); ++i) {
+            if (list.ids[i] < begin || list.ids[i] >= end) {
+              return false;
+            }
+          }
+        }
+      }
+    }
+
+    return true;
+  }
+}
+
+int RunFrustumCullingBenchmark(const std::vector<std::string>& args) {
+  uint32_t instancesCount = args.empty() ? kDefaultInstancesCount : static_cast<uint32_t>(std::stoul(args[0]));
+  Flame::TaskScheduler* scheduler = Flame::TaskScheduler::Get();
+  Flame::TransformSystem* transformSystem = Flame::TransformSystem::Get();
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+  auto randomVec = [&] {
+    return glm::vec3(distribution(generator), distribution(generator), distribution(generator));
+  };
+
+  // Models of a few meshes with random bounds, some of them offset within the model
+  Group group;
+  std::vector<std::shared_ptr<Flame::Model>> models;
+  for (uint32_t modelId = 0; modelId < kModelsCount; ++modelId) {
+    auto model = models.emplace_back(std::make_shared<Flame::Model>());
+    model->m_meshes.resize(kMeshesCount);
+    for (uint32_t meshId = 0; meshId < kMeshesCount; ++meshId) {
+      Flame::Mesh& mesh = model->m_meshes[meshId];
+      glm::vec3 center = randomVec();
+      glm::vec3 extent = glm::abs(randomVec()) + 0.1f;
+      mesh.box = Flame::Aabb(center - extent, center + extent);
+      if (meshId % 2 == 1) {
+        mesh.transforms.emplace_back(glm::translate(glm::mat4(1.0f), randomVec() * 2.0f));
+        mesh.transformsInv.emplace_back(glm::inverse(mesh.transforms.back()));
+      }
+    }
+
+    uint32_t perModelId = group.AddModel(model);
+    for (auto& perMesh : group.GetModel(perModelId)->GetMeshes()) {
+      for (uint32_t materialId = 0; materialId < kMaterialsCount; ++materialId) {
+        perMesh->AddMaterial(MaterialData {});
+      }
+    }
+  }
+
+  // Every instance goes to a random material of a random mesh
+  std::vector<uint32_t> transformIds;
+  std::vector<InstanceHandle> handles;
+  auto addInstance = [&]() {
+    Flame::Transform transform;
+    transform.SetPosition(randomVec() * kSceneSize);
+    transform.SetScale(glm::vec3(0.5f + std::abs(distribution(generator))));
+    uint32_t transformId = transformSystem->Insert(transform);
+    transformIds.emplace_back(transformId);
+
+    auto perModel = group.GetModel(static_cast<uint32_t>(generator() % kModelsCount));
+    auto& perMesh = perModel->GetMeshes()[static_cast<uint32_t>(generator() % kMeshesCount)];
+    Group::PerMaterial* perMaterial = perMesh->GetMaterials()[static_cast<uint32_t>(generator() % kMaterialsCount)].get();
+    handles.emplace_back(InstanceHandle { perMaterial, perMaterial->AddInstance(InstanceData { transformId }), transformId });
+  };
+
+  Flame::Timer addTimer;
+  for (uint32_t i = 0; i < instancesCount; ++i) {
+    addInstance();
+  }
+  // Reading commits the queued instances
+  group.GetInstances();
+  double addTime = addTimer.GetTimeSinceTick();
+  transformSystem->Update();
+
+  std::cout << "Frustum culling: " << instancesCount << " instances, " << group.GetBucketsCount() << " materials, "
+    << kFrustumsCount << " frustums, " << scheduler->GetThreadsCount() << " threads" << '\n';
+
+  Flame::InstanceList list;
+  std::vector<uint32_t> expectedIds;
+  double boxesTime = 0.0;
+  double cullTime = 0.0;
+  double bruteForceTime = 0.0;
+  uint64_t visibleCount = 0;
+  uint32_t mismatchesCount = 0;
+  uint32_t lostHandlesCount = 0;
+  for (uint32_t frustumId = 0; frustumId < kFrustumsCount; ++frustumId) {
+    // Instances come and go, moving the others around the group
+    for (uint32_t i = 0; i < kChurnCount; ++i) {
+      uint32_t handleId = static_cast<uint32_t>(generator() % handles.size());
+      handles[handleId].perMaterial->RemoveInstance(handles[handleId].instanceId);
+      handles[handleId] = handles.back();
+      handles.pop_back();
+      addInstance();
+    }
+
+    for (const InstanceHandle& handle : handles) {
+      lostHandlesCount += handle.perMaterial->GetInstance(handle.instanceId).GetData().transformId != handle.transformId;
+    }
+
+    // Some movement every frame, so the bounds have to be recomputed
+    for (uint32_t i = 0; i < kMovingCount; ++i) {
+      transformSystem->SetPosition(transformIds[generator() % instancesCount], randomVec() * kSceneSize);
+    }
+    transformSystem->Update();
+
+    // Now and then a mesh changes its bounds the way Mesh::RefitBvh() does, which moves all of its instances
+    if (frustumId % 4 == 3) {
+      Flame::Mesh& mesh = models[generator() % kModelsCount]->m_meshes[generator() % kMeshesCount];
+      glm::vec3 center = randomVec();
+      glm::vec3 extent = glm::abs(randomVec()) + 0.1f;
+      mesh.box = Flame::Aabb(center - extent, center + extent);
+      ++mesh.boxVersion;
+    }
+
+    // Both ways to build a frustum get tested
+    glm::mat4 viewProjection = RandomViewProjection(generator);
+    Flame::Frustum frustum = frustumId % 2 == 0
+      ? Flame::Frustum::FromMatrix(viewProjection)
+      : Flame::Frustum::FromCorners(GetCorners(viewProjection));
+
+    Flame::Timer boxesTimer;
+    group.UpdateInstanceBoxes(scheduler);
+    boxesTime += boxesTimer.GetTimeSinceTick();
+
+    Flame::Timer cullTimer;
+    group.Cull(frustum, list, scheduler);
+    cullTime += cullTimer.GetTimeSinceTick();
+
+    Flame::Timer bruteForceTimer;
+    CullBruteForce(group, frustum, expectedIds);
+    bruteForceTime += bruteForceTimer.GetTimeSinceTick();
+
+    visibleCount += list.ids.size();
+    if (!IsMatching(group, list, expectedIds)) {
+      ++mismatchesCount;
+    }
+  }
+
+  // Point light shadows: the faces together have to keep every instance around the light
+  std::vector<Flame::InstanceList> faceLists(kCubeFacesCount);
+  glm::mat4 faceProjection = Flame::MathUtils::Perspective(glm::pi<float>() * 0.5f, 1.0f, 0.01f, kSceneSize);
+  double facesTime = 0.0;
+  uint64_t castersCount = 0;
+  uint32_t missedCount = 0;
+  for (uint32_t lightId = 0; lightId < kPointLightsCount; ++lightId) {
+    glm::vec3 position = randomVec() * kSceneSize * 0.5f;
+
+    Flame::Timer facesTimer;
+    for (uint32_t faceId = 0; faceId < kCubeFacesCount; ++faceId) {
+      Flame::Frustum frustum = Flame::Frustum::FromMatrix(faceProjection * Flame::MathUtils::CubeFaceView(faceId, position));
+      group.Cull(frustum, faceLists[faceId], scheduler);
+    }
+    facesTime += facesTimer.GetTimeSinceTick();
+
+    std::vector<bool> isCaster(group.GetInstanceCount(), false);
+    for (const auto& faceList : faceLists) {
+      castersCount += faceList.ids.size();
+      for (uint32_t id : faceList.ids) {
+        isCaster[id] = true;
+      }
+    }
+
+    // A box center is inside the frustum of the face it points to, unless it is too close or too far
+    auto boxes = group.UpdateInstanceBoxes(scheduler);
+    for (uint32_t i = 0; i < boxes.size(); ++i) {
+      float distance = glm::length(boxes[i].Centroid() - position);
+      if (distance > 1.0f && distance < kSceneSize && !isCaster[i]) {
+        ++missedCount;
+      }
+    }
+  }
+
+  std::cout << std::fixed << std::setprecision(3)
+    << "  visible: " << static_cast<double>(visibleCount) / kFrustumsCount << " instances per frustum" << '\n'
+    << "  bounds update: " << boxesTime * 1000.0 / kFrustumsCount << " ms" << '\n'
+    << "  simd cull: " << cullTime * 1000.0 / kFrustumsCount << " ms" << '\n'
+    << "  brute force: " << bruteForceTime * 1000.0 / kFrustumsCount << " ms" << '\n'
+    << "  speedup: " << std::setprecision(2) << bruteForceTime / (boxesTime + cullTime) << "x" << '\n'
+    << "  mismatches: " << mismatchesCount << '\n'
+    << std::setprecision(3)
+    << "  adding instances: " << addTime * 1000.0 << " ms, lost handles: " << lostHandlesCount << '\n'
+    << "  cube faces: " << facesTime * 1000.0 / kPointLightsCount << " ms per light, "
+    << static_cast<double>(castersCount) / kPointLightsCount << " casters of " << instancesCount << '\n'
+    << "  missed casters: " << missedCount << '\n';
+
+  group.Clear();
+  transformSystem->Cleanup();
+  return mismatchesCount == 0 && missedCount == 0 && lostHandlesCount == 0 ? 0 : 1;
+}
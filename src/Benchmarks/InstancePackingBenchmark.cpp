@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "BenchmarkUtils.h"
+#include "Benchmarks.h"
+#include "Flame/engine/TransformSystem.h"
+#include "Flame/graphics/groups/InstanceStaging.h"
+#include "Flame/utils/TaskScheduler.h"
+
+namespace {
+  constexpr uint32_t kDefaultStaticCount = 100000;
+  constexpr uint32_t kDefaultMovingCount = 1000;
+  constexpr uint32_t kFramesCount = 60;
+  constexpr uint32_t kRepeatsCount = 5;
+
+  /// Same layout as the instance data of OpaqueGroup, which needs a D3D device to exist
+  struct InstanceData final {
+    struct ShaderData final {
+      glm::mat4 modelMatrix;
+    };
+
+    ShaderData GetShaderData() const {
+      return ShaderData {
+        Flame::TransformSystem::Get()->GetMat(transformId)
+      };
+    }
+
+    uint32_t transformId;
+  };
+}
+
+int RunInstancePackingBenchmark(const std::vector<std::string>& args) {
+  uint32_t staticCount = args.size() > 0 ? static_cast<uint32_t>(std::stoul(args[0])) : kDefaultStaticCount;
+  uint32_t movingCount = args.size() > 1 ? static_cast<uint32_t>(std::stoul(args[1])) : kDefaultMovingCount;
+  uint32_t instancesCount = staticCount + movingCount;
+  Flame::TransformSystem* transformSystem = Flame::TransformSystem::Get();
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<float> distribution(-100.0f, 100.0f);
+
+  // Moving instances are spread over the whole range, as they would be after adding objects one by one
+  std::vector<InstanceData> instances(instancesCount);
+  std::vector<uint32_t> movingIds;
+  for (uint32_t i = 0; i < instancesCount; ++i) {
+    Flame::Transform transform;
+    transform.SetPosition(glm::vec3(distribution(generator), distribution(generator), distribution(generator)));
+    instances[i].transformId = transformSystem->Insert(transform);
+    if (static_cast<uint64_t>(i) * movingCount / instancesCount != static_cast<uint64_t>(i + 1) * movingCount / instancesCount) {
+      movingIds.emplace_back(i);
+    }
+  }
+  transformSystem->Update();
+
+  std::cout << "Instance packing: " << staticCount << " static, " << movingIds.size() << " moving instances, "
+    << kFramesCount << " frames" << '\n';
+
+  auto transformIdOf = [&](uint32_t i) {
+    return instances[i].transformId;
+  };
+  auto pack = [&](uint32_t i) {
+    return instances[i].GetShaderData();
+  };
+  auto moveInstances = [&](uint32_t frame) {
+    for (uint32_t id : movingIds) {
+      transformSystem->SetPosition(instances[id].transformId, glm::vec3(static_cast<float>(frame), 0.0f, static_cast<float>(id)));
+    }
+    transformSystem->Update();
+  };
+
+  // What every group did before: the whole buffer is packed again every frame
+  std::vector<InstanceData::ShaderData> fullData(instancesCount);
+  double fullTime = 0.0;
+  double moveTime = 0.0;
+  for (uint32_t frame = 0; frame < kFramesCount; ++frame) {
+    Flame::Timer moveTimer;
+    moveInstances(frame);
+    moveTime += moveTimer.GetTimeSinceTick();
+
+    Flame::Timer timer;
+    for (uint32_t i = 0; i < instancesCount; ++i) {
+      fullData[i] = pack(i);
+    }
+    fullTime += timer.GetTimeSinceTick();
+  }
+
+  Flame::InstanceStaging<InstanceData::ShaderData> staging;
+  staging.Update(instancesCount, 0, transformIdOf, pack);
+  double incrementalTime = 0.0;
+  uint32_t uploadsCount = 0;
+  for (uint32_t frame = 0; frame < kFramesCount; ++frame) {
+    moveInstances(frame);
+
+    Flame::Timer timer;
+    if (staging.Update(instancesCount, 0, transformIdOf, pack)) {
+      ++uploadsCount;
+    }
+    incrementalTime += timer.GetTimeSinceTick();
+  }
+
+  // A frame where nothing moved shouldn't need an upload at all
+  Flame::Timer idleTimer;
+  bool isIdleChanged = staging.Update(instancesCount, 0, transformIdOf, pack);
+  double idleTime = idleTimer.GetTimeSinceTick();
+
+  // Packing everything, as after adding or removing instances, on one thread and split over the workers
+  Flame::TaskScheduler* scheduler = Flame::TaskScheduler::Get();
+  uint32_t instancesVersion = 0;
+  double serialPackTime = MeasureBest(kRepeatsCount, [&] {
+    staging.Update(instancesCount, ++instancesVersion, transformIdOf, pack);
+  });
+  double parallelPackTime = MeasureBest(kRepeatsCount, [&] {
+    staging.Update(instancesCount, ++instancesVersion, transformIdOf, pack, scheduler);
+  });
+
+  // Upload into a stand-in for the mapped buffer: a plain copy against parallel non-temporal stores
+  std::vector<InstanceData::ShaderData> mappedData(instancesCount);
+  double memcpyTime = MeasureBest(kRepeatsCount, [&] {
+    std::memcpy(mappedData.data(), staging.GetData().data(), staging.GetData().size_bytes());
+  });
+  std::fill(mappedData.begin(), mappedData.end(), InstanceData::ShaderData {});
+  double copyToTime = MeasureBest(kRepeatsCount, [&] {
+    staging.CopyTo(mappedData.data(), scheduler);
+  });
+
+  // Everything ran the same frames, so all of it has to end up with the same data as the full repack
+  size_t dataSize = fullData.size() * sizeof(InstanceData::ShaderData);
+  bool isMatching = staging.GetData().size() == fullData.size()
+    && std::memcmp(staging.GetData().data(), fullData.data(), dataSize) == 0
+    && std::memcmp(mappedData.data(), fullData.data(), dataSize) == 0;
+
+  std::cout << std::fixed << std::setprecision(3)
+    << "  transform update: " << moveTime * 1000.0 / kFramesCount << " ms/frame" << '\n'
+    << "  full repack: " << fullTime * 1000.0 / kFramesCount << " ms/frame" << '\n'
+    << "  incremental: " << incrementalTime * 1000.0 / kFramesCount << " ms/frame, " << uploadsCount << " uploads" << '\n'
+    << "  idle frame: " << idleTime * 1000.0 << " ms, " << (isIdleChanged ? "upload" : "no upload") << '\n'
+    << "  speedup: " << std::setprecision(2) << fullTime / incrementalTime << "x" << '\n'
+    << std::setprecision(3)
+    << "  full pack: " << serialPackTime * 1000.0 << " ms serial, " << parallelPackTime * 1000.0 << " ms on "
+    << scheduler->GetThreadsCount() << " threads" << '\n'
+    << "  upload copy: " << memcpyTime * 1000.0 << " ms memcpy, " << copyToTime * 1000.0 << " ms streamed" << '\n'
+    << "  data: " << (isMatching ? "matching" : "MISMATCH") << '\n';
+
+  transformSystem->Cleanup();
+  return isMatching && !isIdleChanged ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Benchmarks.h"
+
+namespace {
+  struct BenchmarkEntry final {
+    const char* name;
+    const char* usage;
+    BenchmarkFunc func;
+  };
+
+  const BenchmarkEntry kBenchmarks[] = {
+    { "parallel_for", "[elementsCount]", RunParallelForBenchmark },
+    { "occlusion", "[trianglesCount]", RunOcclusionBenchmark },
+    { "triangles", "[trianglesCount]", RunTrianglesBenchmark },
+    { "refit", "[trianglesCount]", RunRefitBenchmark },
+    { "bvh_build", "[trianglesCount] [largeTrianglesCount]", RunBvhBuildBenchmark },
+    { "bvh_stats", "[trianglesCount | modelPath]", RunBvhStatsBenchmark },
+    { "instance_packing", "[staticCount] [movingCount]", RunInstancePackingBenchmark },
+    { "frustum_culling", "[instancesCount]", RunFrustumCullingBenchmark },
+  };
+
+  void PrintUsage() {
+    std::cout << "Usage: Benchmarks <name> [args...]" << '\n';
+    for (const BenchmarkEntry& entry : kBenchmarks) {
+      std::cout << "  " << entry.name << ' ' << entry.usage << '\n';
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    PrintUsage();
+    return 1;
+  }
+
+  std::string name = argv[1];
+  std::vector<std::string> args(argv + 2, argv + argc);
+  for (const BenchmarkEntry& entry : kBenchmarks) {
+    if (name == entry.name) {
+      return entry.func(args);
+    }
+  }
+
+  std::cout << "Unknown benchmark: " << name << '\n';
+  PrintUsage();
+  return 1;
+}
@@ -0,0 +1,74 @@
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "BenchmarkUtils.h"
+#include "Benchmarks.h"
+
+namespace {
+  constexpr uint32_t kDefaultTrianglesCount = 200000;
+  constexpr uint32_t kRaysCount = 1 << 18;
+  constexpr uint32_t kRepeatsCount = 3;
+
+  /// \return Number of rays blocked differently than expected
+  uint32_t Report(const char* name, double time, const std::vector<uint8_t>& blocked, const std::vector<uint8_t>& expectedBlocked) {
+    uint32_t blockedCount = 0;
+    uint32_t mismatchesCount = 0;
+    for (size_t i = 0; i < blocked.size(); ++i) {
+      blockedCount += blocked[i];
+      mismatchesCount += blocked[i] != expectedBlocked[i];
+    }
+
+    std::cout << std::left << std::setw(24) << name
+      << std::fixed << std::setprecision(3) << time * 1000.0 << " ms, "
+      << std::setprecision(1) << kRaysCount / time * 1e-6 << " Mrays/s, "
+      << blockedCount << " blocked, " << mismatchesCount << " mismatches" << '\n';
+    return mismatchesCount;
+  }
+}
+
+int RunOcclusionBenchmark(const std::vector<std::string>& args) {
+  uint32_t trianglesCount = args.empty() ? kDefaultTrianglesCount : static_cast<uint32_t>(std::stoul(args[0]));
+  std::mt19937 generator(1);
+  Flame::Mesh mesh;
+  GenerateTriangleSoup(mesh, trianglesCount, generator);
+  mesh.bvh.Build();
+  mesh.wideBvh.Build();
+
+  // Shadow-like rays: random origins and directions, random distance to the "light"
+  std::vector<Flame::Ray> rays;
+  std::vector<float> distances;
+  GenerateRandomRays(rays, distances, kRaysCount, 5.0f, generator);
+
+  std::cout << "Occlusion: " << trianglesCount << " triangles, " << kRaysCount << " rays" << '\n';
+
+  // Any-hit queries have to block exactly the rays the closest hit query finds something for
+  std::vector<uint8_t> hitBlocked(kRaysCount);
+  double hitTime = MeasureBest(kRepeatsCount, [&] {
+    for (uint32_t i = 0; i < kRaysCount; ++i) {
+      Flame::HitRecord<const Flame::Mesh*> record;
+      hitBlocked[i] = mesh.bvh.Hit(rays[i], record, 0.0f, distances[i]);
+    }
+  });
+  Report("closest hit", hitTime, hitBlocked, hitBlocked);
+
+  std::vector<uint8_t> blocked(kRaysCount);
+  double occludedTime = MeasureBest(kRepeatsCount, [&] {
+    for (uint32_t i = 0; i < kRaysCount; ++i) {
+      blocked[i] = mesh.bvh.Occluded(rays[i], 0.0f, distances[i]);
+    }
+  });
+  uint32_t mismatchesCount = Report("any hit", occludedTime, blocked, hitBlocked);
+
+  double wideOccludedTime = MeasureBest(kRepeatsCount, [&] {
+    for (uint32_t i = 0; i < kRaysCount; ++i) {
+      blocked[i] = mesh.Occluded(rays[i], 0.0f, distances[i]);
+    }
+  });
+  mismatchesCount += Report("any hit, wide BVH", wideOccludedTime, blocked, hitBlocked);
+
+  std::cout << "  speedup: " << std::setprecision(2) << hitTime / occludedTime << "x, "
+    << hitTime / wideOccludedTime << "x wide" << '\n';
+  return mismatchesCount == 0 ? 0 : 1;
+}
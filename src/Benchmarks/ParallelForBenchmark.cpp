@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "BenchmarkUtils.h"
+#include "Benchmarks.h"
+#include "Flame/utils/TaskScheduler.h"
+
+namespace {
+  constexpr uint32_t kDefaultElementsCount = 1 << 24;
+  constexpr uint32_t kRepeatsCount = 5;
+  constexpr uint32_t kGrainSizes[] = { 256, 4096, 65536 };
+
+  // Cheap body, so that the dispatch cost is what gets measured
+  inline void Process(const float* input, float* output, uint32_t i) {
+    output[i] = std::sqrt(input[i]) * 0.5f + 1.0f;
+  }
+
+  void Report(const char* name, uint32_t grainSize, double time, uint32_t elementsCount) {
+    std::cout << std::left << std::setw(24) << name
+      << " grain " << std::setw(8) << grainSize
+      << std::fixed << std::setprecision(3) << time * 1000.0 << " ms, "
+      << std::setprecision(3) << time * 1e9 / elementsCount << " ns/element" << '\n';
+  }
+}
+
+int RunParallelForBenchmark(const std::vector<std::string>& args) {
+  uint32_t elementsCount = args.empty() ? kDefaultElementsCount : static_cast<uint32_t>(std::stoul(args[0]));
+  Flame::TaskScheduler* scheduler = Flame::TaskScheduler::Get();
+  std::vector<float> input(elementsCount);
+  std::vector<float> output(elementsCount);
+  for (uint32_t i = 0; i < elementsCount; ++i) {
+    input[i] = static_cast<float>(i);
+  }
+
+  std::cout << "ParallelFor: " << elementsCount << " elements, " << scheduler->GetThreadsCount() << " threads" << '\n';
+
+  double serialTime = MeasureBest(kRepeatsCount, [&] {
+    for (uint32_t i = 0; i < elementsCount; ++i) {
+      Process(input.data(), output.data(), i);
+    }
+  });
+  Report("serial", elementsCount, serialTime, elementsCount);
+
+  for (uint32_t grainSize : kGrainSizes) {
+    // What per-index std::function dispatch costs: the body can't be inlined into the loop
+    std::function<void(uint32_t)> perIndexTask = [&](uint32_t i) {
+      Process(input.data(), output.data(), i);
+    };
+    double perIndexTime = MeasureBest(kRepeatsCount, [&] {
+      scheduler->Wait(scheduler->ParallelForAsync(0, elementsCount, grainSize, [&perIndexTask](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+          perIndexTask(i);
+        }
+      }));
+    });
+    Report("per-index std::function", grainSize, perIndexTime, elementsCount);
+
+    double rangeTime = MeasureBest(kRepeatsCount, [&] {
+      scheduler->ParallelFor(0, elementsCount, grainSize, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+          Process(input.data(), output.data(), i);
+        }
+      });
+    });
+    Report("templated range", grainSize, rangeTime, elementsCount);
+    std::cout << "  speedup: " << std::setprecision(2) << perIndexTime / rangeTime << "x" << '\n';
+  }
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "BenchmarkUtils.h"
+#include "Benchmarks.h"
+#include "Flame/utils/TaskScheduler.h"
+
+namespace {
+  constexpr uint32_t kDefaultTrianglesCount = 500000;
+  constexpr uint32_t kFramesCount = 12;
+  constexpr uint32_t kRepeatsCount = 3;
+  constexpr uint32_t kRaysCount = 1 << 14;
+
+  /// Bends the soup along x like a wave, stronger every frame, so that the refitted tree keeps losing quality
+  void Deform(Flame::Mesh& mesh, const std::vector<glm::vec3>& restVertices, uint32_t frame) {
+    float amplitude = 0.5f * static_cast<float>(frame);
+    for (size_t i = 0; i < restVertices.size(); ++i) {
+      const glm::vec3& rest = restVertices[i];
+      mesh.vertices[i] = rest + glm::vec3(0.0f, amplitude * std::sin(rest.x * 0.7f), amplitude * std::cos(rest.x * 1.3f));
+    }
+  }
+}
+
+int RunRefitBenchmark(const std::vector<std::string>& args) {
+  uint32_t trianglesCount = args.empty() ? kDefaultTrianglesCount : static_cast<uint32_t>(std::stoul(args[0]));
+  Flame::TaskScheduler* scheduler = Flame::TaskScheduler::Get();
+  std::mt19937 generator(1);
+  Flame::Mesh mesh;
+  GenerateTriangleSoup(mesh, trianglesCount, generator);
+  const std::vector<glm::vec3> restVertices = mesh.vertices;
+
+  // Deformed soup stays within the ray box, so the rays keep hitting it
+  std::vector<Flame::Ray> rays;
+  std::vector<float> distances;
+  GenerateRandomRays(rays, distances, kRaysCount, 20.0f, generator);
+
+  std::cout << "Refit: " << trianglesCount << " triangles, " << scheduler->GetThreadsCount() << " threads" << '\n';
+
+  mesh.bvh.Build(scheduler);
+  double totalRefitTime = 0.0;
+  double totalBuildTime = 0.0;
+  RayAnswers refitAnswers;
+  RayAnswers rebuiltAnswers;
+  uint32_t mismatchesCount = 0;
+  for (uint32_t frame = 1; frame <= kFramesCount; ++frame) {
+    Deform(mesh, restVertices, frame);
+
+    // Keeps refitting the tree of the first frame until it drifts too far
+    Flame::Timer timer;
+    bool isRebuilt = mesh.bvh.Refit(scheduler);
+    double refitTime = timer.GetTimeSinceTick();
+    float refitSahCost = mesh.bvh.GetSahCost();
+    totalRefitTime += refitTime;
+
+    Flame::Mesh rebuilt;
+    rebuilt.vertices = mesh.vertices;
+    rebuilt.faces = mesh.faces;
+    double buildTime = MeasureBest(kRepeatsCount, [&] {
+      rebuilt.bvh.Build(scheduler);
+    });
+    totalBuildTime += buildTime;
+
+    // A worse tree is fine, different answers are not
+    TraceAnswers(mesh.bvh, rays, distances, refitAnswers);
+    TraceAnswers(rebuilt.bvh, rays, distances, rebuiltAnswers);
+    uint32_t frameMismatchesCount = CountMismatches(rebuiltAnswers, refitAnswers);
+    mismatchesCount += frameMismatchesCount;
+
+    std::cout << "frame " << frame << std::fixed << std::setprecision(3)
+      << ": refit " << refitTime * 1000.0 << " ms, sah " << refitSahCost << (isRebuilt ? " (rebuilt)" : "")
+      << "; build " << buildTime * 1000.0 << " ms, sah " << rebuilt.bvh.GetSahCost()
+      << "; mismatches " << frameMismatchesCount << '\n';
+  }
+
+  std::cout << "  speedup: " << std::setprecision(2) << totalBuildTime / totalRefitTime << "x" << '\n';
+  return mismatchesCount == 0 ? 0 : 1;
+}
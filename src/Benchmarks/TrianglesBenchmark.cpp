@@ -0,0 +1,72 @@
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "BenchmarkUtils.h"
+#include "Benchmarks.h"
+
+namespace {
+  constexpr uint32_t kDefaultTrianglesCount = 200000;
+  constexpr uint32_t kRaysCount = 1 << 18;
+  constexpr uint32_t kRepeatsCount = 3;
+
+  struct Timings final {
+    double hitTime;
+    double occludedTime;
+    uint32_t hitsCount;
+  };
+
+  Timings MeasureQueries(const Flame::MeshBvh& bvh, const std::vector<Flame::Ray>& rays, const std::vector<float>& distances) {
+    Timings timings {};
+    timings.hitTime = MeasureBest(kRepeatsCount, [&] {
+      timings.hitsCount = 0;
+      for (uint32_t i = 0; i < kRaysCount; ++i) {
+        Flame::HitRecord<const Flame::Mesh*> record;
+        timings.hitsCount += bvh.Hit(rays[i], record, 0.0f, distances[i]);
+      }
+    });
+
+    timings.occludedTime = MeasureBest(kRepeatsCount, [&] {
+      for (uint32_t i = 0; i < kRaysCount; ++i) {
+        volatile bool isOccluded = bvh.Occluded(rays[i], 0.0f, distances[i]);
+        (void)isOccluded;
+      }
+    });
+
+    return timings;
+  }
+
+  void Report(const char* name, const Timings& timings, size_t memoryUsage) {
+    std::cout << std::left << std::setw(16) << name
+      << std::fixed << std::setprecision(3) << "hit " << timings.hitTime * 1000.0 << " ms, "
+      << "occluded " << timings.occludedTime * 1000.0 << " ms, "
+      << timings.hitsCount << " hits, " << memoryUsage / 1024 << " KiB" << '\n';
+  }
+}
+
+int RunTrianglesBenchmark(const std::vector<std::string>& args) {
+  uint32_t trianglesCount = args.empty() ? kDefaultTrianglesCount : static_cast<uint32_t>(std::stoul(args[0]));
+  std::mt19937 generator(1);
+  Flame::Mesh mesh;
+  GenerateTriangleSoup(mesh, trianglesCount, generator);
+  mesh.bvh.Build();
+
+  std::vector<Flame::Ray> rays;
+  std::vector<float> distances;
+  GenerateRandomRays(rays, distances, kRaysCount, 20.0f, generator);
+
+  std::cout << "Precomputed triangles: " << trianglesCount << " triangles, " << kRaysCount << " rays" << '\n';
+
+  Timings gathered = MeasureQueries(mesh.bvh, rays, distances);
+  Report("gathered", gathered, mesh.bvh.GetMemoryUsage());
+
+  mesh.bvh.SetPrecomputeTriangles(true);
+  Timings precomputed = MeasureQueries(mesh.bvh, rays, distances);
+  Report("precomputed", precomputed, mesh.bvh.GetMemoryUsage());
+
+  std::cout << "  speedup: " << std::setprecision(2) << gathered.hitTime / precomputed.hitTime << "x hit, "
+    << gathered.occludedTime / precomputed.occludedTime << "x occluded, for "
+    << mesh.bvh.GetTrianglesMemoryUsage() / 1024 << " KiB more" << '\n';
+  return 0;
+}
@@ -9,6 +9,7 @@
 #include "Flame/engine/MeshSystem.h"
 #include "Flame/engine/Model.h"
 #include "Flame/engine/ModelManager.h"
+#include "Flame/engine/PathTracer.h"
 #include "Flame/engine/TextureManager.h"
 #include "Flame/engine/Transform.h"
 #include "Flame/engine/TransformSystem.h"
@@ -33,14 +34,16 @@
 #include "Flame/math/MathUtils.h"
 #include "Flame/math/MeshData.h"
 #include "Flame/math/Ray.h"
+#include "Flame/math/RayStream.h"
 #include "Flame/utils/draggers/IDragger.h"
 #include "Flame/utils/EventDispatcher.h"
 #include "Flame/utils/FunctionalDispatcher.h"
 #include "Flame/utils/ObjUtils.h"
-#include "Flame/utils/ParallelExecutor.h"
+#include "Flame/utils/PpmImage.h"
 #include "Flame/utils/PtrProxy.h"
 #include "Flame/utils/Random.h"
 #include "Flame/utils/ScopeTimer.h"
+#include "Flame/utils/TaskScheduler.h"
 #include "Flame/utils/Timer.h"
 #include "Flame/window/events/KeyWindowEvent.h"
 #include "Flame/window/events/MouseButtonWindowEvent.h"
@@ -122,7 +122,7 @@ namespace Flame {
     m_iProjection = glm::inverse(m_projection);
     //m_iView = MathUtils::Translate(m_transform.GetPosition()) * glm::mat4(m_transform.GetRotationMat());
     m_iView = m_transform.GetMat();
-    m_view = glm::inverse(m_iView);
+    m_view = m_transform.GetInverseMat();
 
     glm::vec4 target = m_iView * m_iProjection * glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f);
     m_cornerTl = glm::vec3(target) / target.w;
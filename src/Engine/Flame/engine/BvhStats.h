@@ -0,0 +1,97 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+// Per-query counters cost a thread-local increment in the hottest loops, so they only exist in Debug
+// builds or when FLAME_ENABLE_BVH_STATS is set. Without FLAME_BVH_STATS the macro compiles to nothing
+#if defined(FLAME_BVH_STATS)
+#define FLAME_BVH_COUNT(counter, value) (::Flame::BvhQueryStats::Local().counter += (value))
+#else
+#define FLAME_BVH_COUNT(counter, value) ((void)0)
+#endif
+
+namespace Flame {
+  /// Shape of a built MeshBvh, see MeshBvh::CalculateBuildStats()
+  struct BvhBuildStats final {
+    // Leaves with kLeafSizeBucketsCount - 1 or more references share the last bucket
+    static constexpr uint32_t kLeafSizeBucketsCount = 17;
+
+    uint32_t facesCount = 0;
+    // Equal to facesCount unless spatial splits duplicated some faces
+    uint32_t referencesCount = 0;
+    uint32_t nodesCount = 0;
+    uint32_t leavesCount = 0;
+    uint32_t maxDepth = 0;
+    // Over leaves, each one weighted by its references count
+    float averageLeafDepth = 0.0f;
+    uint32_t maxLeafSize = 0;
+    std::array<uint32_t, kLeafSizeBucketsCount> leafSizeHistogram {};
+    float sahCost = 0.0f;
+    size_t memoryUsage = 0;
+    float buildTime = 0.0f;
+
+    friend std::ostream& operator<<(std::ostream& out, const BvhBuildStats& stats) {
+      out << "faces " << stats.facesCount << ", references " << stats.referencesCount
+        << ", nodes " << stats.nodesCount << ", leaves " << stats.leavesCount << '\n'
+        << "depth max " << stats.maxDepth << ", average " << stats.averageLeafDepth
+        << ", leaf size max " << stats.maxLeafSize << '\n'
+        << "sah " << stats.sahCost << ", memory " << stats.memoryUsage / 1024 << " KiB"
+        << ", build " << stats.buildTime * 1000.0f << " ms" << '\n'
+        << "leaf sizes:";
+      for (uint32_t size = 0; size < kLeafSizeBucketsCount; ++size) {
+        if (stats.leafSizeHistogram[size] != 0) {
+          out << ' ' << size << (size + 1 == kLeafSizeBucketsCount ? "+" : "") << ':' << stats.leafSizeHistogram[size];
+        }
+      }
+
+      return out << '\n';
+    }
+  };
+
+  /**
+   * Work done by single-ray BVH queries (Hit() and Occluded() of MeshBvh and MeshWideBvh).
+   * Every thread accumulates into its own Local() instance, so a caller measures its queries by resetting it
+   * before them and reading it after. Wide BVHs count every SIMD lane as a test, padding included.
+   * Stays zero unless FLAME_BVH_STATS is defined
+   */
+  struct BvhQueryStats final {
+    uint64_t queriesCount = 0;
+    uint64_t nodesVisited = 0;
+    uint64_t boxTests = 0;
+    uint64_t triangleTests = 0;
+
+    static constexpr bool IsEnabled() {
+#if defined(FLAME_BVH_STATS)
+      return true;
+#else
+      return false;
+#endif
+    }
+
+    static BvhQueryStats& Local() {
+      thread_local BvhQueryStats stats;
+      return stats;
+    }
+
+    BvhQueryStats& operator+=(const BvhQueryStats& other) {
+      queriesCount += other.queriesCount;
+      nodesVisited += other.nodesVisited;
+      boxTests += other.boxTests;
+      triangleTests += other.triangleTests;
+      return *this;
+    }
+
+    friend std::ostream& operator<<(std::ostream& out, const BvhQueryStats& stats) {
+      if (!IsEnabled()) {
+        return out << "query stats are compiled out, build Debug or set FLAME_ENABLE_BVH_STATS" << '\n';
+      }
+
+      double queries = stats.queriesCount != 0 ? static_cast<double>(stats.queriesCount) : 1.0;
+      return out << "queries " << stats.queriesCount
+        << ", per query: nodes " << stats.nodesVisited / queries
+        << ", boxes " << stats.boxTests / queries
+        << ", triangles " << stats.triangleTests / queries << '\n';
+    }
+  };
+}
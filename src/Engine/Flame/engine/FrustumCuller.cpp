@@ -0,0 +1,113 @@
+#include "FrustumCuller.h"
+
+#include <bit>
+#include <cassert>
+
+namespace Flame {
+  namespace {
+    void SetLane(FrustumCuller::BoxBlock& block, uint32_t lane, const glm::vec3& center, const glm::vec3& extent) {
+      block.centerX[lane] = center.x;
+      block.centerY[lane] = center.y;
+      block.centerZ[lane] = center.z;
+      block.extentX[lane] = extent.x;
+      block.extentY[lane] = extent.y;
+      block.extentZ[lane] = extent.z;
+    }
+  }
+
+  void FrustumCuller::SetBoxes(std::span<const Aabb> boxes, TaskScheduler* scheduler) {
+    m_boxesCount = static_cast<uint32_t>(boxes.size());
+    m_blocks.resize((m_boxesCount + kSimdWidth - 1) / kSimdWidth);
+
+    ForEachChunk(scheduler, [&](uint32_t, uint32_t firstBlockId, uint32_t lastBlockId) {
+      for (uint32_t blockId = firstBlockId; blockId < lastBlockId; ++blockId) {
+        BoxBlock& block = m_blocks[blockId];
+        for (uint32_t lane = 0; lane < kSimdWidth; ++lane) {
+          // Lanes past the end get empty boxes, they are masked out by Cull() anyway
+          uint32_t boxId = blockId * kSimdWidth + lane;
+          if (boxId < m_boxesCount) {
+            SetBox(boxId, boxes[boxId]);
+          } else {
+            SetLane(block, lane, glm::vec3(0.0f), glm::vec3(0.0f));
+          }
+        }
+      }
+    });
+  }
+
+  void FrustumCuller::SetBox(uint32_t boxId, const Aabb& box) {
+    assert(boxId < m_boxesCount);
+    glm::vec3 center = box.Centroid();
+    SetLane(m_blocks[boxId / kSimdWidth], boxId % kSimdWidth, center, box.Max() - center);
+  }
+
+  void FrustumCuller::Reset() {
+    m_blocks.clear();
+    m_boxesCount = 0;
+    m_blockMasks.clear();
+    m_chunkOffsets.clear();
+  }
+
+  void FrustumCuller::Cull(const Frustum& frustum, std::vector<uint32_t>& visibleIds, TaskScheduler* scheduler) {
+    uint32_t blocksCount = static_cast<uint32_t>(m_blocks.size());
+    uint32_t chunksCount = (blocksCount + kChunkBlocksCount - 1) / kChunkBlocksCount;
+    m_blockMasks.resize(blocksCount);
+    m_chunkOffsets.assign(chunksCount + 1, 0);
+
+    // Visibility bits and the number of visible boxes of every chunk
+    ForEachChunk(scheduler, [&](uint32_t chunkId, uint32_t firstBlockId, uint32_t lastBlockId) {
+      uint32_t visibleCount = 0;
+      for (uint32_t blockId = firstBlockId; blockId < lastBlockId; ++blockId) {
+        uint32_t mask = CullBlock(m_blocks[blockId], frustum);
+        uint32_t lanesCount = std::min(kSimdWidth, m_boxesCount - blockId * kSimdWidth);
+        mask &= (1u << lanesCount) - 1;
+
+        m_blockMasks[blockId] = mask;
+        visibleCount += static_cast<uint32_t>(std::popcount(mask));
+      }
+      m_chunkOffsets[chunkId + 1] = visibleCount;
+    });
+
+    // Chunk counts into output offsets, then every chunk writes its own range
+    for (uint32_t chunkId = 0; chunkId < chunksCount; ++chunkId) {
+      m_chunkOffsets[chunkId + 1] += m_chunkOffsets[chunkId];
+    }
+
+    visibleIds.resize(m_chunkOffsets[chunksCount]);
+    ForEachChunk(scheduler, [&](uint32_t chunkId, uint32_t firstBlockId, uint32_t lastBlockId) {
+      uint32_t offset = m_chunkOffsets[chunkId];
+      for (uint32_t blockId = firstBlockId; blockId < lastBlockId; ++blockId) {
+        for (uint32_t mask = m_blockMasks[blockId]; mask != 0; mask &= mask - 1) {
+          visibleIds[offset++] = blockId * kSimdWidth + static_cast<uint32_t>(std::countr_zero(mask));
+        }
+      }
+    });
+  }
+
+  uint32_t FrustumCuller::GetBoxesCount() const {
+    return m_boxesCount;
+  }
+
+  uint32_t FrustumCuller::CullBlock(const BoxBlock& block, const Frustum& frustum) const {
+    using Simd = SimdFloat<kSimdWidth>;
+    Simd centerX = Simd::Load(block.centerX);
+    Simd centerY = Simd::Load(block.centerY);
+    Simd centerZ = Simd::Load(block.centerZ);
+    Simd extentX = Simd::Load(block.extentX);
+    Simd extentY = Simd::Load(block.extentY);
+    Simd extentZ = Simd::Load(block.extentZ);
+    Simd zero(0.0f);
+
+    // Distance of the box corner farthest along the normal, the box is outside if it's behind any plane
+    Simd inside;
+    for (uint32_t planeId = 0; planeId < Frustum::kPlanesCount; ++planeId) {
+      const glm::vec4& plane = frustum.planes[planeId];
+      Simd distance = Simd(plane.x) * centerX + Simd(plane.y) * centerY + Simd(plane.z) * centerZ
+        + Simd(glm::abs(plane.x)) * extentX + Simd(glm::abs(plane.y)) * extentY + Simd(glm::abs(plane.z)) * extentZ
+        + Simd(plane.w);
+      inside = planeId == 0 ? distance >= zero : inside & (distance >= zero);
+    }
+
+    return inside.Mask();
+  }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Flame/math/Aabb.h"
+#include "Flame/math/Frustum.h"
+#include "Flame/math/Simd.h"
+#include "Flame/utils/TaskScheduler.h"
+
+namespace Flame {
+  /**
+   * Visibility of many boxes against frustums. Boxes are stored once as SoA blocks of centers and half extents,
+   * then every Cull() tests a block against a plane at once and compacts the visible indices.
+   * With a scheduler, both steps are split into chunks run in parallel
+   */
+  struct FrustumCuller final {
+    struct alignas(kSimdWidth * sizeof(float)) BoxBlock final {
+      float centerX[kSimdWidth];
+      float centerY[kSimdWidth];
+      float centerZ[kSimdWidth];
+      float extentX[kSimdWidth];
+      float extentY[kSimdWidth];
+      float extentZ[kSimdWidth];
+    };
+
+    void SetBoxes(std::span<const Aabb> boxes, TaskScheduler* scheduler = nullptr);
+    /// Replaces one of the boxes given to SetBoxes(), different boxes may be set from different threads
+    void SetBox(uint32_t boxId, const Aabb& box);
+    void Reset();
+
+    /**
+     * Same conservative test as Frustum::Intersects()
+     * \param visibleIds Filled with indices of the boxes intersecting the frustum, in increasing order
+     */
+    void Cull(const Frustum& frustum, std::vector<uint32_t>& visibleIds, TaskScheduler* scheduler = nullptr);
+
+    uint32_t GetBoxesCount() const;
+
+  private:
+    /// \return Bit per box of the block, set for the ones intersecting the frustum
+    uint32_t CullBlock(const BoxBlock& block, const Frustum& frustum) const;
+
+    /// Calls func(chunkId, firstBlockId, lastBlockId) for every kChunkBlocksCount-long piece of the blocks
+    template <typename Func>
+    void ForEachChunk(TaskScheduler* scheduler, Func&& func) const {
+      uint32_t blocksCount = static_cast<uint32_t>(m_blocks.size());
+      auto task = [&func, blocksCount](uint32_t firstChunkId, uint32_t lastChunkId) {
+        for (uint32_t chunkId = firstChunkId; chunkId < lastChunkId; ++chunkId) {
+          uint32_t firstBlockId = chunkId * kChunkBlocksCount;
+          func(chunkId, firstBlockId, std::min(firstBlockId + kChunkBlocksCount, blocksCount));
+        }
+      };
+
+      uint32_t chunksCount = (blocksCount + kChunkBlocksCount - 1) / kChunkBlocksCount;
+      if (scheduler == nullptr) {
+        task(0, chunksCount);
+      } else {
+        scheduler->ParallelFor(0, chunksCount, 1, task);
+      }
+    }
+
+  public:
+    // Blocks per parallel task
+    static constexpr uint32_t kChunkBlocksCount = 512;
+
+  private:
+    std::vector<BoxBlock> m_blocks;
+    uint32_t m_boxesCount = 0;
+    // Scratch of Cull(): visibility bits of every block and visible boxes of every chunk, turned into offsets
+    std::vector<uint32_t> m_blockMasks;
+    std::vector<uint32_t> m_chunkOffsets;
+  };
+}
@@ -0,0 +1,205 @@
+#include "InstanceBvh.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+namespace Flame {
+  void InstanceBvh::Build(std::span<const Aabb> boxes) {
+    Reset();
+    if (boxes.empty()) {
+      return;
+    }
+
+    m_boxes = boxes;
+    m_nodes.reserve(boxes.size() * 2 - 1);
+    m_instanceIds.resize(boxes.size());
+    std::iota(m_instanceIds.begin(), m_instanceIds.end(), 0);
+    m_nodes.emplace_back();
+    InitNodes(0, 0, static_cast<uint32_t>(boxes.size()), 0);
+    m_boxes = {};
+
+    m_sahCost = CalculateSahCost();
+    m_builtSahCost = m_sahCost;
+  }
+
+  void InstanceBvh::Refit(std::span<const Aabb> boxes) {
+    assert(boxes.size() == m_instanceIds.size());
+    if (m_nodes.empty()) {
+      return;
+    }
+
+    // Children are always stored after their parent, so a reverse pass visits them first
+    for (uint32_t nodeId = static_cast<uint32_t>(m_nodes.size()); nodeId-- > 0;) {
+      Node& node = m_nodes[nodeId];
+      if (node.IsLeaf()) {
+        node.box = Aabb::Empty();
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+          node.box.Union(boxes[m_instanceIds[i]]);
+        }
+      } else {
+        node.box = m_nodes[node.offset].box;
+        node.box.Union(m_nodes[node.offset + 1].box);
+      }
+    }
+
+    m_sahCost = CalculateSahCost();
+    if (m_sahCost > m_builtSahCost * kRebuildSahRatio) {
+      Build(boxes);
+    }
+  }
+
+  void InstanceBvh::Reset() {
+    m_nodes.clear();
+    m_instanceIds.clear();
+    m_sahCost = 0.0f;
+    m_builtSahCost = 0.0f;
+  }
+
+  bool InstanceBvh::IsBuilt() const {
+    return !m_nodes.empty();
+  }
+
+  float InstanceBvh::GetSahCost() const {
+    return m_sahCost;
+  }
+
+  const std::vector<InstanceBvh::Node>& InstanceBvh::GetNodes() const {
+    return m_nodes;
+  }
+
+  void InstanceBvh::InitNodes(uint32_t nodeId, uint32_t begin, uint32_t end, uint32_t depth) {
+    Aabb box = Aabb::Empty();
+    for (uint32_t i = begin; i < end; ++i) {
+      box.Union(m_boxes[m_instanceIds[i]]);
+    }
+    m_nodes[nodeId].box = box;
+
+    uint32_t middle = begin;
+    if (end - begin > 1 && depth + 1 < MeshBvh::kMaxDepth) {
+      middle = Split(m_nodes[nodeId], begin, end);
+    }
+
+    if (middle == begin || middle == end) {
+      m_nodes[nodeId].offset = begin;
+      m_nodes[nodeId].count = end - begin;
+      return;
+    }
+
+    uint32_t leftId = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.emplace_back();
+    m_nodes.emplace_back();
+    m_nodes[nodeId].offset = leftId;
+    m_nodes[nodeId].count = 0;
+
+    InitNodes(leftId, begin, middle, depth + 1);
+    InitNodes(leftId + 1, middle, end, depth + 1);
+  }
+
+  uint32_t InstanceBvh::Split(const Node& node, uint32_t begin, uint32_t end) {
+    struct Bin final {
+      Aabb box = Aabb::Empty();
+      uint32_t count = 0;
+    };
+
+    Aabb centroidBox = Aabb::Empty();
+    for (uint32_t i = begin; i < end; ++i) {
+      glm::vec3 centroid = m_boxes[m_instanceIds[i]].Centroid();
+      centroidBox.Union(Aabb(centroid, centroid));
+    }
+
+    auto getBinId = [&centroidBox](const glm::vec3& centroid, uint32_t axis) {
+      float extent = centroidBox.Max()[axis] - centroidBox.Min()[axis];
+      float relative = (centroid[axis] - centroidBox.Min()[axis]) / extent;
+      return glm::min(static_cast<uint32_t>(relative * static_cast<float>(kBinCount)), kBinCount - 1);
+    };
+
+    float bestCost = std::numeric_limits<float>::infinity();
+    uint32_t bestAxis = 0;
+    uint32_t bestPlane = 0;
+
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      if (centroidBox.Max()[axis] <= centroidBox.Min()[axis]) {
+        continue;
+      }
+
+      Bin bins[kBinCount];
+      for (uint32_t i = begin; i < end; ++i) {
+        const Aabb& box = m_boxes[m_instanceIds[i]];
+        Bin& bin = bins[getBinId(box.Centroid(), axis)];
+        bin.box.Union(box);
+        ++bin.count;
+      }
+
+      float areasRight[kBinCount - 1];
+      uint32_t countsRight[kBinCount - 1];
+      Aabb accumulated = Aabb::Empty();
+      uint32_t count = 0;
+      for (uint32_t i = kBinCount - 1; i > 0; --i) {
+        accumulated.Union(bins[i].box);
+        count += bins[i].count;
+        areasRight[i - 1] = accumulated.SurfaceArea();
+        countsRight[i - 1] = count;
+      }
+
+      accumulated = Aabb::Empty();
+      count = 0;
+      for (uint32_t i = 0; i < kBinCount - 1; ++i) {
+        accumulated.Union(bins[i].box);
+        count += bins[i].count;
+        if (count == 0 || countsRight[i] == 0) {
+          continue;
+        }
+
+        float cost = static_cast<float>(count) * accumulated.SurfaceArea() + static_cast<float>(countsRight[i]) * areasRight[i];
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestAxis = axis;
+          bestPlane = i;
+        }
+      }
+    }
+
+    uint32_t count = end - begin;
+    if (bestCost == std::numeric_limits<float>::infinity()) {
+      // Instances sharing one position (e.g. spawned at the origin) are split in halves to keep leaves small
+      return count > kMaxLeafSize ? begin + count / 2 : begin;
+    }
+
+    float area = node.box.SurfaceArea();
+    float splitCost = kTraversalCost + (area > 0.0f ? kIntersectionCost * bestCost / area : 0.0f);
+    float leafCost = kIntersectionCost * static_cast<float>(count);
+    if (splitCost >= leafCost && count <= kMaxLeafSize) {
+      return begin;
+    }
+
+    auto middle = std::partition(m_instanceIds.begin() + begin, m_instanceIds.begin() + end, [this, &getBinId, bestAxis, bestPlane](uint32_t id) {
+      return getBinId(m_boxes[id].Centroid(), bestAxis) <= bestPlane;
+    });
+
+    return static_cast<uint32_t>(middle - m_instanceIds.begin());
+  }
+
+  float InstanceBvh::CalculateSahCost() const {
+    if (m_nodes.empty()) {
+      return 0.0f;
+    }
+
+    float rootArea = m_nodes[0].box.SurfaceArea();
+    if (rootArea <= 0.0f) {
+      return 0.0f;
+    }
+
+    float cost = 0.0f;
+    for (const Node& node : m_nodes) {
+      float probability = node.box.SurfaceArea() / rootArea;
+      if (node.IsLeaf()) {
+        cost += kIntersectionCost * probability * static_cast<float>(node.count);
+      } else {
+        cost += kTraversalCost * probability;
+      }
+    }
+
+    return cost;
+  }
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "MeshBvh.h"
+#include "RayPacket.h"
+#include "Flame/math/Aabb.h"
+#include "Flame/math/Ray.h"
+
+namespace Flame {
+  /**
+   * Top-level BVH over world-space bounds of instances. Knows nothing about what's inside the boxes:
+   * Hit() reports candidate instance ids to a callback, which does the real intersection.
+   * Moved instances are handled with Refit(), which only rebuilds when the tree got too loose
+   */
+  struct InstanceBvh final {
+    using Node = MeshBvh::MeshBvhNode;
+
+    void Build(std::span<const Aabb> boxes);
+    /// Updates bounds of the existing tree bottom-up. Number of boxes must match the last Build()
+    void Refit(std::span<const Aabb> boxes);
+    void Reset();
+
+    /**
+     * Closest-hit traversal
+     * \param hitInstance bool(uint32_t instanceId, float tMin, float& tMax), on hit returns true and shrinks tMax to the hit time
+     */
+    template <typename HitInstanceFunc>
+    bool Hit(const Ray& r, float tMin, float tMax, HitInstanceFunc&& hitInstance) const {
+      struct StackEntry final {
+        uint32_t nodeId;
+        float entryTime;
+      };
+
+      glm::vec3 invDirection = 1.0f / r.direction;
+
+      float entryTime;
+      if (m_nodes.empty() || !m_nodes[0].box.Hit(r.origin, invDirection, tMin, tMax, entryTime)) {
+        return false;
+      }
+
+      StackEntry stack[MeshBvh::kMaxDepth];
+      uint32_t stackSize = 0;
+      stack[stackSize++] = { 0, entryTime };
+      bool anyHit = false;
+
+      while (stackSize != 0) {
+        const StackEntry entry = stack[--stackSize];
+        if (entry.entryTime > tMax) {
+          continue;
+        }
+
+        const Node& node = m_nodes[entry.nodeId];
+        if (node.IsLeaf()) {
+          for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+            if (hitInstance(m_instanceIds[i], tMin, tMax)) {
+              anyHit = true;
+            }
+          }
+
+          continue;
+        }
+
+        // Push the farthest child first, so the nearest one is popped next
+        uint32_t nearId = node.offset;
+        uint32_t farId = node.offset + 1;
+        float nearEntryTime;
+        float farEntryTime;
+        bool nearHit = m_nodes[nearId].box.Hit(r.origin, invDirection, tMin, tMax, nearEntryTime);
+        bool farHit = m_nodes[farId].box.Hit(r.origin, invDirection, tMin, tMax, farEntryTime);
+
+        if (farHit && (!nearHit || farEntryTime < nearEntryTime)) {
+          std::swap(nearId, farId);
+          std::swap(nearHit, farHit);
+          std::swap(nearEntryTime, farEntryTime);
+        }
+
+        assert(stackSize + 2 <= MeshBvh::kMaxDepth);
+        if (farHit) {
+          stack[stackSize++] = { farId, farEntryTime };
+        }
+        if (nearHit) {
+          stack[stackSize++] = { nearId, nearEntryTime };
+        }
+      }
+
+      return anyHit;
+    }
+
+    /**
+     * Any-hit traversal, stops as soon as the callback reports a hit
+     * \param occludedInstance bool(uint32_t instanceId)
+     */
+    template <typename OccludedInstanceFunc>
+    bool Occluded(const Ray& r, float tMin, float tMax, OccludedInstanceFunc&& occludedInstance) const {
+      glm::vec3 invDirection = 1.0f / r.direction;
+
+      float entryTime;
+      if (m_nodes.empty() || !m_nodes[0].box.Hit(r.origin, invDirection, tMin, tMax, entryTime)) {
+        return false;
+      }
+
+      uint32_t stack[MeshBvh::kMaxDepth];
+      uint32_t stackSize = 0;
+      stack[stackSize++] = 0;
+
+      while (stackSize != 0) {
+        const Node& node = m_nodes[stack[--stackSize]];
+        if (node.IsLeaf()) {
+          for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+            if (occludedInstance(m_instanceIds[i])) {
+              return true;
+            }
+          }
+
+          continue;
+        }
+
+        assert(stackSize + 2 <= MeshBvh::kMaxDepth);
+        for (uint32_t childId = node.offset; childId < node.offset + 2; ++childId) {
+          if (m_nodes[childId].box.Hit(r.origin, invDirection, tMin, tMax, entryTime)) {
+            stack[stackSize++] = childId;
+          }
+        }
+      }
+
+      return false;
+    }
+
+    /**
+     * Packet traversal, see RayPacket
+     * \param hitInstance void(uint32_t instanceId, uint32_t laneMask), shrinks tMax of the packet lanes that hit
+     */
+    template <typename HitInstanceFunc>
+    void Hit(const RayPacketWide& packet, HitInstanceFunc&& hitInstance) const {
+      packet.Traverse(m_nodes, [&](const Node& leaf, uint32_t laneMask) {
+        for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; ++i) {
+          hitInstance(m_instanceIds[i], laneMask);
+        }
+      });
+    }
+
+    bool IsBuilt() const;
+    /// \return SAH cost of the current tree, relative to the root surface area
+    float GetSahCost() const;
+    const std::vector<Node>& GetNodes() const;
+
+  private:
+    void InitNodes(uint32_t nodeId, uint32_t begin, uint32_t end, uint32_t depth);
+    uint32_t Split(const Node& node, uint32_t begin, uint32_t end);
+    float CalculateSahCost() const;
+
+  public:
+    static constexpr uint32_t kBinCount = 16;
+    static constexpr uint32_t kMaxLeafSize = 4;
+    static constexpr float kTraversalCost = 1.0f;
+    // Instance test means a matrix transform and a whole mesh BVH traversal
+    static constexpr float kIntersectionCost = 4.0f;
+    // Refitted tree is rebuilt once it gets this much worse than the freshly built one
+    static constexpr float kRebuildSahRatio = 1.5f;
+
+  private:
+    // Instance bounds, only alive during Build()
+    std::span<const Aabb> m_boxes;
+    std::vector<Node> m_nodes;
+    // Instance indices ordered so that every leaf references a contiguous range
+    std::vector<uint32_t> m_instanceIds;
+    float m_sahCost = 0.0f;
+    float m_builtSahCost = 0.0f;
+  };
+}
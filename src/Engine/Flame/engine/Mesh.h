@@ -4,10 +4,14 @@
 #include <vector>
 #include <assimp/mesh.h>
 #include <assimp/vector3.h>
+#include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
 #include "MeshBvh.h"
+#include "MeshWideBvh.h"
+#include "RayPacket.h"
 #include "Flame/math/Aabb.h"
 #include "Flame/math/HitRecord.h"
+#include "Flame/math/RayStream.h"
 
 namespace Flame {
   struct Face final {
@@ -16,11 +20,15 @@ namespace Flame {
 
   struct Mesh final {
     Mesh()
-    : bvh(this) {
+    : bvh(this)
+    , wideBvh(this) {
     }
 
     bool Hit(const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const {
-      if (!bvh.Hit(r, record, tMin, tMax)) {
+      bool isHit = wideBvh.IsBuilt()
+        ? wideBvh.Hit(r, record, tMin, tMax)
+        : bvh.Hit(r, record, tMin, tMax);
+      if (!isHit) {
         return false;
       }
 
@@ -28,6 +36,51 @@ namespace Flame {
       return true;
     }
 
+    /// Any-hit query, see MeshBvh::Occluded()
+    bool Occluded(const Ray& r, float tMin, float tMax) const {
+      return wideBvh.IsBuilt()
+        ? wideBvh.Occluded(r, tMin, tMax)
+        : bvh.Occluded(r, tMin, tMax);
+    }
+
+    /**
+     * Closest hits of every ray of the stream: coherent packets traverse the BVH together, the rest one by one.
+     * Packets stay on the binary bvh even when wideBvh is built: they already fill the SIMD lanes with rays, one box
+     * per step, while the wide nodes fill them with children of a single ray. The binary tree is always there,
+     * since the wide one is collapsed from it. Rays left out of packets use wideBvh as Hit(const Ray&) does
+     * \param hits Set to 1 for rays that hit, their records are filled
+     * \return Number of rays that hit
+     */
+    uint32_t Hit(const RayStream& rays, std::span<HitRecord<const Mesh*>> records, std::span<uint8_t> hits) const {
+      assert(records.size() >= rays.Size() && hits.size() >= rays.Size());
+      uint32_t hitsCount = 0;
+
+      ForEachRayPacket(rays, [&](RayPacketWide& packet, uint32_t firstRayId) {
+        HitRecord<const Mesh*> packetRecords[kSimdWidth];
+        uint32_t hitMask = bvh.Hit(packet, packetRecords);
+
+        for (uint32_t lane = 0; lane < kSimdWidth; ++lane) {
+          if ((packet.activeMask & (1u << lane)) == 0) {
+            continue;
+          }
+
+          bool isHit = (hitMask & (1u << lane)) != 0;
+          hits[firstRayId + lane] = isHit;
+          if (isHit) {
+            packetRecords[lane].data = this;
+            records[firstRayId + lane] = packetRecords[lane];
+            ++hitsCount;
+          }
+        }
+      }, [&](uint32_t rayId) {
+        bool isHit = Hit(rays.Get(rayId), records[rayId], rays.tMin[rayId], rays.tMax[rayId]);
+        hits[rayId] = isHit;
+        hitsCount += isHit;
+      });
+
+      return hitsCount;
+    }
+
     void Parse(const aiMesh& mesh) {
       assert(sizeof(aiVector3D) == sizeof(glm::vec3));
       assert(sizeof(aiAABB) == sizeof(Aabb));
@@ -62,13 +115,56 @@ namespace Flame {
         std::memcpy(faces.data() + i, mesh.mFaces[i].mIndices, 3 * sizeof(uint32_t));
       }
       std::memcpy(&box, &mesh.mAABB, sizeof(aiAABB));
+      ++boxVersion;
       name = mesh.mName.C_Str();
+    }
+
+    /// \param scheduler Spreads the build of a single big mesh over threads, see MeshBvh::Build()
+    void BuildBvh(TaskScheduler* scheduler = nullptr) {
+      bvh.Build(scheduler);
+      ++boxVersion;
+      // Keep the wide BVH in sync if it's used
+      if (wideBvh.IsBuilt()) {
+        wideBvh.Build();
+      }
+    }
+
+    void BuildBvh(MeshBvh::BuildMode mode) {
+      bvh.SetBuildMode(mode);
+      BuildBvh();
+    }
+
+    /**
+     * Updates the BVH after vertices moved, see MeshBvh::Refit(). Collapsing is linear,
+     * so the wide BVH is simply collapsed again
+     */
+    void RefitBvh(TaskScheduler* scheduler = nullptr) {
+      bvh.Refit(scheduler);
+      box = bvh.GetBounds();
+      ++boxVersion;
+      if (wideBvh.IsBuilt()) {
+        wideBvh.Build();
+      }
+    }
+
+    /// Collapses the built BVH into the SIMD one, which is then used by Hit()
+    void BuildWideBvh() {
+      wideBvh.Build();
+    }
 
-      bvh.Build();
+    /**
+     * Places the mesh in the world for an instance of its model. Meshes have at most one meshToModel
+     * transform, which is applied before the model one
+     */
+    glm::mat4 GetMeshToWorld(const glm::mat4& modelToWorld) const {
+      assert(transforms.size() <= 1);
+      return transforms.empty() ? modelToWorld : modelToWorld * transforms[0];
     }
 
-    void BuildBvh() {
-      bvh.Build();
+    /// Inverse of GetMeshToWorld()
+    glm::mat4 GetWorldToMesh(const glm::mat4& worldToModel) const {
+      assert(transformsInv.size() <= 1);
+      return transformsInv.empty() ? worldToModel : transformsInv[0] * worldToModel;
     }
 
   public:
@@ -83,7 +179,10 @@ namespace Flame {
     std::vector<glm::mat4> transformsInv;
     std::vector<Face> faces;
     Aabb box;
+    // Bumped whenever box or the BVH bounds change, so that instances of the mesh know to update their bounds
+    uint32_t boxVersion = 0;
     MeshBvh bvh;
+    MeshBvhWide wideBvh;
   };
 }
 
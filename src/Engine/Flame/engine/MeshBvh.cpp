@@ -1,24 +1,51 @@
 #include "MeshBvh.h"
 
+#include <algorithm>
+#include <bit>
 #include <iostream>
+#include <limits>
 #include <numeric>
 
 #include "Mesh.h"
+#include "RayPacket.h"
 #include "Flame/math/MathUtils.h"
+#include "Flame/utils/RadixSort.h"
+#include "Flame/utils/TaskScheduler.h"
+#include "Flame/utils/Timer.h"
 
 namespace Flame {
-  MeshBvh::MeshBvhNode::MeshBvhNode()
-  : leftId(std::numeric_limits<uint32_t>::max())
-  , rightId(std::numeric_limits<uint32_t>::max()) {
+  namespace {
+    uint32_t GetChunksCount(uint32_t begin, uint32_t end) {
+      return (end - begin + MeshBvh::kParallelChunkSize - 1) / MeshBvh::kParallelChunkSize;
+    }
 
+    // Calls func(chunkId, chunkBegin, chunkEnd) for every kParallelChunkSize-long piece of [begin; end)
+    template <typename Func>
+    void ForEachChunk(TaskScheduler* scheduler, uint32_t begin, uint32_t end, Func&& func) {
+      uint32_t chunksCount = GetChunksCount(begin, end);
+      auto task = [&func, begin, end](uint32_t firstChunkId, uint32_t lastChunkId) {
+        for (uint32_t chunkId = firstChunkId; chunkId < lastChunkId; ++chunkId) {
+          uint32_t chunkBegin = begin + chunkId * MeshBvh::kParallelChunkSize;
+          func(chunkId, chunkBegin, glm::min(chunkBegin + MeshBvh::kParallelChunkSize, end));
+        }
+      };
+
+      if (scheduler == nullptr) {
+        task(0, chunksCount);
+      } else {
+        scheduler->ParallelFor(0, chunksCount, 1, task);
+      }
+    }
   }
 
   MeshBvh::MeshBvh(const Mesh* mesh)
   : m_mesh(mesh) {
   }
 
-  void MeshBvh::Build() {
+  void MeshBvh::Build(TaskScheduler* scheduler) {
     assert(m_mesh->faces.size() != 0);
+    Timer timer;
+    m_scheduler = scheduler;
     m_boxes.clear();
     m_nodes.clear();
 
@@ -26,170 +53,1056 @@ namespace Flame {
     m_nodes.reserve(m_boxes.size() * 2 - 1);
 
     // Indices of faces
-    std::vector<uint32_t> indices(m_boxes.size());
-    std::iota(indices.begin(), indices.end(), 0);
-    InitNodes(std::move(indices));
+    m_faceIds.resize(m_boxes.size());
+    std::iota(m_faceIds.begin(), m_faceIds.end(), 0);
+    if (m_buildMode == BuildMode::LINEAR_MORTON) {
+      if (m_faceIds.size() > kLinearWideCodeThreshold) {
+        InitNodesLinear<uint64_t>();
+      } else {
+        InitNodesLinear<uint32_t>();
+      }
+    } else if (m_buildMode == BuildMode::SPATIAL_SAH) {
+      InitNodesSpatial();
+    } else {
+      m_nodes.emplace_back();
+      InitNodes(m_nodes, 0, 0, static_cast<uint32_t>(m_faceIds.size()), 0, m_scheduler != nullptr);
+      InitSubtrees();
+    }
+    m_scheduler = nullptr;
 
     m_nodes.shrink_to_fit();
+    m_sahCost = CalculateSahCost();
+    m_builtSahCost = m_sahCost;
+    InitTriangles();
+
+    // Bounds are baked into nodes
+    m_boxes.clear();
+    m_boxes.shrink_to_fit();
+    m_buildTime = timer.GetTimeSinceTick();
   }
 
-  bool MeshBvh::Hit(const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const {
-    return HitNode(0, r, record, tMin, tMax);
+  void MeshBvh::Load(std::vector<MeshBvhNode> nodes, std::vector<uint32_t> faceIds) {
+    assert(faceIds.size() >= m_mesh->faces.size());
+    m_nodes = std::move(nodes);
+    m_faceIds = std::move(faceIds);
+    m_sahCost = CalculateSahCost();
+    m_builtSahCost = m_sahCost;
+    InitTriangles();
+    m_buildTime = 0.0f;
   }
 
-  bool MeshBvh::HitFace(uint32_t faceId, const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const {
-    glm::vec3 vertices[3] = {
-      m_mesh->vertices[m_mesh->faces[faceId].indices[0]],
-      m_mesh->vertices[m_mesh->faces[faceId].indices[1]],
-      m_mesh->vertices[m_mesh->faces[faceId].indices[2]],
+  bool MeshBvh::Refit(TaskScheduler* scheduler) {
+    // Split references get whole face bounds back, which is conservative but correct
+    assert(!m_nodes.empty() && m_faceIds.size() >= m_mesh->faces.size());
+
+    InitNodeBounds(scheduler);
+    if (!m_triangles.empty()) {
+      ForEachChunk(scheduler, 0, static_cast<uint32_t>(m_faceIds.size()), [this](uint32_t, uint32_t begin, uint32_t end) {
+        for (uint32_t id = begin; id < end; ++id) {
+          const Face& face = m_mesh->faces[m_faceIds[id]];
+          glm::vec3 v0 = m_mesh->vertices[face.indices[0]];
+          m_triangles[id] = { v0, m_mesh->vertices[face.indices[1]] - v0, m_mesh->vertices[face.indices[2]] - v0 };
+        }
+      });
+    }
+
+    m_sahCost = CalculateSahCost();
+    if (m_sahCost <= m_builtSahCost * kRefitRebuildSahRatio) {
+      return false;
+    }
+
+    Build(scheduler);
+    return true;
+  }
+
+  bool MeshBvh::Hit(const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const {
+    struct StackEntry final {
+      uint32_t nodeId;
+      float entryTime;
     };
 
-    glm::vec3 v0v1 = vertices[1] - vertices[0];
-	  glm::vec3 v0v2 = vertices[2] - vertices[0];
-
-	  glm::vec3 pvec = glm::cross(r.direction, v0v2);
-	  float det = glm::dot(v0v1, pvec);
-	  if (det < 0.00001) {
-		  return false;
-	  }
-
-	  float invDet = 1.0f / det;
-	  glm::vec3 tvec = r.origin - vertices[0];
-
-	  float u = glm::dot(tvec, pvec) * invDet;
-	  if (u < 0 || u > 1) {
-		  return false;
-	  }
-
-	  glm::vec3 qvec = glm::cross(tvec, v0v1);
-	  float v = glm::dot(r.direction, qvec) * invDet;
-	  if (v < 0 || u + v > 1) {
-		  return false;
-	  }
-
-	  float t = glm::dot(v0v2, qvec) * invDet;
-    if (t > tMin && t < tMax) {
-      glm::vec3 normals[3] = {
-        m_mesh->normals[m_mesh->faces[faceId].indices[0]],
-        m_mesh->normals[m_mesh->faces[faceId].indices[1]],
-        m_mesh->normals[m_mesh->faces[faceId].indices[2]],
-      };
-      glm::vec3 barycentric = MathUtils::ToBarycentric(record.point, vertices);
-
-      record.time = t;
-      record.point = r.AtParameter(t);
-      // Interpolate normal
-      //record.normal = barycentric.x * normals[0] + barycentric.y * normals[1] + barycentric.z * normals[2];
-      record.normal = glm::cross(v0v1, v0v2);
-	    return true;
-    }
-
-	  return false;
-  }
-
-  bool MeshBvh::HitNode(uint32_t nodeId, const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const {
-    // BVH hit algorithm:
-    // 1. Determine if current box is even being hit
-    // 1.1.If not - return false
-    // 1.2 If yes: ->2/3
-    // 2. If current object is a leaf - determine if underlying IHitable is being hit
-    // 2.1 If not - return false
-    // 2.2 If yes - return true, time OF THE CLOSEST
-    // 3. If current Object is a compound - call Hit() for children
-    // 3.1 If none was hit - return false
-    // 3.2 If one was hit - return true and its record
-    // 3.3 If both were hit - compare time and return true and record of the closest one
-
-    const MeshBvhNode& node = m_nodes[nodeId];
-
-    // If bound wasn't hit - no hit
-    {
-      HitRecord<const Aabb*> record0;
-      if (!node.box.Hit(r, record0, tMin, tMax)) {
+    // Computed once per ray instead of once per box
+    glm::vec3 invDirection = 1.0f / r.direction;
+
+    FLAME_BVH_COUNT(queriesCount, 1);
+    FLAME_BVH_COUNT(boxTests, 1);
+    float entryTime;
+    if (m_nodes.empty() || !m_nodes[0].box.Hit(r.origin, invDirection, tMin, tMax, entryTime)) {
+      return false;
+    }
+
+    // Depth is limited by kMaxDepth, so the far children never overflow the stack
+    StackEntry stack[kMaxDepth];
+    uint32_t stackSize = 0;
+    uint32_t nodeId = 0;
+    bool anyHit = false;
+
+    while (true) {
+      const MeshBvhNode& node = m_nodes[nodeId];
+      FLAME_BVH_COUNT(nodesVisited, 1);
+
+      if (node.IsLeaf()) {
+        FLAME_BVH_COUNT(triangleTests, node.count);
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+          if (HitTriangle(GetTriangle(i), r, record, tMin, tMax)) {
+            anyHit = true;
+            tMax = record.time;
+          }
+        }
+      } else {
+        // Visit the nearest child first, postpone the farthest one
+        uint32_t nearId = node.offset;
+        uint32_t farId = node.offset + 1;
+        float nearEntryTime;
+        float farEntryTime;
+        FLAME_BVH_COUNT(boxTests, 2);
+        bool nearHit = m_nodes[nearId].box.Hit(r.origin, invDirection, tMin, tMax, nearEntryTime);
+        bool farHit = m_nodes[farId].box.Hit(r.origin, invDirection, tMin, tMax, farEntryTime);
+
+        if (farHit && (!nearHit || farEntryTime < nearEntryTime)) {
+          std::swap(nearId, farId);
+          std::swap(nearHit, farHit);
+          std::swap(nearEntryTime, farEntryTime);
+        }
+
+        if (nearHit) {
+          if (farHit) {
+            assert(stackSize < kMaxDepth);
+            stack[stackSize++] = { farId, farEntryTime };
+          }
+
+          nodeId = nearId;
+          continue;
+        }
+      }
+
+      // Pop the next node, skipping ones that are behind the closest hit
+      bool found = false;
+      while (stackSize != 0) {
+        const StackEntry& entry = stack[--stackSize];
+        if (entry.entryTime <= tMax) {
+          nodeId = entry.nodeId;
+          found = true;
+          break;
+        }
+      }
+
+      if (!found) {
+        break;
+      }
+    }
+
+    return anyHit;
+  }
+
+  bool MeshBvh::Occluded(const Ray& r, float tMin, float tMax) const {
+    glm::vec3 invDirection = 1.0f / r.direction;
+
+    FLAME_BVH_COUNT(queriesCount, 1);
+    FLAME_BVH_COUNT(boxTests, 1);
+    float entryTime;
+    if (m_nodes.empty() || !m_nodes[0].box.Hit(r.origin, invDirection, tMin, tMax, entryTime)) {
+      return false;
+    }
+
+    uint32_t stack[kMaxDepth];
+    uint32_t stackSize = 0;
+    uint32_t nodeId = 0;
+
+    while (true) {
+      const MeshBvhNode& node = m_nodes[nodeId];
+      FLAME_BVH_COUNT(nodesVisited, 1);
+
+      if (node.IsLeaf()) {
+        float time;
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+          FLAME_BVH_COUNT(triangleTests, 1);
+          if (IntersectTriangle(GetTriangle(i), r, tMin, tMax, time)) {
+            return true;
+          }
+        }
+      } else {
+        // Any hit will do, so there's no point in ordering the children by distance
+        uint32_t leftId = node.offset;
+        uint32_t rightId = node.offset + 1;
+        FLAME_BVH_COUNT(boxTests, 2);
+        bool leftHit = m_nodes[leftId].box.Hit(r.origin, invDirection, tMin, tMax, entryTime);
+        bool rightHit = m_nodes[rightId].box.Hit(r.origin, invDirection, tMin, tMax, entryTime);
+
+        if (leftHit || rightHit) {
+          if (leftHit && rightHit) {
+            assert(stackSize < kMaxDepth);
+            stack[stackSize++] = rightId;
+          }
+
+          nodeId = leftHit ? leftId : rightId;
+          continue;
+        }
+      }
+
+      if (stackSize == 0) {
         return false;
       }
+
+      nodeId = stack[--stackSize];
     }
+  }
+
+  uint32_t MeshBvh::Hit(RayPacket<kSimdWidth>& packet, std::span<HitRecord<const Mesh*>, kSimdWidth> records) const {
+    using Float = SimdFloat<kSimdWidth>;
+
+    Float originX = Float::Load(packet.originX);
+    Float originY = Float::Load(packet.originY);
+    Float originZ = Float::Load(packet.originZ);
+    Float directionX = Float::Load(packet.directionX);
+    Float directionY = Float::Load(packet.directionY);
+    Float directionZ = Float::Load(packet.directionZ);
+    Float tMin = Float::Load(packet.tMin);
+    Float zero(0.0f);
+    Float one(1.0f);
+
+    uint32_t hitMask = 0;
+    uint32_t hitTriangleIds[kSimdWidth];
+
+    packet.Traverse(m_nodes, [&](const MeshBvhNode& leaf, uint32_t laneMask) {
+      Float tMax = Float::Load(packet.tMax);
+
+      for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; ++i) {
+        // Moller-Trumbore, same as IntersectTriangle() but one triangle against every lane
+        const Triangle triangle = GetTriangle(i);
+        const glm::vec3& v0 = triangle.v0;
+        const glm::vec3& e1 = triangle.e1;
+        const glm::vec3& e2 = triangle.e2;
+
+        Float px = directionY * Float(e2.z) - directionZ * Float(e2.y);
+        Float py = directionZ * Float(e2.x) - directionX * Float(e2.z);
+        Float pz = directionX * Float(e2.y) - directionY * Float(e2.x);
+        Float det = Float(e1.x) * px + Float(e1.y) * py + Float(e1.z) * pz;
+        Float mask = det >= Float(0.00001f);
+        if ((mask.Mask() & laneMask) == 0) {
+          continue;
+        }
 
-    // If leaf
-    if (!node.boxesId.empty()) {
-      HitRecord<const Mesh*> record0;
-      record0.time = tMax;
-      bool anyHit = false;
-      for (uint32_t id : node.boxesId) {
-        if (HitFace(id, r, record0, tMin, record0.time)) {
-          anyHit = true;
+        Float invDet = one / det;
+        Float tx = originX - Float(v0.x);
+        Float ty = originY - Float(v0.y);
+        Float tz = originZ - Float(v0.z);
+
+        Float u = (tx * px + ty * py + tz * pz) * invDet;
+        mask = mask & (u >= zero) & (u <= one);
+
+        Float qx = ty * Float(e1.z) - tz * Float(e1.y);
+        Float qy = tz * Float(e1.x) - tx * Float(e1.z);
+        Float qz = tx * Float(e1.y) - ty * Float(e1.x);
+        Float v = (directionX * qx + directionY * qy + directionZ * qz) * invDet;
+        mask = mask & (v >= zero) & (u + v <= one);
+
+        Float t = (Float(e2.x) * qx + Float(e2.y) * qy + Float(e2.z) * qz) * invDet;
+        mask = mask & (t > tMin) & (t < tMax);
+
+        uint32_t bits = mask.Mask() & laneMask;
+        if (bits == 0) {
+          continue;
+        }
+
+        tMax = Float::Select(mask, t, tMax);
+        hitMask |= bits;
+        for (; bits != 0; bits &= bits - 1) {
+          hitTriangleIds[std::countr_zero(bits)] = i;
         }
       }
 
-      if (anyHit) {
-        record = record0;
-        return true;
+      tMax.Store(packet.tMax);
+    });
+
+    for (uint32_t bits = hitMask; bits != 0; bits &= bits - 1) {
+      uint32_t lane = static_cast<uint32_t>(std::countr_zero(bits));
+      const Triangle triangle = GetTriangle(hitTriangleIds[lane]);
+
+      HitRecord<const Mesh*>& record = records[lane];
+      record.time = packet.tMax[lane];
+      record.point = packet.GetRay(lane).AtParameter(record.time);
+      record.normal = glm::cross(triangle.e1, triangle.e2);
+    }
+
+    return hitMask;
+  }
+
+  void MeshBvh::SetBuildMode(BuildMode mode) {
+    assert(mode < BuildMode::COUNT);
+    m_buildMode = mode;
+  }
+
+  MeshBvh::BuildMode MeshBvh::GetBuildMode() const {
+    return m_buildMode;
+  }
+
+  void MeshBvh::SetPrecomputeTriangles(bool isEnabled) {
+    m_isPrecomputingTriangles = isEnabled;
+    InitTriangles();
+  }
+
+  bool MeshBvh::IsPrecomputingTriangles() const {
+    return m_isPrecomputingTriangles;
+  }
+
+  void MeshBvh::SetSpatialSplitBudget(float budget) {
+    assert(budget >= 0.0f);
+    m_spatialSplitBudget = budget;
+  }
+
+  float MeshBvh::GetSpatialSplitBudget() const {
+    return m_spatialSplitBudget;
+  }
+
+  size_t MeshBvh::GetMemoryUsage() const {
+    return m_nodes.capacity() * sizeof(MeshBvhNode)
+      + m_faceIds.capacity() * sizeof(uint32_t)
+      + GetTrianglesMemoryUsage();
+  }
+
+  size_t MeshBvh::GetTrianglesMemoryUsage() const {
+    return m_triangles.capacity() * sizeof(Triangle);
+  }
+
+  float MeshBvh::GetSahCost() const {
+    return m_sahCost;
+  }
+
+  float MeshBvh::GetBuildTime() const {
+    return m_buildTime;
+  }
+
+  BvhBuildStats MeshBvh::CalculateBuildStats() const {
+    struct StackEntry final {
+      uint32_t nodeId;
+      uint32_t depth;
+    };
+
+    BvhBuildStats stats;
+    stats.facesCount = static_cast<uint32_t>(m_mesh->faces.size());
+    stats.referencesCount = static_cast<uint32_t>(m_faceIds.size());
+    stats.nodesCount = static_cast<uint32_t>(m_nodes.size());
+    stats.sahCost = m_sahCost;
+    stats.memoryUsage = GetMemoryUsage();
+    stats.buildTime = m_buildTime;
+    if (m_nodes.empty()) {
+      return stats;
+    }
+
+    // Depth isn't stored in nodes, so it's tracked along the way down. Both children are pushed, hence the extra entry
+    StackEntry stack[kMaxDepth + 1];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = { 0, 0 };
+    uint64_t leafDepthSum = 0;
+
+    while (stackSize != 0) {
+      const StackEntry entry = stack[--stackSize];
+      const MeshBvhNode& node = m_nodes[entry.nodeId];
+      stats.maxDepth = std::max(stats.maxDepth, entry.depth);
+
+      if (node.IsLeaf()) {
+        ++stats.leavesCount;
+        stats.maxLeafSize = std::max(stats.maxLeafSize, node.count);
+        ++stats.leafSizeHistogram[std::min(node.count, BvhBuildStats::kLeafSizeBucketsCount - 1)];
+        leafDepthSum += static_cast<uint64_t>(entry.depth) * node.count;
+        continue;
       }
 
+      assert(stackSize + 2 <= kMaxDepth + 1);
+      stack[stackSize++] = { node.offset, entry.depth + 1 };
+      stack[stackSize++] = { node.offset + 1, entry.depth + 1 };
+    }
+
+    if (!m_faceIds.empty()) {
+      stats.averageLeafDepth = static_cast<float>(leafDepthSum) / static_cast<float>(m_faceIds.size());
+    }
+
+    return stats;
+  }
+
+  const Aabb& MeshBvh::GetBounds() const {
+    assert(!m_nodes.empty());
+    return m_nodes[0].box;
+  }
+
+  const Mesh* MeshBvh::GetMesh() const {
+    return m_mesh;
+  }
+
+  const std::vector<MeshBvh::MeshBvhNode>& MeshBvh::GetNodes() const {
+    return m_nodes;
+  }
+
+  const std::vector<uint32_t>& MeshBvh::GetFaceIds() const {
+    return m_faceIds;
+  }
+
+  MeshBvh::Triangle MeshBvh::GetTriangle(uint32_t id) const {
+    if (!m_triangles.empty()) {
+      return m_triangles[id];
+    }
+
+    const Face& face = m_mesh->faces[m_faceIds[id]];
+    glm::vec3 v0 = m_mesh->vertices[face.indices[0]];
+    return { v0, m_mesh->vertices[face.indices[1]] - v0, m_mesh->vertices[face.indices[2]] - v0 };
+  }
+
+  bool MeshBvh::HitTriangle(const Triangle& triangle, const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) {
+    float time;
+    if (!IntersectTriangle(triangle, r, tMin, tMax, time)) {
+      return false;
+    }
+
+    record.time = time;
+    record.point = r.AtParameter(time);
+    record.normal = glm::cross(triangle.e1, triangle.e2);
+    return true;
+  }
+
+  bool MeshBvh::IntersectTriangle(const Triangle& triangle, const Ray& r, float tMin, float tMax, float& time) {
+    glm::vec3 pvec = glm::cross(r.direction, triangle.e2);
+    float det = glm::dot(triangle.e1, pvec);
+    if (det < 0.00001) {
+      return false;
+    }
+
+    float invDet = 1.0f / det;
+    glm::vec3 tvec = r.origin - triangle.v0;
+
+    float u = glm::dot(tvec, pvec) * invDet;
+    if (u < 0 || u > 1) {
       return false;
     }
 
-    // If compound
-    HitRecord<const Mesh*> record0;
-    record0.time = tMax;
-    bool anyHit = HitNode(node.leftId, r, record0, tMin, record0.time);
-    anyHit |= HitNode(node.rightId, r, record0, tMin, record0.time);
-    if (anyHit) {
-      record = record0;
-      return true;
+    glm::vec3 qvec = glm::cross(tvec, triangle.e1);
+    float v = glm::dot(r.direction, qvec) * invDet;
+    if (v < 0 || u + v > 1) {
+      return false;
     }
 
-    return false;
+    time = glm::dot(triangle.e2, qvec) * invDet;
+    return time > tMin && time < tMax;
+  }
+
+  void MeshBvh::InitTriangles() {
+    m_triangles.clear();
+    if (!m_isPrecomputingTriangles || m_faceIds.empty()) {
+      m_triangles.shrink_to_fit();
+      return;
+    }
+
+    // Gathered once here, so that traversal reads a leaf's triangles as one contiguous block
+    m_triangles.reserve(m_faceIds.size());
+    for (uint32_t id = 0; id < m_faceIds.size(); ++id) {
+      const Face& face = m_mesh->faces[m_faceIds[id]];
+      glm::vec3 v0 = m_mesh->vertices[face.indices[0]];
+      m_triangles.push_back({ v0, m_mesh->vertices[face.indices[1]] - v0, m_mesh->vertices[face.indices[2]] - v0 });
+    }
   }
 
   void MeshBvh::InitBounds() {
     // Create boxes for triangles
-    m_boxes.reserve(m_mesh->faces.size() * 2 - 1);
-    for (uint32_t i = 0; i < m_mesh->faces.size(); ++i) {
-      m_boxes.emplace_back(GetFaceBounds(i));
+    m_boxes.resize(m_mesh->faces.size());
+    ForEachChunk(m_scheduler, 0, static_cast<uint32_t>(m_boxes.size()), [this](uint32_t, uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        m_boxes[i] = GetFaceBounds(i);
+      }
+    });
+  }
+
+  void MeshBvh::InitNodes(std::vector<MeshBvhNode>& nodes, uint32_t nodeId, uint32_t begin, uint32_t end, uint32_t depth, bool deferSubtrees) {
+    if (deferSubtrees && end - begin < kParallelSubtreeSize) {
+      // Leave the node as is, InitSubtrees() will replace it
+      m_subtrees.push_back({ nodeId, begin, end, depth });
+      return;
+    }
+
+    bool isParallel = deferSubtrees && end - begin >= kParallelChunkSize;
+    nodes[nodeId].box = CalculateBound(begin, end, isParallel);
+
+    uint32_t middle = begin;
+    // Depth limit keeps the traversal stack fixed-size
+    if (end - begin > 1 && depth + 1 < kMaxDepth) {
+      middle = m_buildMode == BuildMode::BINNED_SAH
+        ? SplitBinnedSah(nodes[nodeId], begin, end, isParallel)
+        : SplitCentroidAverage(nodes[nodeId], begin, end);
+    }
+
+    if (middle == begin || middle == end) {
+      // Can't subdivide further
+      nodes[nodeId].offset = begin;
+      nodes[nodeId].count = end - begin;
+      return;
+    }
+
+    // Siblings are stored next to each other
+    uint32_t leftId = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    nodes.emplace_back();
+    nodes[nodeId].offset = leftId;
+    nodes[nodeId].count = 0;
+
+    InitNodes(nodes, leftId, begin, middle, depth + 1, deferSubtrees);
+    InitNodes(nodes, leftId + 1, middle, end, depth + 1, deferSubtrees);
+  }
+
+  void MeshBvh::InitSubtrees() {
+    if (m_subtrees.empty()) {
+      return;
+    }
+
+    // Biggest first, so that a big one doesn't end up alone at the end
+    std::sort(m_subtrees.begin(), m_subtrees.end(), [](const Subtree& a, const Subtree& b) {
+      return a.end - a.begin > b.end - b.begin;
+    });
+
+    // Face ranges of subtrees don't overlap, so they are partitioned independently
+    std::vector<std::vector<MeshBvhNode>> subtreeNodes(m_subtrees.size());
+    m_scheduler->ParallelFor(0, static_cast<uint32_t>(m_subtrees.size()), 1, [this, &subtreeNodes](uint32_t begin, uint32_t end) {
+      for (uint32_t subtreeId = begin; subtreeId < end; ++subtreeId) {
+        const Subtree& subtree = m_subtrees[subtreeId];
+        std::vector<MeshBvhNode>& nodes = subtreeNodes[subtreeId];
+        nodes.reserve((subtree.end - subtree.begin) * 2 - 1);
+        nodes.emplace_back();
+        InitNodes(nodes, 0, subtree.begin, subtree.end, subtree.depth, false);
+      }
+    });
+
+    // Splice: the subtree root replaces the placeholder, the rest is appended with shifted child indices
+    for (uint32_t subtreeId = 0; subtreeId < m_subtrees.size(); ++subtreeId) {
+      const std::vector<MeshBvhNode>& nodes = subtreeNodes[subtreeId];
+      uint32_t shift = static_cast<uint32_t>(m_nodes.size()) - 1;
+
+      for (uint32_t i = 0; i < nodes.size(); ++i) {
+        MeshBvhNode node = nodes[i];
+        if (!node.IsLeaf()) {
+          node.offset += shift;
+        }
+
+        if (i == 0) {
+          m_nodes[m_subtrees[subtreeId].nodeId] = node;
+        } else {
+          m_nodes.push_back(node);
+        }
+      }
+    }
+
+    m_subtrees.clear();
+  }
+
+  template <typename Code>
+  void MeshBvh::InitNodesLinear() {
+    uint32_t count = static_cast<uint32_t>(m_faceIds.size());
+    Aabb centroidBox = CalculateCentroidBound(0, count, m_scheduler != nullptr);
+    glm::vec3 extent = centroidBox.Max() - centroidBox.Min();
+    // Flat axes collapse to zero instead of dividing by zero
+    glm::vec3 scale(
+      extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+      extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+      extent.z > 0.0f ? 1.0f / extent.z : 0.0f
+    );
+
+    std::vector<Code> codes(count);
+    ForEachChunk(m_scheduler, 0, count, [&](uint32_t, uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        glm::vec3 unit = (m_boxes[i].Centroid() - centroidBox.Min()) * scale;
+        if constexpr (sizeof(Code) == sizeof(uint64_t)) {
+          codes[i] = MathUtils::MortonCode63(unit);
+        } else {
+          codes[i] = MathUtils::MortonCode30(unit);
+        }
+      }
+    });
+
+    RadixSort(codes, m_faceIds, m_scheduler);
+
+    // Nodes are emitted in the same parent-before-children order as InitNodes(), so the rest of the code can't tell
+    m_nodes.emplace_back();
+    InitLinearNode<Code>(codes, 0, 0, count, 0);
+    InitNodeBounds(m_scheduler);
+  }
+
+  template <typename Code>
+  void MeshBvh::InitLinearNode(std::span<const Code> codes, uint32_t nodeId, uint32_t begin, uint32_t end, uint32_t depth) {
+    uint32_t count = end - begin;
+    uint32_t middle = begin;
+    if (count > kLinearMaxLeafSize && depth + 1 < kMaxDepth) {
+      Code differentBits = codes[begin] ^ codes[end - 1];
+      if (differentBits == 0) {
+        // Faces share a Morton cell, nothing to split them by
+        middle = begin + count / 2;
+      } else {
+        // Codes are sorted, so the range splits where its highest differing bit turns on
+        Code splitBit = Code(1) << (std::bit_width(differentBits) - 1);
+        auto split = std::partition_point(codes.begin() + begin, codes.begin() + end, [splitBit](Code code) {
+          return (code & splitBit) == 0;
+        });
+        middle = static_cast<uint32_t>(split - codes.begin());
+      }
+    }
+
+    if (middle == begin) {
+      m_nodes[nodeId].offset = begin;
+      m_nodes[nodeId].count = count;
+      return;
+    }
+
+    uint32_t leftId = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.emplace_back();
+    m_nodes.emplace_back();
+    m_nodes[nodeId].offset = leftId;
+    m_nodes[nodeId].count = 0;
+
+    InitLinearNode(codes, leftId, begin, middle, depth + 1);
+    InitLinearNode(codes, leftId + 1, middle, end, depth + 1);
+  }
+
+  void MeshBvh::InitNodeBounds(TaskScheduler* scheduler) {
+    // Leaves do nearly all the work and don't depend on each other. Face boxes are reused while building
+    ForEachChunk(scheduler, 0, static_cast<uint32_t>(m_nodes.size()), [this](uint32_t, uint32_t begin, uint32_t end) {
+      for (uint32_t nodeId = begin; nodeId < end; ++nodeId) {
+        MeshBvhNode& node = m_nodes[nodeId];
+        if (!node.IsLeaf()) {
+          continue;
+        }
+
+        node.box = Aabb::Empty();
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+          node.box.Union(m_boxes.empty() ? GetFaceBounds(m_faceIds[i]) : m_boxes[m_faceIds[i]]);
+        }
+      }
+    });
+
+    // Children are always stored after their parent, so a reverse pass visits them first
+    for (uint32_t nodeId = static_cast<uint32_t>(m_nodes.size()); nodeId-- > 0;) {
+      MeshBvhNode& node = m_nodes[nodeId];
+      if (!node.IsLeaf()) {
+        node.box = m_nodes[node.offset].box;
+        node.box.Union(m_nodes[node.offset + 1].box);
+      }
+    }
+  }
+
+  void MeshBvh::InitNodesSpatial() {
+    std::vector<SpatialReference> references(m_faceIds.size());
+    for (uint32_t faceId = 0; faceId < references.size(); ++faceId) {
+      references[faceId] = { m_boxes[faceId], faceId };
+    }
+
+    m_spatialReferencesLeft = static_cast<uint32_t>(m_spatialSplitBudget * static_cast<float>(references.size()));
+    m_spatialRootArea = Aabb::Union(m_boxes.begin(), m_boxes.end()).SurfaceArea();
+    m_faceIds.clear();
+    m_faceIds.reserve(references.size() + m_spatialReferencesLeft);
+
+    m_nodes.emplace_back();
+    InitSpatialNode(references, 0, 0);
+    m_faceIds.shrink_to_fit();
+  }
+
+  void MeshBvh::InitSpatialNode(std::vector<SpatialReference>& references, uint32_t nodeId, uint32_t depth) {
+    Aabb box = Aabb::Empty();
+    for (const SpatialReference& reference : references) {
+      box.Union(reference.box);
     }
+    m_nodes[nodeId].box = box;
+
+    uint32_t count = static_cast<uint32_t>(references.size());
+    SpatialSplit split;
+    bool isSpatial = false;
+    if (count > 1 && depth + 1 < kMaxDepth) {
+      split = FindObjectSplit(references);
+
+      // Spatial splits only pay off where children of the object split overlap
+      float overlapArea = split.leftBox.Intersection(split.rightBox).SurfaceArea();
+      bool isOverlapping = split.cost == std::numeric_limits<float>::infinity() || overlapArea > kSpatialOverlapThreshold * m_spatialRootArea;
+      if (isOverlapping && m_spatialReferencesLeft != 0) {
+        SpatialSplit spatialSplit = FindSpatialSplit(references, box);
+        if (spatialSplit.cost < split.cost) {
+          split = spatialSplit;
+          isSpatial = true;
+        }
+      }
+    }
+
+    // Same leaf criteria as SplitBinnedSah()
+    bool isLeaf = split.cost == std::numeric_limits<float>::infinity();
+    if (!isLeaf) {
+      float area = box.SurfaceArea();
+      float splitCost = kSahTraversalCost + (area > 0.0f ? kSahIntersectionCost * split.cost / area : 0.0f);
+      float leafCost = kSahIntersectionCost * static_cast<float>(count);
+      isLeaf = splitCost >= leafCost && count <= kSahMaxLeafSize;
+    }
+
+    std::vector<SpatialReference> left;
+    std::vector<SpatialReference> right;
+    // Charged to the budget only once the partition is committed below
+    uint32_t duplicatesCount = 0;
+    if (!isLeaf && !isSpatial) {
+      Aabb centroidBox = Aabb::Empty();
+      for (const SpatialReference& reference : references) {
+        centroidBox.Union(reference.box.Centroid());
+      }
+
+      float scale = static_cast<float>(kSahBinCount) / (centroidBox.Max()[split.axis] - centroidBox.Min()[split.axis]);
+      for (const SpatialReference& reference : references) {
+        float relative = (reference.box.Centroid()[split.axis] - centroidBox.Min()[split.axis]) * scale;
+        uint32_t binId = glm::min(static_cast<uint32_t>(relative), kSahBinCount - 1);
+        (binId <= split.plane ? left : right).push_back(reference);
+      }
+    } else if (!isLeaf) {
+      float leftArea = split.leftBox.SurfaceArea();
+      float rightArea = split.rightBox.SurfaceArea();
+      float leftCount = static_cast<float>(split.leftCount);
+      float rightCount = static_cast<float>(split.rightCount);
+
+      for (const SpatialReference& reference : references) {
+        if (reference.box.Max()[split.axis] <= split.position) {
+          left.push_back(reference);
+          continue;
+        }
+        if (reference.box.Min()[split.axis] >= split.position) {
+          right.push_back(reference);
+          continue;
+        }
+
+        // Reference unsplitting: a straddling face goes wholly to one side when that's cheaper than duplicating it
+        Aabb leftUnion = split.leftBox;
+        leftUnion.Union(reference.box);
+        Aabb rightUnion = split.rightBox;
+        rightUnion.Union(reference.box);
+        float splitCost = leftArea * leftCount + rightArea * rightCount;
+        float leftOnlyCost = leftUnion.SurfaceArea() * leftCount + rightArea * (rightCount - 1.0f);
+        float rightOnlyCost = leftArea * (leftCount - 1.0f) + rightUnion.SurfaceArea() * rightCount;
+
+        if (duplicatesCount < m_spatialReferencesLeft && splitCost < leftOnlyCost && splitCost < rightOnlyCost) {
+          SpatialReference leftPart;
+          SpatialReference rightPart;
+          SplitReference(reference, split.axis, split.position, leftPart, rightPart);
+          // Clipping may find the face entirely on one side of the plane, even though its box straddles it
+          bool isLeftEmpty = leftPart.box.Min()[split.axis] > leftPart.box.Max()[split.axis];
+          bool isRightEmpty = rightPart.box.Min()[split.axis] > rightPart.box.Max()[split.axis];
+          if (!isLeftEmpty) {
+            left.push_back(leftPart);
+          }
+          if (!isRightEmpty) {
+            right.push_back(rightPart);
+          }
+          if (!isLeftEmpty && !isRightEmpty) {
+            ++duplicatesCount;
+          }
+        } else if (leftOnlyCost <= rightOnlyCost) {
+          left.push_back(reference);
+        } else {
+          right.push_back(reference);
+        }
+      }
+    }
+
+    if (isLeaf || left.empty() || right.empty()) {
+      m_nodes[nodeId].offset = static_cast<uint32_t>(m_faceIds.size());
+      m_nodes[nodeId].count = count;
+      for (const SpatialReference& reference : references) {
+        m_faceIds.push_back(reference.faceId);
+      }
+      return;
+    }
+
+    m_spatialReferencesLeft -= duplicatesCount;
+
+    // Only one level of references is alive at a time per branch
+    references.clear();
+    references.shrink_to_fit();
+
+    uint32_t leftId = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.emplace_back();
+    m_nodes.emplace_back();
+    m_nodes[nodeId].offset = leftId;
+    m_nodes[nodeId].count = 0;
+
+    InitSpatialNode(left, leftId, depth + 1);
+    InitSpatialNode(right, leftId + 1, depth + 1);
   }
 
-  uint32_t MeshBvh::InitNodes(std::vector<uint32_t>&& boundsId, bool shouldSubdivide) {
-    uint32_t currentIndex = static_cast<uint32_t>(m_nodes.size());
-    MeshBvhNode& node = m_nodes.emplace_back();
-    node.box = CalculateBound(boundsId);
+  MeshBvh::SpatialSplit MeshBvh::FindObjectSplit(const std::vector<SpatialReference>& references) const {
+    Aabb centroidBox = Aabb::Empty();
+    for (const SpatialReference& reference : references) {
+      centroidBox.Union(reference.box.Centroid());
+    }
+
+    SpatialSplit best;
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      float extent = centroidBox.Max()[axis] - centroidBox.Min()[axis];
+      if (extent <= 0.0f) {
+        continue;
+      }
+
+      SahBin bins[kSahBinCount];
+      float scale = static_cast<float>(kSahBinCount) / extent;
+      for (const SpatialReference& reference : references) {
+        float relative = (reference.box.Centroid()[axis] - centroidBox.Min()[axis]) * scale;
+        SahBin& bin = bins[glm::min(static_cast<uint32_t>(relative), kSahBinCount - 1)];
+        bin.box.Union(reference.box);
+        ++bin.count;
+      }
+
+      Aabb boxesRight[kSahBinCount - 1];
+      uint32_t countsRight[kSahBinCount - 1];
+      Aabb accumulated = Aabb::Empty();
+      uint32_t count = 0;
+      for (uint32_t i = kSahBinCount - 1; i > 0; --i) {
+        accumulated.Union(bins[i].box);
+        count += bins[i].count;
+        boxesRight[i - 1] = accumulated;
+        countsRight[i - 1] = count;
+      }
+
+      accumulated = Aabb::Empty();
+      count = 0;
+      for (uint32_t i = 0; i < kSahBinCount - 1; ++i) {
+        accumulated.Union(bins[i].box);
+        count += bins[i].count;
+        if (count == 0 || countsRight[i] == 0) {
+          continue;
+        }
 
-    if (!shouldSubdivide || boundsId.size() == 1) {
-      node.boxesId = std::move(boundsId);
-      return currentIndex;
+        float cost = static_cast<float>(count) * accumulated.SurfaceArea() + static_cast<float>(countsRight[i]) * boxesRight[i].SurfaceArea();
+        if (cost < best.cost) {
+          best = { cost, axis, i, 0.0f, accumulated, boxesRight[i], count, countsRight[i] };
+        }
+      }
     }
 
-    glm::vec3 splitPoint = CalculateSplitPoint(boundsId);
+    return best;
+  }
+
+  MeshBvh::SpatialSplit MeshBvh::FindSpatialSplit(const std::vector<SpatialReference>& references, const Aabb& box) const {
+    struct SpatialBin final {
+      Aabb box = Aabb::Empty();
+      // References starting and ending in this bin
+      uint32_t entriesCount = 0;
+      uint32_t exitsCount = 0;
+    };
+
+    SpatialSplit best;
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      float origin = box.Min()[axis];
+      float binSize = (box.Max()[axis] - origin) / static_cast<float>(kSpatialBinCount);
+      if (binSize <= 0.0f) {
+        continue;
+      }
+
+      // Every reference is chopped at the bin planes it crosses, so bins get tight clipped bounds
+      SpatialBin bins[kSpatialBinCount];
+      auto getBinId = [origin, binSize](float position) {
+        float relative = glm::max((position - origin) / binSize, 0.0f);
+        return glm::min(static_cast<uint32_t>(relative), kSpatialBinCount - 1);
+      };
+
+      for (const SpatialReference& reference : references) {
+        uint32_t firstBinId = getBinId(reference.box.Min()[axis]);
+        uint32_t lastBinId = glm::max(getBinId(reference.box.Max()[axis]), firstBinId);
+
+        SpatialReference rest = reference;
+        for (uint32_t binId = firstBinId; binId < lastBinId; ++binId) {
+          SpatialReference part;
+          SplitReference(rest, axis, origin + binSize * static_cast<float>(binId + 1), part, rest);
+          bins[binId].box.Union(part.box);
+        }
+
+        bins[lastBinId].box.Union(rest.box);
+        ++bins[firstBinId].entriesCount;
+        ++bins[lastBinId].exitsCount;
+      }
+
+      Aabb boxesRight[kSpatialBinCount - 1];
+      uint32_t countsRight[kSpatialBinCount - 1];
+      Aabb accumulated = Aabb::Empty();
+      uint32_t count = 0;
+      for (uint32_t i = kSpatialBinCount - 1; i > 0; --i) {
+        accumulated.Union(bins[i].box);
+        count += bins[i].exitsCount;
+        boxesRight[i - 1] = accumulated;
+        countsRight[i - 1] = count;
+      }
+
+      accumulated = Aabb::Empty();
+      count = 0;
+      for (uint32_t i = 0; i < kSpatialBinCount - 1; ++i) {
+        accumulated.Union(bins[i].box);
+        count += bins[i].entriesCount;
+        if (count == 0 || countsRight[i] == 0) {
+          continue;
+        }
+
+        float cost = static_cast<float>(count) * accumulated.SurfaceArea() + static_cast<float>(countsRight[i]) * boxesRight[i].SurfaceArea();
+        if (cost < best.cost) {
+          best = { cost, axis, i, origin + binSize * static_cast<float>(i + 1), accumulated, boxesRight[i], count, countsRight[i] };
+        }
+      }
+    }
+
+    return best;
+  }
+
+  void MeshBvh::SplitReference(const SpatialReference& reference, uint32_t axis, float position, SpatialReference& left, SpatialReference& right) const {
+    const Face& face = m_mesh->faces[reference.faceId];
+    Aabb leftBox = Aabb::Empty();
+    Aabb rightBox = Aabb::Empty();
+
+    // Vertices go to their side, edges crossing the plane add the crossing point to both
+    for (uint32_t i = 0; i < 3; ++i) {
+      const glm::vec3& v0 = m_mesh->vertices[face.indices[i]];
+      const glm::vec3& v1 = m_mesh->vertices[face.indices[(i + 1) % 3]];
+      float p0 = v0[axis];
+      float p1 = v1[axis];
+
+      if (p0 <= position) {
+        leftBox.Union(v0);
+      }
+      if (p0 >= position) {
+        rightBox.Union(v0);
+      }
+
+      if ((p0 < position && p1 > position) || (p0 > position && p1 < position)) {
+        float t = glm::clamp((position - p0) / (p1 - p0), 0.0f, 1.0f);
+        glm::vec3 crossing = v0 + (v1 - v0) * t;
+        crossing[axis] = position;
+        leftBox.Union(crossing);
+        rightBox.Union(crossing);
+      }
+    }
+
+    // The reference may already be a clipped part of the face
+    uint32_t faceId = reference.faceId;
+    left = { leftBox.Intersection(reference.box), faceId };
+    right = { rightBox.Intersection(reference.box), faceId };
+  }
+
+  uint32_t MeshBvh::SplitCentroidAverage(const MeshBvhNode& node, uint32_t begin, uint32_t end) {
+    glm::vec3 splitPoint = CalculateSplitPoint(begin, end);
     uint32_t splitAxis = node.box.GetBiggestSideIndex();
 
-    // Determine affiliation
-    std::vector<uint32_t> indicesLeft;
-    std::vector<uint32_t> indicesRight;
-    for (uint32_t id : boundsId) {
-      // Centroids are better than min/max because the farthest arises 2 problems:
-      // - 2 children may return the same element
-      // - Since we calculate TheBigDanny in constructor, both children will have bloated volume
-      if (m_boxes[id].Centroid()[splitAxis] < splitPoint[splitAxis]) {
-        // Left may be zero length if all triangles have the same centroid because of <
-        indicesLeft.emplace_back(id);
-      } else {
-        indicesRight.emplace_back(id);
+    // Centroids are better than min/max because the farthest arises 2 problems:
+    // - 2 children may return the same element
+    // - Since we calculate TheBigDanny in constructor, both children will have bloated volume
+    auto middle = std::partition(m_faceIds.begin() + begin, m_faceIds.begin() + end, [this, &splitPoint, splitAxis](uint32_t id) {
+      // Left may be zero length if all triangles have the same centroid because of <
+      return m_boxes[id].Centroid()[splitAxis] < splitPoint[splitAxis];
+    });
+
+    return static_cast<uint32_t>(middle - m_faceIds.begin());
+  }
+
+  uint32_t MeshBvh::SplitBinnedSah(const MeshBvhNode& node, uint32_t begin, uint32_t end, bool isParallel) {
+    // Faces are binned by centroids, so bins are spread over the centroid bounds, not over the node bounds
+    Aabb centroidBox = CalculateCentroidBound(begin, end, isParallel);
+    auto getBinId = [&centroidBox](const glm::vec3& centroid, uint32_t axis) {
+      // Same math as in FillSahBins(), so faces land in the bins they were counted in
+      float scale = static_cast<float>(kSahBinCount) / (centroidBox.Max()[axis] - centroidBox.Min()[axis]);
+      float relative = (centroid[axis] - centroidBox.Min()[axis]) * scale;
+      return glm::min(static_cast<uint32_t>(relative), kSahBinCount - 1);
+    };
+
+    SahBins bins;
+    if (isParallel) {
+      // Every chunk fills its own bins, which are merged afterwards
+      std::vector<SahBins> chunkBins(GetChunksCount(begin, end));
+      ForEachChunk(m_scheduler, begin, end, [this, &chunkBins, &centroidBox](uint32_t chunkId, uint32_t chunkBegin, uint32_t chunkEnd) {
+        FillSahBins(chunkBins[chunkId], centroidBox, chunkBegin, chunkEnd);
+      });
+
+      for (const auto& chunk : chunkBins) {
+        for (uint32_t axis = 0; axis < 3; ++axis) {
+          for (uint32_t i = 0; i < kSahBinCount; ++i) {
+            bins.axes[axis][i].box.Union(chunk.axes[axis][i].box);
+            bins.axes[axis][i].count += chunk.axes[axis][i].count;
+          }
+        }
       }
+    } else {
+      FillSahBins(bins, centroidBox, begin, end);
     }
 
-    if ((indicesLeft.size() == boundsId.size() && indicesRight.size() == boundsId.size())
-      || indicesLeft.empty() || indicesRight.empty()) {
-      // Can't subdivide further
-      node.boxesId = std::move(boundsId);
-      return currentIndex;
+    float bestCost = std::numeric_limits<float>::infinity();
+    uint32_t bestAxis = 0;
+    uint32_t bestPlane = 0;
+
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      if (centroidBox.Max()[axis] <= centroidBox.Min()[axis]) {
+        // All centroids lie on the same plane - nothing to split here
+        continue;
+      }
+
+      // Right-to-left sweep: plane i lies between bins i and i + 1
+      float areasRight[kSahBinCount - 1];
+      uint32_t countsRight[kSahBinCount - 1];
+      Aabb accumulated = Aabb::Empty();
+      uint32_t count = 0;
+      for (uint32_t i = kSahBinCount - 1; i > 0; --i) {
+        accumulated.Union(bins.axes[axis][i].box);
+        count += bins.axes[axis][i].count;
+        areasRight[i - 1] = accumulated.SurfaceArea();
+        countsRight[i - 1] = count;
+      }
+
+      // Left-to-right sweep evaluating each plane
+      accumulated = Aabb::Empty();
+      count = 0;
+      for (uint32_t i = 0; i < kSahBinCount - 1; ++i) {
+        accumulated.Union(bins.axes[axis][i].box);
+        count += bins.axes[axis][i].count;
+        if (count == 0 || countsRight[i] == 0) {
+          continue;
+        }
+
+        float cost = static_cast<float>(count) * accumulated.SurfaceArea() + static_cast<float>(countsRight[i]) * areasRight[i];
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestAxis = axis;
+          bestPlane = i;
+        }
+      }
+    }
+
+    if (bestCost == std::numeric_limits<float>::infinity()) {
+      return begin;
     }
 
-    // Don't subdivide children if elements count is the same
-    node.leftId = InitNodes(std::move(indicesLeft), indicesLeft.size() != boundsId.size());
-    node.rightId = InitNodes(std::move(indicesRight), indicesRight.size() != boundsId.size());
+    // Compare with the cost of intersecting every face in a leaf
+    uint32_t count = end - begin;
+    float area = node.box.SurfaceArea();
+    float splitCost = kSahTraversalCost + (area > 0.0f ? kSahIntersectionCost * bestCost / area : 0.0f);
+    float leafCost = kSahIntersectionCost * static_cast<float>(count);
+    if (splitCost >= leafCost && count <= kSahMaxLeafSize) {
+      return begin;
+    }
+
+    auto middle = std::partition(m_faceIds.begin() + begin, m_faceIds.begin() + end, [this, &getBinId, bestAxis, bestPlane](uint32_t id) {
+      return getBinId(m_boxes[id].Centroid(), bestAxis) <= bestPlane;
+    });
+
+    return static_cast<uint32_t>(middle - m_faceIds.begin());
+  }
+
+  void MeshBvh::FillSahBins(SahBins& bins, const Aabb& centroidBox, uint32_t begin, uint32_t end) const {
+    glm::vec3 scale(0.0f);
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      float extent = centroidBox.Max()[axis] - centroidBox.Min()[axis];
+      // Flat axes put everything into the first bin and are skipped by the caller
+      scale[axis] = extent > 0.0f ? static_cast<float>(kSahBinCount) / extent : 0.0f;
+    }
+
+    for (uint32_t i = begin; i < end; ++i) {
+      const Aabb& box = m_boxes[m_faceIds[i]];
+      glm::vec3 relative = (box.Centroid() - centroidBox.Min()) * scale;
 
-    return currentIndex;
+      for (uint32_t axis = 0; axis < 3; ++axis) {
+        SahBin& bin = bins.axes[axis][glm::min(static_cast<uint32_t>(relative[axis]), kSahBinCount - 1)];
+        bin.box.Union(box);
+        ++bin.count;
+      }
+    }
   }
 
   Aabb MeshBvh::GetFaceBounds(uint32_t id) const {
@@ -201,28 +1114,81 @@ namespace Flame {
     return Aabb::Union(vertices, vertices + 3);
   }
 
-  Aabb MeshBvh::CalculateBound(const std::vector<uint32_t>& boundsId) const {
+  Aabb MeshBvh::CalculateBound(uint32_t begin, uint32_t end, bool isParallel) const {
+    if (isParallel) {
+      std::vector<Aabb> chunkBounds(GetChunksCount(begin, end));
+      ForEachChunk(m_scheduler, begin, end, [this, &chunkBounds](uint32_t chunkId, uint32_t chunkBegin, uint32_t chunkEnd) {
+        chunkBounds[chunkId] = CalculateBound(chunkBegin, chunkEnd);
+      });
+
+      return Aabb::Union(chunkBounds.begin(), chunkBounds.end());
+    }
+
     glm::vec3 min(std::numeric_limits<float>::infinity());
     glm::vec3 max(-std::numeric_limits<float>::infinity());
 
     // Calculate The Big Danny
-    for (uint32_t id : boundsId) {
+    for (uint32_t i = begin; i < end; ++i) {
+      const Aabb& box = m_boxes[m_faceIds[i]];
       for (int dim = 0; dim < 3; ++dim) {
-        min[dim] = glm::min(m_boxes[id].Min()[dim], min[dim]);
-        max[dim] = glm::max(m_boxes[id].Max()[dim], max[dim]);
+        min[dim] = glm::min(box.Min()[dim], min[dim]);
+        max[dim] = glm::max(box.Max()[dim], max[dim]);
       }
     }
 
     return Aabb(min, max);
   }
 
-  glm::vec3 MeshBvh::CalculateSplitPoint(const std::vector<uint32_t>& boundsId) const {
+  Aabb MeshBvh::CalculateCentroidBound(uint32_t begin, uint32_t end, bool isParallel) const {
+    if (isParallel) {
+      std::vector<Aabb> chunkBounds(GetChunksCount(begin, end));
+      ForEachChunk(m_scheduler, begin, end, [this, &chunkBounds](uint32_t chunkId, uint32_t chunkBegin, uint32_t chunkEnd) {
+        chunkBounds[chunkId] = CalculateCentroidBound(chunkBegin, chunkEnd);
+      });
+
+      return Aabb::Union(chunkBounds.begin(), chunkBounds.end());
+    }
+
+    Aabb result = Aabb::Empty();
+    for (uint32_t i = begin; i < end; ++i) {
+      glm::vec3 centroid = m_boxes[m_faceIds[i]].Centroid();
+      result.Union(Aabb(centroid, centroid));
+    }
+
+    return result;
+  }
+
+  glm::vec3 MeshBvh::CalculateSplitPoint(uint32_t begin, uint32_t end) const {
     // Find average centroid
     glm::vec3 avgCentroid(0.0f);
-    for (uint32_t id : boundsId) {
-      avgCentroid += m_boxes[id].Centroid();
+    for (uint32_t i = begin; i < end; ++i) {
+      avgCentroid += m_boxes[m_faceIds[i]].Centroid();
+    }
+
+    return avgCentroid / static_cast<float>(end - begin);
+  }
+
+  float MeshBvh::CalculateSahCost() const {
+    if (m_nodes.empty()) {
+      return 0.0f;
+    }
+
+    float rootArea = m_nodes[0].box.SurfaceArea();
+    if (rootArea <= 0.0f) {
+      return 0.0f;
+    }
+
+    // Expected cost of a random ray that hits the root
+    float cost = 0.0f;
+    for (const MeshBvhNode& node : m_nodes) {
+      float probability = node.box.SurfaceArea() / rootArea;
+      if (node.IsLeaf()) {
+        cost += kSahIntersectionCost * probability * static_cast<float>(node.count);
+      } else {
+        cost += kSahTraversalCost * probability;
+      }
     }
 
-    return avgCentroid / boundsId.size();
+    return cost;
   }
 }
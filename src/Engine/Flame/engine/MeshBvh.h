@@ -1,42 +1,231 @@
 #pragma once
 #include <cstdint>
+#include <limits>
+#include <span>
 #include <vector>
 
+#include "BvhStats.h"
 #include "Flame/math/Aabb.h"
 #include "Flame/math/Ray.h"
+#include "Flame/math/Simd.h"
 
 namespace Flame {
   struct Mesh;
+  struct TaskScheduler;
+  template <uint32_t Width>
+  struct RayPacket;
 
   struct MeshBvh final {
-    struct MeshBvhNode final {
-      MeshBvhNode();
+    enum class BuildMode : uint32_t {
+      // Split at the average centroid on the longest axis
+      CENTROID_AVERAGE,
+      // Split where the binned surface area heuristic is the lowest
+      BINNED_SAH,
+      // Sort faces along a Morton curve and split where the codes differ first (LBVH).
+      // Builds several times faster than SAH for a somewhat worse tree, meant for runtime-generated meshes
+      LINEAR_MORTON,
+      // Binned SAH that may also split big faces between both children (SBVH), so that nodes don't overlap.
+      // A face may then be referenced by several leaves, see SetSpatialSplitBudget(). Slow and single-threaded,
+      // meant for static assets with large triangles
+      SPATIAL_SAH,
+      COUNT
+    };
+
+    struct alignas(32) MeshBvhNode final {
+      bool IsLeaf() const {
+        return count != 0;
+      }
 
-      uint32_t leftId;
-      uint32_t rightId;
       Aabb box;
-      std::vector<uint32_t> boxesId;
+      // Leaf: index of the first face in m_faceIds. Compound: index of the left child, the right one follows it
+      uint32_t offset = 0;
+      // Number of faces in a leaf, zero for compounds
+      uint32_t count = 0;
+    };
+
+    /// Face prepared for the intersection test: first vertex and both edges coming out of it
+    struct Triangle final {
+      glm::vec3 v0;
+      glm::vec3 e1;
+      glm::vec3 e2;
     };
 
     explicit MeshBvh(const Mesh* mesh);
 
-    void Build();
+    /**
+     * \param scheduler If set, face bounds and binning of big nodes are spread over its threads,
+     * then subtrees below kParallelSubtreeSize faces are built as separate tasks. May be called from a task
+     */
+    void Build(TaskScheduler* scheduler = nullptr);
+    /// Restores a tree previously taken from GetNodes() and GetFaceIds() of the same mesh and built with the same mode
+    void Load(std::vector<MeshBvhNode> nodes, std::vector<uint32_t> faceIds);
+    /**
+     * Recomputes bounds of the existing tree bottom-up after vertices moved, keeping its topology.
+     * Rebuilds instead once the SAH cost drifts kRefitRebuildSahRatio times above the built one.
+     * Faces themselves must stay the same
+     * \param scheduler If set, leaf bounds are spread over its threads
+     * \return Whether the tree had to be rebuilt
+     */
+    bool Refit(TaskScheduler* scheduler = nullptr);
     bool Hit(const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const;
+    /// Any-hit query for shadow and visibility rays: stops at the first face within (tMin; tMax) and fills nothing
+    bool Occluded(const Ray& r, float tMin, float tMax) const;
+    /**
+     * Closest hits of a whole packet, each lane within its own [tMin; tMax]
+     * \return Mask of lanes that hit. Their tMax is shrunk to the hit time and records[lane] is filled
+     */
+    uint32_t Hit(RayPacket<kSimdWidth>& packet, std::span<HitRecord<const Mesh*>, kSimdWidth> records) const;
+
+    void SetBuildMode(BuildMode mode);
+    BuildMode GetBuildMode() const;
+    /**
+     * Keeps a copy of every face as a Triangle in leaf order, so that leaves are tested with sequential loads
+     * instead of gathering vertices through indices. Costs sizeof(Triangle) per face.
+     * Applies to the current tree right away and to every following Build() and Load()
+     */
+    void SetPrecomputeTriangles(bool isEnabled);
+    /// \param budget Extra face references SPATIAL_SAH may create, relative to the number of faces
+    void SetSpatialSplitBudget(float budget);
+    float GetSpatialSplitBudget() const;
+    bool IsPrecomputingTriangles() const;
+    /// \return Bytes taken by nodes, face indices and precomputed triangles
+    size_t GetMemoryUsage() const;
+    /// \return Bytes taken by precomputed triangles alone, zero if they are disabled
+    size_t GetTrianglesMemoryUsage() const;
+    /// \return SAH cost of the last built tree, relative to the root surface area
+    float GetSahCost() const;
+    /// \return Duration of the last Build() in seconds
+    float GetBuildTime() const;
+    /// Walks the whole tree, meant for reports rather than per-frame use
+    BvhBuildStats CalculateBuildStats() const;
+    /// \return Bounds of the whole mesh, available after Build()
+    const Aabb& GetBounds() const;
+    const Mesh* GetMesh() const;
+    const std::vector<MeshBvhNode>& GetNodes() const;
+    /// Face indices in leaf order. SPATIAL_SAH trees may reference a face more than once
+    const std::vector<uint32_t>& GetFaceIds() const;
+
+  public:
+    static constexpr uint32_t kMaxDepth = 64;
+    static constexpr uint32_t kSahBinCount = 16;
+    static constexpr uint32_t kSahMaxLeafSize = 8;
+    static constexpr float kSahTraversalCost = 1.0f;
+    static constexpr float kSahIntersectionCost = 1.0f;
+    // Meshes with fewer faces aren't worth splitting between threads
+    static constexpr uint32_t kParallelBuildThreshold = 1 << 16;
+    static constexpr uint32_t kParallelSubtreeSize = 1 << 13;
+    static constexpr uint32_t kParallelChunkSize = 1 << 14;
+    // Refitted tree is rebuilt once it gets this much worse than the freshly built one
+    static constexpr float kRefitRebuildSahRatio = 1.5f;
+    static constexpr uint32_t kLinearMaxLeafSize = 4;
+    // Past this many faces 10 bits per axis leave too many of them sharing a Morton cell, so 21 bits are used
+    static constexpr uint32_t kLinearWideCodeThreshold = 1 << 18;
+    static constexpr uint32_t kSpatialBinCount = 16;
+    // Spatial splits are only tried when children of the object split overlap by this much of the root surface area
+    static constexpr float kSpatialOverlapThreshold = 1e-5f;
+    static constexpr float kDefaultSpatialSplitBudget = 0.3f;
 
   private:
-    // Really really hard
-    bool HitFace(uint32_t faceId, const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const;
-    bool HitNode(uint32_t nodeId, const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const;
+    struct Subtree final {
+      uint32_t nodeId;
+      uint32_t begin;
+      uint32_t end;
+      uint32_t depth;
+    };
+
+    struct SahBin final {
+      Aabb box = Aabb::Empty();
+      uint32_t count = 0;
+    };
+
+    struct SahBins final {
+      SahBin axes[3][kSahBinCount];
+    };
+
+    /// Part of a face that went to one side of a spatial split
+    struct SpatialReference final {
+      Aabb box;
+      uint32_t faceId;
+    };
+
+    struct SpatialSplit final {
+      float cost = std::numeric_limits<float>::infinity();
+      uint32_t axis = 0;
+      // Object split: last bin of the left child. Spatial split: plane position
+      uint32_t plane = 0;
+      float position = 0.0f;
+      Aabb leftBox = Aabb::Empty();
+      Aabb rightBox = Aabb::Empty();
+      uint32_t leftCount = 0;
+      uint32_t rightCount = 0;
+    };
+
+    /// \param id Index into m_faceIds, not a face index
+    Triangle GetTriangle(uint32_t id) const;
+    static bool HitTriangle(const Triangle& triangle, const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax);
+    /// Moller-Trumbore without filling a record
+    static bool IntersectTriangle(const Triangle& triangle, const Ray& r, float tMin, float tMax, float& time);
+
+    void InitTriangles();
 
     void InitBounds();
-    uint32_t InitNodes(std::vector<uint32_t>&& boundsId, bool shouldSubdivide = true);
+    /**
+     * Builds the subtree rooted at nodes[nodeId]
+     * \param deferSubtrees Small subtrees are queued into m_subtrees instead of being built right away
+     */
+    void InitNodes(std::vector<MeshBvhNode>& nodes, uint32_t nodeId, uint32_t begin, uint32_t end, uint32_t depth, bool deferSubtrees);
+    /// Builds queued subtrees in parallel and appends them to m_nodes
+    void InitSubtrees();
+    /// LINEAR_MORTON build: sorts m_faceIds by Morton code, emits the topology, then fills bounds bottom-up
+    template <typename Code>
+    void InitNodesLinear();
+    /// \param codes Sorted Morton codes of faces [begin; end)
+    template <typename Code>
+    void InitLinearNode(std::span<const Code> codes, uint32_t nodeId, uint32_t begin, uint32_t end, uint32_t depth);
+    /// Recomputes bounds of every node from its faces, leaves in parallel chunks
+    void InitNodeBounds(TaskScheduler* scheduler);
+    /// SPATIAL_SAH build, refills m_faceIds leaf by leaf
+    void InitNodesSpatial();
+    /// \param references Taken apart and released before the children are built
+    void InitSpatialNode(std::vector<SpatialReference>& references, uint32_t nodeId, uint32_t depth);
+    SpatialSplit FindObjectSplit(const std::vector<SpatialReference>& references) const;
+    SpatialSplit FindSpatialSplit(const std::vector<SpatialReference>& references, const Aabb& box) const;
+    /// Clips the face of a reference by an axis-aligned plane, boxes of both parts stay within the reference box
+    void SplitReference(const SpatialReference& reference, uint32_t axis, float position, SpatialReference& left, SpatialReference& right) const;
+    /// Partitions faces [begin; end) in place
+    /// \return Index of the first face of the right part or begin if the range shouldn't be split
+    uint32_t SplitCentroidAverage(const MeshBvhNode& node, uint32_t begin, uint32_t end);
+    uint32_t SplitBinnedSah(const MeshBvhNode& node, uint32_t begin, uint32_t end, bool isParallel);
+    void FillSahBins(SahBins& bins, const Aabb& centroidBox, uint32_t begin, uint32_t end) const;
     Aabb GetFaceBounds(uint32_t id) const;
-    Aabb CalculateBound(const std::vector<uint32_t>& boundsId) const;
-    glm::vec3 CalculateSplitPoint(const std::vector<uint32_t>& boundsId) const;
+    Aabb CalculateBound(uint32_t begin, uint32_t end, bool isParallel = false) const;
+    Aabb CalculateCentroidBound(uint32_t begin, uint32_t end, bool isParallel = false) const;
+    glm::vec3 CalculateSplitPoint(uint32_t begin, uint32_t end) const;
+    float CalculateSahCost() const;
 
   private:
     const Mesh* m_mesh;
+    BuildMode m_buildMode = BuildMode::BINNED_SAH;
+    bool m_isPrecomputingTriangles = false;
+    float m_spatialSplitBudget = kDefaultSpatialSplitBudget;
+    // Only alive during a SPATIAL_SAH build
+    uint32_t m_spatialReferencesLeft = 0;
+    float m_spatialRootArea = 0.0f;
+    float m_sahCost = 0.0f;
+    // SAH cost right after the last Build() or Load(), the reference for Refit()
+    float m_builtSahCost = 0.0f;
+    float m_buildTime = 0.0f;
+    // Only alive during the build
+    TaskScheduler* m_scheduler = nullptr;
+    std::vector<Subtree> m_subtrees;
+    // Face bounds, only alive during the build
     std::vector<Aabb> m_boxes;
     std::vector<MeshBvhNode> m_nodes;
+    // Face indices ordered so that every leaf references a contiguous range
+    std::vector<uint32_t> m_faceIds;
+    // Same order as m_faceIds, empty unless m_isPrecomputingTriangles
+    std::vector<Triangle> m_triangles;
   };
+
+  static_assert(sizeof(MeshBvh::MeshBvhNode) == 32);
 }
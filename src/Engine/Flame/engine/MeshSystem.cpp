@@ -13,7 +13,9 @@
 #include "ModelManager.h"
 #include "glm/fwd.hpp"
 #include "lights/DirectLight.h"
+#include <bit>
 #include <d3dcommon.h>
+#include <type_traits>
 #include <wrl/client.h>
 
 namespace Flame {
@@ -29,6 +31,12 @@ namespace Flame {
 
   void MeshSystem::Cleanup() {
     m_shadowMapProvider.reset();
+    m_tlas.Reset();
+    m_tlasInstances.clear();
+    m_tlasBoxes.clear();
+    m_tlasMeshRanges.clear();
+    m_tlasTransformHeads.clear();
+    m_isTlasBuilt = false;
 
     m_opaqueGroup.Cleanup();
     m_hologramGroup.Cleanup();
@@ -37,22 +45,23 @@ namespace Flame {
   }
 
   void MeshSystem::Update(float deltaTime) {
-
+    TransformSystem::Get()->Update();
+    UpdateTlas();
   }
 
-  void MeshSystem::Render(float deltaTime) {
-    m_opaqueGroup.Render();
+  void MeshSystem::Render(float deltaTime, const Frustum& frustum) {
+    m_opaqueGroup.Render(frustum);
     m_hologramGroup.Render();
     m_emissionOnlyGroup.Render();
     m_textureOnlyGroup.Render();
   }
 
-  void MeshSystem::RenderDepth2D() {
-    m_opaqueGroup.RenderDepth2D();
+  void MeshSystem::RenderDepth2D(const Frustum& frustum) {
+    m_opaqueGroup.RenderDepth2D(frustum);
   }
 
-  void MeshSystem::RenderDepthCubemaps(std::span<glm::vec3> positions) {
-    m_opaqueGroup.RenderDepthCubemaps(positions);
+  void MeshSystem::RenderDepthCubemaps(std::span<glm::vec3> positions, const glm::mat4& projection) {
+    m_opaqueGroup.RenderDepthCubemaps(positions, projection);
   }
 
   OpaqueGroup* MeshSystem::GetOpaqueGroup() {
@@ -71,43 +80,174 @@ namespace Flame {
     return &m_emissionOnlyGroup;
   }
 
-  bool MeshSystem::Hit(const Ray& ray, HitRecord<HitResult>& record, float tMin, float tMax) const {
-    HitRecord<OpaqueGroup::PerInstance*> opaqueResult;
-    HitRecord<HologramGroup::PerInstance*> hologramResult;
-    HitRecord<TextureOnlyGroup::PerInstance*> textureOnlyResult;
-    HitRecord<EmissionOnlyGroup::PerInstance*> emissionOnlyResult;
-    bool wasHit = false;
-
-    if (m_opaqueGroup.HitInstance(ray, opaqueResult, tMin, tMax)) {
-      wasHit |= true;
-      tMax = opaqueResult.time;
-      record = opaqueResult;
-      record.data.groupType = GroupType::OPAQUE_GROUP;
-      record.data.perInstanceOpaque = opaqueResult.data;
+  void MeshSystem::UpdateTlas() {
+    TransformSystem* transformSystem = TransformSystem::Get();
+    std::array<uint32_t, static_cast<size_t>(GroupType::COUNT)> groupVersions = {
+      m_opaqueGroup.GetInstancesVersion(),
+      m_hologramGroup.GetInstancesVersion(),
+      m_textureOnlyGroup.GetInstancesVersion(),
+      m_emissionOnlyGroup.GetInstancesVersion(),
+    };
+
+    // Instances were added or removed, pointers to them may be stale as well
+    if (!m_isTlasBuilt || groupVersions != m_tlasGroupVersions) {
+      m_tlasInstances.clear();
+      m_tlasMeshRanges.clear();
+      GatherTlasInstances(m_opaqueGroup, GroupType::OPAQUE_GROUP);
+      GatherTlasInstances(m_hologramGroup, GroupType::HOLOGRAM_GROUP);
+      GatherTlasInstances(m_textureOnlyGroup, GroupType::TEXTURE_ONLY_GROUP);
+      GatherTlasInstances(m_emissionOnlyGroup, GroupType::EMISSION_ONLY_GROUP);
+
+      // Several instances share a transform when it places every mesh of a model
+      m_tlasTransformHeads.clear();
+      m_tlasBoxes.resize(m_tlasInstances.size());
+      for (uint32_t i = 0; i < m_tlasInstances.size(); ++i) {
+        uint32_t transformId = m_tlasInstances[i].transformId;
+        if (transformId >= m_tlasTransformHeads.size()) {
+          m_tlasTransformHeads.resize(transformId + 1, kNoTlasInstance);
+        }
+        m_tlasInstances[i].nextSameTransform = m_tlasTransformHeads[transformId];
+        m_tlasTransformHeads[transformId] = i;
+        UpdateTlasInstance(i);
+      }
+
+      m_tlas.Build(m_tlasBoxes);
+      m_tlasGroupVersions = groupVersions;
+      m_tlasUpdateId = transformSystem->GetUpdateId();
+      m_isTlasBuilt = true;
+      return;
     }
-    if (m_hologramGroup.HitInstance(ray, hologramResult, tMin, tMax)) {
-      wasHit |= true;
-      tMax = hologramResult.time;
-      record = hologramResult;
-      record.data.groupType = GroupType::HOLOGRAM_GROUP;
-      record.data.perInstanceHologram = hologramResult.data;
+
+    // Refitted meshes move every instance of theirs
+    bool isChanged = false;
+    for (TlasMeshRange& range : m_tlasMeshRanges) {
+      if (range.mesh->boxVersion == range.boxVersion) {
+        continue;
+      }
+
+      range.boxVersion = range.mesh->boxVersion;
+      for (uint32_t i = range.begin; i < range.end; ++i) {
+        UpdateTlasInstance(i);
+      }
+      isChanged = true;
+    }
+
+    auto updateTransform = [&](TransformSystem::ID transformId) {
+      if (transformId >= m_tlasTransformHeads.size()) {
+        return;
+      }
+
+      for (uint32_t i = m_tlasTransformHeads[transformId]; i != kNoTlasInstance; i = m_tlasInstances[i].nextSameTransform) {
+        UpdateTlasInstance(i);
+        isChanged = true;
+      }
+    };
+
+    // Only transforms changed since the last sync are visited. A single Update() in between lists them itself,
+    // otherwise change IDs of the transforms that place instances tell
+    uint32_t updateId = transformSystem->GetUpdateId();
+    if (updateId == m_tlasUpdateId + 1) {
+      for (TransformSystem::ID transformId : transformSystem->GetChangedIds()) {
+        updateTransform(transformId);
+      }
+    } else if (updateId != m_tlasUpdateId) {
+      for (TransformSystem::ID transformId = 0; transformId < m_tlasTransformHeads.size(); ++transformId) {
+        if (m_tlasTransformHeads[transformId] != kNoTlasInstance && transformSystem->Contains(transformId)
+          && transformSystem->GetChangeId(transformId) > m_tlasUpdateId) {
+          updateTransform(transformId);
+        }
+      }
     }
-    if (m_textureOnlyGroup.HitInstance(ray, textureOnlyResult, tMin, tMax)) {
-      wasHit |= true;
-      tMax = textureOnlyResult.time;
-      record = textureOnlyResult;
-      record.data.groupType = GroupType::TEXTURE_ONLY_GROUP;
-      record.data.perInstanceTextureOnly = textureOnlyResult.data;
+    m_tlasUpdateId = updateId;
+
+    if (isChanged) {
+      m_tlas.Refit(m_tlasBoxes);
     }
-    if (m_emissionOnlyGroup.HitInstance(ray, emissionOnlyResult, tMin, tMax)) {
-      wasHit |= true;
-      tMax = emissionOnlyResult.time;
-      record = emissionOnlyResult;
-      record.data.groupType = GroupType::EMISSION_ONLY_GROUP;
-      record.data.perInstanceEmissionOnly = emissionOnlyResult.data;
+  }
+
+  bool MeshSystem::Hit(const Ray& ray, HitRecord<HitResult>& record, float tMin, float tMax) const {
+    HitRecord<const Mesh*> meshRecord;
+    const TlasInstance* closest = nullptr;
+
+    m_tlas.Hit(ray, tMin, tMax, [&](uint32_t instanceId, float instanceTMin, float& closestTime) {
+      const TlasInstance& instance = m_tlasInstances[instanceId];
+
+      // Hit the mesh in mesh space. Direction isn't normalized, so the time stays the same
+      glm::vec4 position = instance.worldToMesh * glm::vec4(ray.origin, 1.0f);
+      glm::vec3 direction = instance.worldToMesh * glm::vec4(ray.direction, 0.0f);
+      Ray rayMesh { position / position.w, direction };
+      if (!instance.mesh->Hit(rayMesh, meshRecord, instanceTMin, closestTime)) {
+        return false;
+      }
+
+      closestTime = meshRecord.time;
+      closest = &instance;
+      return true;
+    });
+
+    if (closest == nullptr) {
+      return false;
     }
 
-    return wasHit;
+    FillHitRecord(*closest, meshRecord, record);
+    return true;
+  }
+
+  bool MeshSystem::Occluded(const Ray& ray, float tMin, float tMax, uint32_t groupsMask) const {
+    return m_tlas.Occluded(ray, tMin, tMax, [&](uint32_t instanceId) {
+      const TlasInstance& instance = m_tlasInstances[instanceId];
+      if ((groupsMask & (1u << static_cast<uint32_t>(instance.result.groupType))) == 0) {
+        return false;
+      }
+
+      glm::vec4 position = instance.worldToMesh * glm::vec4(ray.origin, 1.0f);
+      glm::vec3 direction = instance.worldToMesh * glm::vec4(ray.direction, 0.0f);
+      return instance.mesh->Occluded(Ray(position / position.w, direction), tMin, tMax);
+    });
+  }
+
+  uint32_t MeshSystem::Hit(const RayStream& rays, std::span<HitRecord<HitResult>> records, std::span<uint8_t> hits) const {
+    assert(records.size() >= rays.Size() && hits.size() >= rays.Size());
+    uint32_t hitsCount = 0;
+
+    ForEachRayPacket(rays, [&](RayPacketWide& packet, uint32_t firstRayId) {
+      HitRecord<const Mesh*> meshRecords[kSimdWidth];
+      const TlasInstance* closest[kSimdWidth] = {};
+
+      m_tlas.Hit(packet, [&](uint32_t instanceId, uint32_t laneMask) {
+        const TlasInstance& instance = m_tlasInstances[instanceId];
+        RayPacketWide packetMesh = packet.Transformed(instance.worldToMesh, laneMask);
+        HitRecord<const Mesh*> instanceRecords[kSimdWidth];
+        // Binary tree on purpose, see Mesh::Hit(const RayStream&)
+        uint32_t hitMask = instance.mesh->bvh.Hit(packetMesh, instanceRecords);
+
+        for (; hitMask != 0; hitMask &= hitMask - 1) {
+          uint32_t lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+          packet.tMax[lane] = instanceRecords[lane].time;
+          meshRecords[lane] = instanceRecords[lane];
+          closest[lane] = &instance;
+        }
+      });
+
+      for (uint32_t lane = 0; lane < kSimdWidth; ++lane) {
+        if ((packet.activeMask & (1u << lane)) == 0) {
+          continue;
+        }
+
+        uint32_t rayId = firstRayId + lane;
+        hits[rayId] = closest[lane] != nullptr;
+        if (closest[lane] != nullptr) {
+          FillHitRecord(*closest[lane], meshRecords[lane], records[rayId]);
+          ++hitsCount;
+        }
+      }
+    }, [&](uint32_t rayId) {
+      bool isHit = Hit(rays.Get(rayId), records[rayId], rays.tMin[rayId], rays.tMax[rayId]);
+      hits[rayId] = isHit;
+      hitsCount += isHit;
+    });
+
+    return hitsCount;
   }
 
   void MeshSystem::SetShadowMapProvider(const std::shared_ptr<IShadowMapProvider>& provider) {
@@ -115,8 +255,61 @@ namespace Flame {
     m_opaqueGroup.SetShadowMapProvider(provider);
   }
 
+  template <typename Group>
+  void MeshSystem::GatherTlasInstances(Group& group, GroupType groupType) {
+    for (const auto& perModel : group.GetModels()) {
+      const auto& model = perModel->GetModel();
+
+      for (uint32_t meshId = 0; meshId < perModel->GetMeshes().size(); ++meshId) {
+        const auto& perMesh = perModel->GetMeshes()[meshId];
+        const Mesh& mesh = model->m_meshes[meshId];
+        uint32_t begin = static_cast<uint32_t>(m_tlasInstances.size());
+
+        for (const auto& perMaterial : perMesh->GetMaterials()) {
+          auto instances = perMaterial->GetInstances();
+          for (uint32_t i = 0; i < instances.size(); ++i) {
+            TlasInstance& instance = m_tlasInstances.emplace_back();
+            if constexpr (std::is_same_v<Group, OpaqueGroup>) {
+              instance.result.perMaterialOpaque = perMaterial.get();
+            } else if constexpr (std::is_same_v<Group, HologramGroup>) {
+              instance.result.perMaterialHologram = perMaterial.get();
+            } else if constexpr (std::is_same_v<Group, TextureOnlyGroup>) {
+              instance.result.perMaterialTextureOnly = perMaterial.get();
+            } else {
+              instance.result.perMaterialEmissionOnly = perMaterial.get();
+            }
+            instance.result.instanceId = perMaterial->GetInstanceId(i);
+            instance.result.groupType = groupType;
+            instance.mesh = &mesh;
+            instance.transformId = instances[i].GetData().transformId;
+          }
+        }
+
+        uint32_t end = static_cast<uint32_t>(m_tlasInstances.size());
+        if (end != begin) {
+          m_tlasMeshRanges.emplace_back(TlasMeshRange { &mesh, mesh.boxVersion, begin, end });
+        }
+      }
+    }
+  }
+
+  void MeshSystem::UpdateTlasInstance(uint32_t instanceId) {
+    TlasInstance& instance = m_tlasInstances[instanceId];
+    instance.meshToWorld = instance.mesh->GetMeshToWorld(TransformSystem::Get()->GetMat(instance.transformId));
+    instance.worldToMesh = instance.mesh->GetWorldToMesh(TransformSystem::Get()->GetInverseMat(instance.transformId));
+    m_tlasBoxes[instanceId] = instance.mesh->bvh.GetBounds().Transformed(instance.meshToWorld);
+  }
+
   MeshSystem* MeshSystem::Get() {
     static MeshSystem instance;
     return &instance;
   }
+
+  void MeshSystem::FillHitRecord(const TlasInstance& instance, const HitRecord<const Mesh*>& meshRecord, HitRecord<HitResult>& record) const {
+    glm::vec4 position = instance.meshToWorld * glm::vec4(meshRecord.point, 1.0f);
+    record.time = meshRecord.time;
+    record.point = position / position.w;
+    record.normal = glm::normalize(instance.meshToWorld * glm::vec4(meshRecord.normal, 0.0f));
+    record.data = instance.result;
+  }
 }
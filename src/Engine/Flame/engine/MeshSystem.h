@@ -1,9 +1,15 @@
 #pragma once
 #include <d3d11.h>
+#include <array>
+#include <limits>
 #include <memory>
 #include <glm/glm.hpp>
 
 #include "IShadowMapProvider.h"
+#include "InstanceBvh.h"
+#include "RayPacket.h"
+#include "Flame/math/RayStream.h"
+#include "Flame/math/Frustum.h"
 #include "Flame/graphics/groups/TextureOnlyGroup.h"
 #include "Flame/graphics/groups/EmissionOnlyGroup.h"
 #include "Model.h"
@@ -23,11 +29,13 @@ namespace Flame {
   struct MeshSystem final {
     struct HitResult final {
       union {
-        OpaqueGroup::PerInstance* perInstanceOpaque;
-        HologramGroup::PerInstance* perInstanceHologram;
-        TextureOnlyGroup::PerInstance* perInstanceTextureOnly;
-        EmissionOnlyGroup::PerInstance* perInstanceEmissionOnly;
+        OpaqueGroup::PerMaterial* perMaterialOpaque;
+        HologramGroup::PerMaterial* perMaterialHologram;
+        TextureOnlyGroup::PerMaterial* perMaterialTextureOnly;
+        EmissionOnlyGroup::PerMaterial* perMaterialEmissionOnly;
       };
+      // Resolved with PerMaterial::GetInstance() on use
+      uint32_t instanceId;
       GroupType groupType;
     };
 
@@ -36,21 +44,70 @@ namespace Flame {
     void Init();
     void Cleanup();
     void Update(float deltaTime);
-    void Render(float deltaTime);
-    void RenderDepth2D();
-    void RenderDepthCubemaps(std::span<glm::vec3> positions);
+    /// \param frustum View frustum, instances outside of it are culled
+    void Render(float deltaTime, const Frustum& frustum);
+    /// \param frustum Light volume, instances outside of it cast no shadow
+    void RenderDepth2D(const Frustum& frustum);
+    /// \param projection Projection of a single cubemap face, casters are culled per face
+    void RenderDepthCubemaps(std::span<glm::vec3> positions, const glm::mat4& projection);
 
     OpaqueGroup* GetOpaqueGroup();
     HologramGroup* GetHologramGroup();
     TextureOnlyGroup* GetTextureOnlyGroup();
     EmissionOnlyGroup* GetEmissionOnlyGroup();
 
+    /**
+     * Rebuilds the instance BVH if instances were added or removed, refits it if they moved or their meshes were refitted.
+     * Only instances of changed transforms and meshes are visited. Called from Update()
+     */
+    void UpdateTlas();
+    /// Uses the instance BVH as of the last UpdateTlas()
     bool Hit(const Ray& ray, HitRecord<HitResult>& record, float tMin, float tMax) const;
+    /**
+     * Closest hits of every ray of the stream, each within its own [tMin; tMax].
+     * Coherent packets traverse the instance and mesh BVHs together, the rest go one by one
+     * \param hits Set to 1 for rays that hit, their records are filled
+     * \return Number of rays that hit
+     */
+    uint32_t Hit(const RayStream& rays, std::span<HitRecord<HitResult>> records, std::span<uint8_t> hits) const;
+    /**
+     * Any-hit query for shadow rays: stops at the first hit and fills no record
+     * \param groupsMask Bit (1 << GroupType) set for every group that blocks the ray
+     */
+    bool Occluded(const Ray& ray, float tMin, float tMax, uint32_t groupsMask = ~0u) const;
 
     void SetShadowMapProvider(const std::shared_ptr<IShadowMapProvider>& provider);
 
     static MeshSystem* Get();
 
+  private:
+    struct TlasInstance final {
+      HitResult result;
+      const Mesh* mesh;
+      uint32_t transformId;
+      // Next instance placed by the same transform, or kNoTlasInstance
+      uint32_t nextSameTransform;
+      // Mesh space to world space and back
+      glm::mat4 meshToWorld;
+      glm::mat4 worldToMesh;
+    };
+
+    /// Instances of one mesh of one model, gathered next to each other
+    struct TlasMeshRange final {
+      const Mesh* mesh;
+      // Mesh::boxVersion as of the last UpdateTlas()
+      uint32_t boxVersion;
+      uint32_t begin;
+      uint32_t end;
+    };
+
+    template <typename Group>
+    void GatherTlasInstances(Group& group, GroupType groupType);
+    /// Recomputes the matrices and the box of the instance from its transform and mesh
+    void UpdateTlasInstance(uint32_t instanceId);
+    /// Fills the world space record from a mesh space hit of the instance
+    void FillHitRecord(const TlasInstance& instance, const HitRecord<const Mesh*>& meshRecord, HitRecord<HitResult>& record) const;
+
   private:
     Window* m_window;
 
@@ -60,5 +117,19 @@ namespace Flame {
     EmissionOnlyGroup m_emissionOnlyGroup;
 
     std::shared_ptr<IShadowMapProvider> m_shadowMapProvider;
+
+    // Top-level acceleration structure over every instance of every group
+    InstanceBvh m_tlas;
+    std::vector<TlasInstance> m_tlasInstances;
+    std::vector<Aabb> m_tlasBoxes;
+    std::vector<TlasMeshRange> m_tlasMeshRanges;
+    // First instance placed by every transform ID, or kNoTlasInstance
+    std::vector<uint32_t> m_tlasTransformHeads;
+    // GetInstancesVersion() of every group and TransformSystem::GetUpdateId() as of the last UpdateTlas()
+    std::array<uint32_t, static_cast<size_t>(GroupType::COUNT)> m_tlasGroupVersions = {};
+    uint32_t m_tlasUpdateId = 0;
+    bool m_isTlasBuilt = false;
+
+    static constexpr uint32_t kNoTlasInstance = std::numeric_limits<uint32_t>::max();
   };
 }
@@ -0,0 +1,351 @@
+#include "MeshWideBvh.h"
+
+#include <bit>
+#include <limits>
+
+#include "BvhStats.h"
+#include "Mesh.h"
+
+namespace Flame {
+  template <uint32_t Width>
+  MeshWideBvh<Width>::MeshWideBvh(const Mesh* mesh)
+  : m_mesh(mesh) {
+  }
+
+  template <uint32_t Width>
+  void MeshWideBvh<Width>::Build() {
+    const MeshBvh& bvh = m_mesh->bvh;
+    assert(!bvh.GetNodes().empty());
+    Reset();
+
+    m_nodes.reserve(bvh.GetNodes().size() / (Width - 1) + 1);
+    m_packets.reserve(bvh.GetFaceIds().size() / Width + 1);
+    InitNode(bvh, 0);
+
+    m_nodes.shrink_to_fit();
+    m_packets.shrink_to_fit();
+  }
+
+  template <uint32_t Width>
+  void MeshWideBvh<Width>::Reset() {
+    m_nodes.clear();
+    m_packets.clear();
+  }
+
+  template <uint32_t Width>
+  bool MeshWideBvh<Width>::IsBuilt() const {
+    return !m_nodes.empty();
+  }
+
+  template <uint32_t Width>
+  bool MeshWideBvh<Width>::Hit(const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const {
+    struct StackEntry final {
+      uint32_t offset;
+      uint32_t count;
+      float entryTime;
+    };
+
+    glm::vec3 invDirection = 1.0f / r.direction;
+    FLAME_BVH_COUNT(queriesCount, 1);
+
+    StackEntry stack[kMaxStackSize];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = { 0, 0, tMin };
+    bool anyHit = false;
+
+    while (stackSize != 0) {
+      const StackEntry entry = stack[--stackSize];
+      // Behind the closest hit
+      if (entry.entryTime > tMax) {
+        continue;
+      }
+
+      if (entry.count != 0) {
+        if (HitLeaf(entry.offset, entry.count, r, record, tMin, tMax)) {
+          anyHit = true;
+          tMax = record.time;
+        }
+
+        continue;
+      }
+
+      const WideNode& node = m_nodes[entry.offset];
+      alignas(Width * sizeof(float)) float entryTimesArray[Width];
+      uint32_t mask = HitNode(node, r, invDirection, tMin, tMax, entryTimesArray);
+
+      // Push hit children, keeping the nearest on top of the stack
+      uint32_t base = stackSize;
+      while (mask != 0) {
+        uint32_t i = static_cast<uint32_t>(std::countr_zero(mask));
+        mask &= mask - 1;
+
+        StackEntry child { node.offset[i], node.count[i], entryTimesArray[i] };
+        uint32_t j = stackSize++;
+        while (j > base && stack[j - 1].entryTime < child.entryTime) {
+          stack[j] = stack[j - 1];
+          --j;
+        }
+
+        stack[j] = child;
+      }
+    }
+
+    return anyHit;
+  }
+
+  template <uint32_t Width>
+  bool MeshWideBvh<Width>::Occluded(const Ray& r, float tMin, float tMax) const {
+    struct StackEntry final {
+      uint32_t offset;
+      uint32_t count;
+    };
+
+    glm::vec3 invDirection = 1.0f / r.direction;
+    FLAME_BVH_COUNT(queriesCount, 1);
+
+    StackEntry stack[kMaxStackSize];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = { 0, 0 };
+
+    while (stackSize != 0) {
+      const StackEntry entry = stack[--stackSize];
+
+      if (entry.count != 0) {
+        alignas(Width * sizeof(float)) float times[Width];
+        for (uint32_t packetId = entry.offset; packetId < entry.offset + entry.count; ++packetId) {
+          if (HitPacket(m_packets[packetId], r, tMin, tMax, times) != 0) {
+            return true;
+          }
+        }
+
+        continue;
+      }
+
+      // Any hit will do, so children are pushed without sorting
+      const WideNode& node = m_nodes[entry.offset];
+      alignas(Width * sizeof(float)) float entryTimes[Width];
+      for (uint32_t mask = HitNode(node, r, invDirection, tMin, tMax, entryTimes); mask != 0; mask &= mask - 1) {
+        uint32_t i = static_cast<uint32_t>(std::countr_zero(mask));
+        stack[stackSize++] = { node.offset[i], node.count[i] };
+      }
+    }
+
+    return false;
+  }
+
+  template <uint32_t Width>
+  uint32_t MeshWideBvh<Width>::InitNode(const MeshBvh& bvh, uint32_t binaryNodeId) {
+    const auto& binaryNodes = bvh.GetNodes();
+
+    // Pull grandchildren up until the node is full, opening the biggest compounds first
+    uint32_t children[Width] = { binaryNodeId };
+    uint32_t childrenCount = 1;
+    while (childrenCount < Width) {
+      uint32_t biggestId = Width;
+      float biggestArea = -1.0f;
+      for (uint32_t i = 0; i < childrenCount; ++i) {
+        const MeshBvh::MeshBvhNode& child = binaryNodes[children[i]];
+        if (!child.IsLeaf() && child.box.SurfaceArea() > biggestArea) {
+          biggestId = i;
+          biggestArea = child.box.SurfaceArea();
+        }
+      }
+
+      if (biggestId == Width) {
+        break;
+      }
+
+      uint32_t leftId = binaryNodes[children[biggestId]].offset;
+      children[biggestId] = leftId;
+      children[childrenCount++] = leftId + 1;
+    }
+
+    uint32_t nodeId = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.emplace_back();
+
+    for (uint32_t i = 0; i < Width; ++i) {
+      WideNode& node = m_nodes[nodeId];
+
+      if (i >= childrenCount) {
+        // Empty slot: all slab times are infinite, so it's never hit
+        node.minX[i] = node.minY[i] = node.minZ[i] = std::numeric_limits<float>::infinity();
+        node.maxX[i] = node.maxY[i] = node.maxZ[i] = std::numeric_limits<float>::infinity();
+        node.offset[i] = 0;
+        node.count[i] = 0;
+        continue;
+      }
+
+      const MeshBvh::MeshBvhNode& child = binaryNodes[children[i]];
+      node.minX[i] = child.box.Min().x;
+      node.minY[i] = child.box.Min().y;
+      node.minZ[i] = child.box.Min().z;
+      node.maxX[i] = child.box.Max().x;
+      node.maxY[i] = child.box.Max().y;
+      node.maxZ[i] = child.box.Max().z;
+
+      // Children may reallocate m_nodes
+      uint32_t offset;
+      uint32_t count;
+      if (child.IsLeaf()) {
+        offset = static_cast<uint32_t>(m_packets.size());
+        count = InitLeaf(bvh, child);
+      } else {
+        offset = InitNode(bvh, children[i]);
+        count = 0;
+      }
+
+      m_nodes[nodeId].offset[i] = offset;
+      m_nodes[nodeId].count[i] = count;
+    }
+
+    return nodeId;
+  }
+
+  template <uint32_t Width>
+  uint32_t MeshWideBvh<Width>::InitLeaf(const MeshBvh& bvh, const MeshBvh::MeshBvhNode& binaryNode) {
+    const auto& faceIds = bvh.GetFaceIds();
+    uint32_t packetsCount = (binaryNode.count + Width - 1) / Width;
+
+    for (uint32_t packetId = 0; packetId < packetsCount; ++packetId) {
+      TrianglePacket& packet = m_packets.emplace_back();
+
+      for (uint32_t lane = 0; lane < Width; ++lane) {
+        uint32_t i = packetId * Width + lane;
+        glm::vec3 v0(0.0f);
+        glm::vec3 e1(0.0f);
+        glm::vec3 e2(0.0f);
+
+        // Padding lanes are degenerate and fail the determinant test
+        if (i < binaryNode.count) {
+          const Face& face = m_mesh->faces[faceIds[binaryNode.offset + i]];
+          v0 = m_mesh->vertices[face.indices[0]];
+          e1 = m_mesh->vertices[face.indices[1]] - v0;
+          e2 = m_mesh->vertices[face.indices[2]] - v0;
+        }
+
+        packet.v0x[lane] = v0.x;
+        packet.v0y[lane] = v0.y;
+        packet.v0z[lane] = v0.z;
+        packet.e1x[lane] = e1.x;
+        packet.e1y[lane] = e1.y;
+        packet.e1z[lane] = e1.z;
+        packet.e2x[lane] = e2.x;
+        packet.e2y[lane] = e2.y;
+        packet.e2z[lane] = e2.z;
+      }
+    }
+
+    return packetsCount;
+  }
+
+  template <uint32_t Width>
+  bool MeshWideBvh<Width>::HitLeaf(uint32_t offset, uint32_t count, const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const {
+    uint32_t bestPacket = std::numeric_limits<uint32_t>::max();
+    uint32_t bestLane = 0;
+
+    for (uint32_t packetId = offset; packetId < offset + count; ++packetId) {
+      alignas(Width * sizeof(float)) float times[Width];
+      for (uint32_t bits = HitPacket(m_packets[packetId], r, tMin, tMax, times); bits != 0; bits &= bits - 1) {
+        uint32_t lane = static_cast<uint32_t>(std::countr_zero(bits));
+        if (times[lane] < tMax) {
+          tMax = times[lane];
+          bestPacket = packetId;
+          bestLane = lane;
+        }
+      }
+    }
+
+    if (bestPacket == std::numeric_limits<uint32_t>::max()) {
+      return false;
+    }
+
+    const TrianglePacket& packet = m_packets[bestPacket];
+    glm::vec3 e1(packet.e1x[bestLane], packet.e1y[bestLane], packet.e1z[bestLane]);
+    glm::vec3 e2(packet.e2x[bestLane], packet.e2y[bestLane], packet.e2z[bestLane]);
+    record.time = tMax;
+    record.point = r.AtParameter(tMax);
+    record.normal = glm::cross(e1, e2);
+    return true;
+  }
+
+  template <uint32_t Width>
+  uint32_t MeshWideBvh<Width>::HitPacket(const TrianglePacket& packet, const Ray& r, float tMin, float tMax, float* times) const {
+    using Float = SimdFloat<Width>;
+    FLAME_BVH_COUNT(triangleTests, Width);
+
+    Float directionX(r.direction.x);
+    Float directionY(r.direction.y);
+    Float directionZ(r.direction.z);
+    Float zero(0.0f);
+    Float one(1.0f);
+
+    Float e1x = Float::Load(packet.e1x);
+    Float e1y = Float::Load(packet.e1y);
+    Float e1z = Float::Load(packet.e1z);
+    Float e2x = Float::Load(packet.e2x);
+    Float e2y = Float::Load(packet.e2y);
+    Float e2z = Float::Load(packet.e2z);
+
+    // Moller-Trumbore, same as MeshBvh::IntersectTriangle() but for Width triangles
+    Float px = directionY * e2z - directionZ * e2y;
+    Float py = directionZ * e2x - directionX * e2z;
+    Float pz = directionX * e2y - directionY * e2x;
+    Float det = e1x * px + e1y * py + e1z * pz;
+    Float mask = det >= Float(0.00001f);
+    if (mask.Mask() == 0) {
+      return 0;
+    }
+
+    Float invDet = one / det;
+    Float tx = Float(r.origin.x) - Float::Load(packet.v0x);
+    Float ty = Float(r.origin.y) - Float::Load(packet.v0y);
+    Float tz = Float(r.origin.z) - Float::Load(packet.v0z);
+
+    Float u = (tx * px + ty * py + tz * pz) * invDet;
+    mask = mask & (u >= zero) & (u <= one);
+
+    Float qx = ty * e1z - tz * e1y;
+    Float qy = tz * e1x - tx * e1z;
+    Float qz = tx * e1y - ty * e1x;
+    Float v = (directionX * qx + directionY * qy + directionZ * qz) * invDet;
+    mask = mask & (v >= zero) & (u + v <= one);
+
+    Float t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+    mask = mask & (t > Float(tMin)) & (t < Float(tMax));
+
+    uint32_t bits = mask.Mask();
+    if (bits != 0) {
+      t.Store(times);
+    }
+
+    return bits;
+  }
+
+  template <uint32_t Width>
+  uint32_t MeshWideBvh<Width>::HitNode(const WideNode& node, const Ray& r, const glm::vec3& invDirection, float tMin, float tMax, float* entryTimes) const {
+    using Float = SimdFloat<Width>;
+    FLAME_BVH_COUNT(nodesVisited, 1);
+    FLAME_BVH_COUNT(boxTests, Width);
+
+    // Slab test against all children at once
+    Float originX(r.origin.x);
+    Float originY(r.origin.y);
+    Float originZ(r.origin.z);
+    Float t1x = (Float::Load(node.minX) - originX) * Float(invDirection.x);
+    Float t2x = (Float::Load(node.maxX) - originX) * Float(invDirection.x);
+    Float t1y = (Float::Load(node.minY) - originY) * Float(invDirection.y);
+    Float t2y = (Float::Load(node.maxY) - originY) * Float(invDirection.y);
+    Float t1z = (Float::Load(node.minZ) - originZ) * Float(invDirection.z);
+    Float t2z = (Float::Load(node.maxZ) - originZ) * Float(invDirection.z);
+
+    Float entry = Float::Max(Float::Max(Float::Min(t1x, t2x), Float::Min(t1y, t2y)), Float::Max(Float::Min(t1z, t2z), Float(tMin)));
+    Float exit = Float::Min(Float::Min(Float::Max(t1x, t2x), Float::Max(t1y, t2y)), Float::Min(Float::Max(t1z, t2z), Float(tMax)));
+    entry.Store(entryTimes);
+    return (entry <= exit).Mask();
+  }
+
+  template struct MeshWideBvh<4>;
+#if defined(__AVX__)
+  template struct MeshWideBvh<8>;
+#endif
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "MeshBvh.h"
+#include "Flame/math/Ray.h"
+#include "Flame/math/Simd.h"
+
+namespace Flame {
+  struct Mesh;
+
+  /**
+   * BVH with Width children per node, collapsed from a built binary MeshBvh.
+   * Child boxes and leaf triangles are stored as SoA, so a node or Width triangles are tested at once
+   */
+  template <uint32_t Width>
+  struct MeshWideBvh final {
+    static_assert(Width == 4 || Width == 8);
+
+    struct alignas(Width * sizeof(float)) WideNode final {
+      float minX[Width];
+      float minY[Width];
+      float minZ[Width];
+      float maxX[Width];
+      float maxY[Width];
+      float maxZ[Width];
+      // Compound child: index of the node. Leaf child: index of the first packet
+      uint32_t offset[Width];
+      // Number of triangle packets of a leaf child, zero for compound children
+      uint32_t count[Width];
+    };
+
+    // Triangles stored as a vertex and 2 edges, ready for Moller-Trumbore
+    struct alignas(Width * sizeof(float)) TrianglePacket final {
+      float v0x[Width];
+      float v0y[Width];
+      float v0z[Width];
+      float e1x[Width];
+      float e1y[Width];
+      float e1z[Width];
+      float e2x[Width];
+      float e2y[Width];
+      float e2z[Width];
+    };
+
+    explicit MeshWideBvh(const Mesh* mesh);
+
+    /// Collapses the binary BVH of the mesh, which has to be built beforehand
+    void Build();
+    void Reset();
+    bool IsBuilt() const;
+    bool Hit(const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const;
+    /// Any-hit query: stops at the first triangle within [tMin; tMax]
+    bool Occluded(const Ray& r, float tMin, float tMax) const;
+
+  private:
+    uint32_t InitNode(const MeshBvh& bvh, uint32_t binaryNodeId);
+    uint32_t InitLeaf(const MeshBvh& bvh, const MeshBvh::MeshBvhNode& binaryNode);
+    bool HitLeaf(uint32_t offset, uint32_t count, const Ray& r, HitRecord<const Mesh*>& record, float tMin, float tMax) const;
+    /**
+     * Moller-Trumbore against the Width triangles of a packet
+     * \param times Hit times of the lanes, only written if any lane hits
+     * \return Mask of lanes hit within (tMin; tMax)
+     */
+    uint32_t HitPacket(const TrianglePacket& packet, const Ray& r, float tMin, float tMax, float* times) const;
+    /// \return Mask of children whose boxes the ray enters within [tMin; tMax]
+    uint32_t HitNode(const WideNode& node, const Ray& r, const glm::vec3& invDirection, float tMin, float tMax, float* entryTimes) const;
+
+  public:
+    static constexpr uint32_t kMaxStackSize = MeshBvh::kMaxDepth * (Width - 1) + 1;
+
+  private:
+    const Mesh* m_mesh;
+    std::vector<WideNode> m_nodes;
+    std::vector<TrianglePacket> m_packets;
+  };
+
+  using MeshBvh4 = MeshWideBvh<4>;
+#if defined(__AVX__)
+  using MeshBvh8 = MeshWideBvh<8>;
+#endif
+  // Widest BVH available in this build
+  using MeshBvhWide = MeshWideBvh<kSimdWidth>;
+}
@@ -1,5 +1,6 @@
 #include "Model.h"
 #include "glm/ext.hpp"
+#include "Flame/utils/TaskScheduler.h"
 
 namespace Flame {
 	bool Model::Hit(const Ray& r, HitRecord<const Model*>& record, float tMin, float tMax) const {
@@ -23,6 +24,16 @@ namespace Flame {
 		return false;
 	}
 
+	bool Model::Occluded(const Ray& r, float tMin, float tMax) const {
+		for (const auto& mesh : m_meshes) {
+			if (mesh.Occluded(r, tMin, tMax)) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
 	void Model::Reset() {
 	  m_meshes.clear();
 		m_ranges.clear();
@@ -43,6 +54,8 @@ namespace Flame {
 			mesh.Parse(*scene.mMeshes[meshId]);
 			// TODO Parse textures
 		}
+
+		BuildBvhs();
 	
 		std::function<void(aiNode*)> LoadInstances;
 		LoadInstances = [&LoadInstances, this](aiNode* node) {
@@ -66,6 +79,19 @@ namespace Flame {
 		FillBuffers();
 	}
 
+	void Model::BuildBvhs(MeshBvh::BuildMode mode) {
+		TaskScheduler* scheduler = TaskScheduler::Get();
+
+		// A task per mesh, big meshes additionally split their own build into nested tasks
+		scheduler->ParallelFor(0, static_cast<uint32_t>(m_meshes.size()), 1, [this, scheduler, mode](uint32_t begin, uint32_t end) {
+			for (uint32_t meshId = begin; meshId < end; ++meshId) {
+				Mesh& mesh = m_meshes[meshId];
+				mesh.bvh.SetBuildMode(mode);
+				mesh.BuildBvh(mesh.faces.size() >= MeshBvh::kParallelBuildThreshold ? scheduler : nullptr);
+			}
+		});
+	}
+
 	void Model::GenerateRanges() {
 	  uint32_t vertexOffset = 0;
 	  uint32_t indexOffset = 0;
@@ -22,10 +22,15 @@ namespace Flame {
 		Model() = default;
 
 		bool Hit(const Ray& r, HitRecord<const Model*>& record, float tMin, float tMax) const;
+		/// \return Whether any mesh is hit within (tMin; tMax)
+		bool Occluded(const Ray& r, float tMin, float tMax) const;
 
 		void Reset();
 		void Parse(const aiScene& scene);
 
+		/// Builds BVHs of all meshes in parallel, stats are up to MeshBvh::CalculateBuildStats(). Called by Parse() with the default mode,
+		/// call again e.g. with SPATIAL_SAH for static assets where ray performance matters more than build time
+		void BuildBvhs(MeshBvh::BuildMode mode = MeshBvh::BuildMode::BINNED_SAH);
 		void GenerateRanges();
 		void FillBuffers();
 
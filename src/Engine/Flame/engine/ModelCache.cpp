@@ -0,0 +1,278 @@
+#include "ModelCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <system_error>
+#include <type_traits>
+
+#include "Engine.h"
+#include "Flame/utils/MappedFile.h"
+
+namespace Flame {
+  namespace {
+    uint64_t HashFnv1a(const uint8_t* data, size_t size, uint64_t hash = 0xCBF29CE484222325ULL) {
+      for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+      }
+
+      return hash;
+    }
+
+    // Bounds-checked reads from the mapped file: a truncated or corrupted cache is a miss, not a crash
+    struct Reader final {
+      template <typename T>
+      bool Read(T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (size - offset < sizeof(T)) {
+          return false;
+        }
+
+        std::memcpy(&value, data + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+      }
+
+      template <typename T>
+      bool ReadArray(std::vector<T>& values, size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if ((size - offset) / sizeof(T) < count) {
+          return false;
+        }
+
+        values.resize(count);
+        std::memcpy(values.data(), data + offset, count * sizeof(T));
+        offset += count * sizeof(T);
+        return true;
+      }
+
+    public:
+      const uint8_t* data;
+      size_t size;
+      size_t offset = 0;
+    };
+
+    bool AreFacesValid(std::span<const Face> faces, uint32_t verticesCount) {
+      for (const Face& face : faces) {
+        if (face.indices[0] >= verticesCount || face.indices[1] >= verticesCount || face.indices[2] >= verticesCount) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    /**
+     * Children always follow their parent, which also rules out cycles. Leaves stay within the face IDs.
+     * The depth stays below MeshBvh::kMaxDepth as the build keeps it, since traversal stacks are sized by it
+     */
+    bool AreNodesValid(std::span<const MeshBvh::MeshBvhNode> nodes, uint32_t faceIdsCount) {
+      uint32_t nodesCount = static_cast<uint32_t>(nodes.size());
+      for (uint32_t nodeId = 0; nodeId < nodesCount; ++nodeId) {
+        const MeshBvh::MeshBvhNode& node = nodes[nodeId];
+        bool isValid = node.IsLeaf()
+          ? node.offset <= faceIdsCount && node.count <= faceIdsCount - node.offset
+          : node.offset > nodeId && node.offset < nodesCount - 1;
+        if (!isValid) {
+          return false;
+        }
+      }
+
+      struct StackEntry final {
+        uint32_t nodeId;
+        uint32_t depth;
+      };
+
+      // Same walk as MeshBvh::CalculateBuildStats(). Nodes shared by several parents would make it visit more nodes than there are
+      StackEntry stack[MeshBvh::kMaxDepth + 1];
+      uint32_t stackSize = 0;
+      uint32_t visitedCount = 0;
+      stack[stackSize++] = { 0, 0 };
+      while (stackSize > 0) {
+        const StackEntry entry = stack[--stackSize];
+        const MeshBvh::MeshBvhNode& node = nodes[entry.nodeId];
+        if (++visitedCount > nodesCount) {
+          return false;
+        }
+
+        if (node.IsLeaf()) {
+          continue;
+        }
+
+        if (entry.depth + 1 >= MeshBvh::kMaxDepth) {
+          return false;
+        }
+
+        stack[stackSize++] = { node.offset, entry.depth + 1 };
+        stack[stackSize++] = { node.offset + 1, entry.depth + 1 };
+      }
+
+      return true;
+    }
+
+    bool AreFaceIdsValid(std::span<const uint32_t> faceIds, uint32_t facesCount) {
+      for (uint32_t faceId : faceIds) {
+        if (faceId >= facesCount) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    struct Writer final {
+      template <typename T>
+      void Write(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+      }
+
+      template <typename T>
+      void WriteArray(std::span<const T> values) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size_bytes()));
+      }
+
+    public:
+      std::ofstream& out;
+    };
+  }
+
+  uint64_t ModelCache::CalculateKey(const std::string& sourcePath, uint32_t loadFlags) {
+    MappedFile file;
+    if (!file.Open(sourcePath)) {
+      return 0;
+    }
+
+    uint32_t salt[2] = { loadFlags, kVersion };
+    uint64_t key = HashFnv1a(file.GetData(), file.GetSize());
+    key = HashFnv1a(reinterpret_cast<const uint8_t*>(salt), sizeof(salt), key);
+    return key != 0 ? key : 1;
+  }
+
+  std::filesystem::path ModelCache::GetCachePath(uint64_t key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.mesh", static_cast<unsigned long long>(key));
+    return std::filesystem::path(Engine::GetDirectory(L"Generated")) / "Models" / name;
+  }
+
+  bool ModelCache::Load(const std::filesystem::path& cachePath, uint64_t key, Model& model) {
+    MappedFile file;
+    if (!file.Open(cachePath)) {
+      return false;
+    }
+
+    Reader reader { file.GetData(), file.GetSize() };
+    FileHeader header;
+    if (!reader.Read(header) || header.magic != kMagic || header.version != kVersion || header.key != key) {
+      return false;
+    }
+
+    // Every mesh takes at least its header and a root node, so a corrupted count can't make reserve() huge
+    if (header.meshesCount > (reader.size - reader.offset) / (sizeof(MeshHeader) + sizeof(MeshBvh::MeshBvhNode))) {
+      return false;
+    }
+
+    model.Reset();
+    // Meshes keep pointers to themselves in their BVHs, so the vector must never reallocate
+    model.m_meshes.reserve(header.meshesCount);
+
+    for (uint32_t meshId = 0; meshId < header.meshesCount; ++meshId) {
+      Mesh& mesh = model.m_meshes.emplace_back();
+      MeshHeader meshHeader;
+      std::vector<char> name;
+      std::vector<MeshBvh::MeshBvhNode> nodes;
+      std::vector<uint32_t> faceIds;
+
+      bool isValid = reader.Read(meshHeader)
+        && meshHeader.buildMode < static_cast<uint32_t>(MeshBvh::BuildMode::COUNT)
+        && reader.ReadArray(name, meshHeader.nameLength)
+        && reader.ReadArray(mesh.vertices, meshHeader.verticesCount)
+        && reader.ReadArray(mesh.normals, meshHeader.verticesCount)
+        && reader.ReadArray(mesh.tangents, meshHeader.verticesCount)
+        && reader.ReadArray(mesh.bitangents, meshHeader.verticesCount)
+        && reader.ReadArray(mesh.uvs, meshHeader.verticesCount)
+        && reader.ReadArray(mesh.transforms, meshHeader.transformsCount)
+        && reader.ReadArray(mesh.transformsInv, meshHeader.transformsCount)
+        && reader.ReadArray(mesh.faces, meshHeader.facesCount)
+        && reader.ReadArray(nodes, meshHeader.nodesCount)
+        && meshHeader.faceIdsCount >= meshHeader.facesCount
+        && reader.ReadArray(faceIds, meshHeader.faceIdsCount)
+        && !nodes.empty()
+        && AreFacesValid(mesh.faces, meshHeader.verticesCount)
+        && AreNodesValid(nodes, meshHeader.faceIdsCount)
+        && AreFaceIdsValid(faceIds, meshHeader.facesCount);
+      // Out of range indices would be read blindly by rendering and traversal, so they are a miss as well
+      if (!isValid) {
+        model.Reset();
+        return false;
+      }
+
+      mesh.name.assign(name.begin(), name.end());
+      mesh.box = meshHeader.box;
+      mesh.bvh.SetBuildMode(static_cast<MeshBvh::BuildMode>(meshHeader.buildMode));
+      mesh.bvh.Load(std::move(nodes), std::move(faceIds));
+    }
+
+    model.GenerateRanges();
+    model.FillBuffers();
+    return true;
+  }
+
+  bool ModelCache::Save(const std::filesystem::path& cachePath, uint64_t key, const Model& model) {
+    std::error_code error;
+    std::filesystem::create_directories(cachePath.parent_path(), error);
+
+    // Written aside and renamed, so an interrupted write never leaves a broken cache under the real name
+    std::filesystem::path tempPath = cachePath;
+    tempPath += ".tmp";
+
+    {
+      std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+      if (!out) {
+        return false;
+      }
+
+      Writer writer { out };
+      writer.Write(FileHeader { kMagic, kVersion, key, static_cast<uint32_t>(model.m_meshes.size()), 0 });
+
+      for (const Mesh& mesh : model.m_meshes) {
+        assert(mesh.normals.size() == mesh.vertices.size() && mesh.uvs.size() == mesh.vertices.size());
+        assert(mesh.tangents.size() == mesh.vertices.size() && mesh.bitangents.size() == mesh.vertices.size());
+        assert(mesh.transformsInv.size() == mesh.transforms.size());
+        const auto& nodes = mesh.bvh.GetNodes();
+        writer.Write(MeshHeader {
+          static_cast<uint32_t>(mesh.name.size()),
+          static_cast<uint32_t>(mesh.vertices.size()),
+          static_cast<uint32_t>(mesh.faces.size()),
+          static_cast<uint32_t>(mesh.transforms.size()),
+          static_cast<uint32_t>(nodes.size()),
+          static_cast<uint32_t>(mesh.bvh.GetFaceIds().size()),
+          static_cast<uint32_t>(mesh.bvh.GetBuildMode()),
+          mesh.box
+        });
+
+        writer.WriteArray(std::span<const char>(mesh.name));
+        writer.WriteArray(std::span<const glm::vec3>(mesh.vertices));
+        writer.WriteArray(std::span<const glm::vec3>(mesh.normals));
+        writer.WriteArray(std::span<const glm::vec3>(mesh.tangents));
+        writer.WriteArray(std::span<const glm::vec3>(mesh.bitangents));
+        writer.WriteArray(std::span<const glm::vec2>(mesh.uvs));
+        writer.WriteArray(std::span<const glm::mat4>(mesh.transforms));
+        writer.WriteArray(std::span<const glm::mat4>(mesh.transformsInv));
+        writer.WriteArray(std::span<const Face>(mesh.faces));
+        writer.WriteArray(std::span<const MeshBvh::MeshBvhNode>(nodes));
+        writer.WriteArray(std::span<const uint32_t>(mesh.bvh.GetFaceIds()));
+      }
+
+      if (!out) {
+        return false;
+      }
+    }
+
+    std::filesystem::rename(tempPath, cachePath, error);
+    return !error;
+  }
+}
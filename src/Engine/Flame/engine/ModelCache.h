@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "Model.h"
+
+namespace Flame {
+  /**
+   * Binary cache of imported models: post-processed mesh arrays together with their flattened BVHs.
+   * Files live in Generated/Models and are named after a key made of the source file contents and import flags,
+   * so a changed asset or changed flags simply miss the cache
+   */
+  struct ModelCache final {
+    /// \return Key of the source file, 0 if it can't be read
+    static uint64_t CalculateKey(const std::string& sourcePath, uint32_t loadFlags);
+    static std::filesystem::path GetCachePath(uint64_t key);
+
+    /// Fills the model from a memory-mapped cache file, leaves it empty on failure
+    static bool Load(const std::filesystem::path& cachePath, uint64_t key, Model& model);
+    static bool Save(const std::filesystem::path& cachePath, uint64_t key, const Model& model);
+
+  private:
+    struct FileHeader final {
+      uint32_t magic;
+      uint32_t version;
+      uint64_t key;
+      uint32_t meshesCount;
+      uint32_t reserved;
+    };
+
+    struct MeshHeader final {
+      uint32_t nameLength;
+      uint32_t verticesCount;
+      uint32_t facesCount;
+      uint32_t transformsCount;
+      uint32_t nodesCount;
+      // More than facesCount if spatial splits reference faces several times
+      uint32_t faceIdsCount;
+      uint32_t buildMode;
+      Aabb box;
+    };
+
+  public:
+    static constexpr uint32_t kMagic = 0x434D4C46; // "FLMC"
+    // Bump whenever Mesh or MeshBvh layout changes
+    static constexpr uint32_t kVersion = 2;
+  };
+}
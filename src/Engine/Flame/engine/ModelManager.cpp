@@ -1,4 +1,5 @@
 #include "ModelManager.h"
+#include "ModelCache.h"
 #include "glm/ext/vector_float3.hpp"
 #include "glm/geometric.hpp"
 #include <memory>
@@ -21,16 +22,29 @@ namespace Flame {
       return true;
     }
 
+    // Warm start: skip Assimp and BVH builds entirely
+    auto model = std::make_shared<Model>();
+    uint64_t cacheKey = ModelCache::CalculateKey(path, kLoadFlags);
+    std::filesystem::path cachePath = ModelCache::GetCachePath(cacheKey);
+    if (cacheKey != 0 && ModelCache::Load(cachePath, cacheKey, *model)) {
+      m_models.emplace(path, std::move(model));
+      return true;
+    }
+
     auto scene = m_importer.ReadFile(path.c_str(), kLoadFlags);
     assert(scene && (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) != 1);
     if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)) {
       return false;
     }
 
-    auto model = std::make_shared<Model>();
     model->Parse(*scene);
-    m_models.emplace(path, std::move(model));
     m_importer.FreeScene();
+    // A failed write only means the next start parses the file again
+    if (cacheKey != 0) {
+      ModelCache::Save(cachePath, cacheKey, *model);
+    }
+
+    m_models.emplace(path, std::move(model));
 
     return true;
   }
@@ -130,7 +144,7 @@ namespace Flame {
       }
     }
 
-    mesh.BuildBvh();
+    mesh.BuildBvh(MeshBvh::BuildMode::LINEAR_MORTON);
     model->GenerateRanges();
     model->FillBuffers();
     return model;
@@ -249,7 +263,7 @@ namespace Flame {
     //   }
     // }
 
-    mesh.BuildBvh();
+    mesh.BuildBvh(MeshBvh::BuildMode::LINEAR_MORTON);
     model->GenerateRanges();
     model->FillBuffers();
     return model;
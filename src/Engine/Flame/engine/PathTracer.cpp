@@ -0,0 +1,217 @@
+#include "PathTracer.h"
+
+#include <atomic>
+#include <glm/ext/scalar_constants.hpp>
+
+#include "LightSystem.h"
+#include "Flame/math/MathUtils.h"
+#include "Flame/utils/Random.h"
+#include "Flame/utils/Timer.h"
+
+namespace Flame {
+  namespace {
+    /// Cosine-weighted direction around the normal, its pdf cancels out the Lambert cosine
+    glm::vec3 SampleCosineHemisphere(const glm::vec3& normal) {
+      float phi = 2.0f * glm::pi<float>() * Random::Float();
+      float sinThetaSq = Random::Float();
+      float sinTheta = glm::sqrt(sinThetaSq);
+      float cosTheta = glm::sqrt(1.0f - sinThetaSq);
+
+      // Branchless orthonormal basis (Duff et al. 2017)
+      float sign = normal.z >= 0.0f ? 1.0f : -1.0f;
+      float a = -1.0f / (sign + normal.z);
+      float b = normal.x * normal.y * a;
+      glm::vec3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+      glm::vec3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+
+      return glm::normalize(tangent * (glm::cos(phi) * sinTheta) + bitangent * (glm::sin(phi) * sinTheta) + normal * cosTheta);
+    }
+  }
+
+  float PathTracer::Stats::GetSamplesPerSecond() const {
+    return renderTime > 0.0f ? static_cast<float>(samplesCount) / renderTime : 0.0f;
+  }
+
+  float PathTracer::Stats::GetRaysPerSecond() const {
+    return renderTime > 0.0f ? static_cast<float>(raysCount) / renderTime : 0.0f;
+  }
+
+  PathTracer::PathTracer(const Settings& settings)
+  : m_settings(settings) {
+  }
+
+  PathTracer::Stats PathTracer::Render(const AlignedCamera& camera, PpmImage& image, TaskScheduler* scheduler) {
+    assert(m_settings.tileSize != 0 && m_settings.samplesPerPixel != 0);
+    Timer timer;
+    GatherLights();
+    // Camera updates its matrices lazily, which must not happen from several threads at once
+    camera.GetViewMatrix();
+
+    uint32_t tilesX = (image.Width() + m_settings.tileSize - 1) / m_settings.tileSize;
+    uint32_t tilesY = (image.Height() + m_settings.tileSize - 1) / m_settings.tileSize;
+    std::atomic<uint64_t> raysCount = 0;
+
+    scheduler->ParallelFor(0, tilesX * tilesY, 1, [&](uint32_t begin, uint32_t end) {
+      const MeshSystem* meshSystem = MeshSystem::Get();
+      uint64_t tileRaysCount = 0;
+      RayStream rays;
+      std::vector<HitRecord<MeshSystem::HitResult>> records(m_settings.tileSize * m_settings.tileSize);
+      std::vector<uint8_t> hits(m_settings.tileSize * m_settings.tileSize);
+      std::vector<glm::vec3> colors;
+
+      for (uint32_t tileId = begin; tileId < end; ++tileId) {
+        uint32_t beginX = (tileId % tilesX) * m_settings.tileSize;
+        uint32_t beginY = (tileId / tilesX) * m_settings.tileSize;
+        uint32_t endX = glm::min(beginX + m_settings.tileSize, image.Width());
+        uint32_t endY = glm::min(beginY + m_settings.tileSize, image.Height());
+        uint32_t tileWidth = endX - beginX;
+        uint32_t pixelsCount = tileWidth * (endY - beginY);
+        rays.Resize(pixelsCount);
+        colors.assign(pixelsCount, glm::vec3(0.0f));
+
+        for (uint32_t sample = 0; sample < m_settings.samplesPerPixel; ++sample) {
+          // Neighbouring pixels of a row form coherent packets
+          for (uint32_t i = 0; i < pixelsCount; ++i) {
+            rays.Set(i, camera.GetRandomizedRay(beginX + i % tileWidth, beginY + i / tileWidth), 0.0f, m_settings.maxDistance);
+          }
+
+          meshSystem->Hit(rays, records, hits);
+          tileRaysCount += pixelsCount;
+          for (uint32_t i = 0; i < pixelsCount; ++i) {
+            colors[i] += TracePath(rays.Get(i), records[i], hits[i] != 0, tileRaysCount);
+          }
+        }
+
+        for (uint32_t i = 0; i < pixelsCount; ++i) {
+          image.Set(beginX + i % tileWidth, beginY + i / tileWidth, colors[i] / static_cast<float>(m_settings.samplesPerPixel));
+        }
+      }
+
+      raysCount.fetch_add(tileRaysCount, std::memory_order_relaxed);
+    });
+
+    timer.Tick();
+    Stats stats;
+    stats.samplesCount = static_cast<uint64_t>(image.Width()) * image.Height() * m_settings.samplesPerPixel;
+    stats.raysCount = raysCount.load();
+    stats.renderTime = timer.GetElapsedTime();
+    return stats;
+  }
+
+  const PathTracer::Settings& PathTracer::GetSettings() const {
+    return m_settings;
+  }
+
+  void PathTracer::GatherLights() {
+    LightSystem* ls = LightSystem::Get();
+    m_directLights.clear();
+    m_sphereLights.clear();
+
+    for (const auto& light : ls->GetDirectLights()) {
+      // Same convention as the shaders: radiance times solid angle is the irradiance
+      m_directLights.push_back({ -glm::normalize(light->direction), light->radiance * light->solidAngle });
+    }
+
+    for (const auto& light : ls->GetPointLights()) {
+      m_sphereLights.push_back({ light->GetPositionWS(), light->radiance, light->radius, glm::vec3(0.0f), -1.0f, -1.0f });
+    }
+
+    for (const auto& light : ls->GetSpotLights()) {
+      m_sphereLights.push_back({ light->position, light->radiance, light->radius, glm::normalize(light->axisFront), light->cutoffCosineInner, light->cutoffCosineOuter });
+    }
+  }
+
+  glm::vec3 PathTracer::TracePath(Ray ray, HitRecord<MeshSystem::HitResult> record, bool isHit, uint64_t& raysCount) const {
+    const MeshSystem* meshSystem = MeshSystem::Get();
+    glm::vec3 radiance(0.0f);
+    glm::vec3 throughput(1.0f);
+    uint32_t bounce = 0;
+
+    while (true) {
+      if (!isHit) {
+        radiance += throughput * m_settings.skyRadiance;
+        break;
+      }
+
+      switch (record.data.groupType) {
+        case GroupType::EMISSION_ONLY_GROUP:
+          // Emissive meshes aren't sampled by SampleLights(), so there is no double counting
+          radiance += throughput * record.data.perMaterialEmissionOnly->GetInstance(record.data.instanceId).GetData().emission;
+          return radiance;
+        case GroupType::HOLOGRAM_GROUP:
+          // See-through, continue the same ray without counting a bounce
+          ++raysCount;
+          isHit = meshSystem->Hit(ray, record, record.time + m_settings.epsilon, m_settings.maxDistance);
+          continue;
+        default:
+          break;
+      }
+
+      glm::vec3 normal = record.normal;
+      if (glm::dot(normal, ray.direction) > 0.0f) {
+        normal = -normal;
+      }
+
+      glm::vec3 point = record.point + normal * m_settings.epsilon;
+      radiance += throughput * m_settings.albedo / glm::pi<float>() * SampleLights(point, normal, raysCount);
+
+      throughput *= m_settings.albedo;
+      if (++bounce > m_settings.maxBounces) {
+        break;
+      }
+
+      ray = Ray(point, SampleCosineHemisphere(normal));
+      ++raysCount;
+      isHit = meshSystem->Hit(ray, record, 0.0f, m_settings.maxDistance);
+    }
+
+    return radiance;
+  }
+
+  glm::vec3 PathTracer::SampleLights(const glm::vec3& point, const glm::vec3& normal, uint64_t& raysCount) const {
+    glm::vec3 irradiance(0.0f);
+
+    for (const DirectLightSample& light : m_directLights) {
+      float NoL = glm::dot(normal, light.toLight);
+      if (NoL > 0.0f && !IsOccluded(point, light.toLight, m_settings.maxDistance, raysCount)) {
+        irradiance += light.irradiance * NoL;
+      }
+    }
+
+    for (const SphereLightSample& light : m_sphereLights) {
+      glm::vec3 lightVec = light.position - point;
+      float distance = glm::length(lightVec);
+      glm::vec3 lightDir = lightVec / distance;
+      float NoL = glm::dot(normal, lightDir);
+      if (NoL <= 0.0f) {
+        continue;
+      }
+
+      float intensity = 1.0f;
+      if (light.cutoffCosineOuter > -1.0f) {
+        float theta = glm::dot(-lightDir, light.axisFront);
+        intensity = glm::clamp((theta - light.cutoffCosineOuter) / (light.cutoffCosineInner - light.cutoffCosineOuter), 0.0f, 1.0f);
+        if (intensity == 0.0f) {
+          continue;
+        }
+      }
+
+      if (IsOccluded(point, lightDir, distance - light.radius, raysCount)) {
+        continue;
+      }
+
+      float solidAngle = distance > light.radius ? MathUtils::SolidAngle(light.radius, distance) : 1.0f;
+      irradiance += light.radiance * (solidAngle * intensity * NoL);
+    }
+
+    return irradiance;
+  }
+
+  bool PathTracer::IsOccluded(const glm::vec3& point, const glm::vec3& direction, float distance, uint64_t& raysCount) const {
+    // Holograms don't cast shadows, same as they don't block camera rays
+    static constexpr uint32_t kShadowGroupsMask = ~(1u << static_cast<uint32_t>(GroupType::HOLOGRAM_GROUP));
+
+    ++raysCount;
+    return MeshSystem::Get()->Occluded(Ray(point, direction), 0.0f, distance, kShadowGroupsMask);
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "MeshSystem.h"
+#include "Flame/camera/AlignedCamera.h"
+#include "Flame/math/Ray.h"
+#include "Flame/utils/PpmImage.h"
+#include "Flame/utils/TaskScheduler.h"
+
+namespace Flame {
+  /**
+   * Offline CPU renderer for the current MeshSystem scene: tiles of the image are path traced in parallel
+   * with next event estimation towards LightSystem lights. Primary rays of a tile are traced as a coherent RayStream.
+   * Only CPU-side data is used. Textures live on the GPU, so every surface is a Lambertian of Settings::albedo,
+   * emission-only instances emit their color and holograms are see-through.
+   * Reads the instance BVH as of the last MeshSystem::UpdateTlas(), so the scene must not change while rendering
+   */
+  struct PathTracer final {
+    struct Settings final {
+      uint32_t samplesPerPixel = 64;
+      // Diffuse bounces after the primary hit
+      uint32_t maxBounces = 4;
+      uint32_t tileSize = 16;
+      glm::vec3 albedo { 0.7f };
+      glm::vec3 skyRadiance { 0.0f };
+      // Offset of secondary rays from the surface
+      float epsilon = 0.0001f;
+      float maxDistance = 1000.0f;
+    };
+
+    struct Stats final {
+      uint64_t samplesCount = 0;
+      uint64_t raysCount = 0;
+      float renderTime = 0.0f;
+
+      float GetSamplesPerSecond() const;
+      float GetRaysPerSecond() const;
+    };
+
+    PathTracer() = default;
+    explicit PathTracer(const Settings& settings);
+
+    /**
+     * Fills the whole image with linear radiance. Camera must have the same size as the image
+     * \return Timing and sample counts, printing them is up to the caller
+     */
+    Stats Render(const AlignedCamera& camera, PpmImage& image, TaskScheduler* scheduler = TaskScheduler::Get());
+
+    const Settings& GetSettings() const;
+
+  private:
+    struct DirectLightSample final {
+      glm::vec3 toLight;
+      glm::vec3 irradiance;
+    };
+
+    struct SphereLightSample final {
+      glm::vec3 position;
+      glm::vec3 radiance;
+      float radius;
+      // Spot lights only, cutoffCosineOuter is -1 for point lights
+      glm::vec3 axisFront;
+      float cutoffCosineInner;
+      float cutoffCosineOuter;
+    };
+
+    /// Copies lights out of LightSystem, so that tiles don't touch the shared pointers or TransformSystem
+    void GatherLights();
+    /// Continues the path from the already traced primary ray
+    glm::vec3 TracePath(Ray ray, HitRecord<MeshSystem::HitResult> record, bool isHit, uint64_t& raysCount) const;
+    /// \return Radiance reflected towards the viewer from the lights visible at the point
+    glm::vec3 SampleLights(const glm::vec3& point, const glm::vec3& normal, uint64_t& raysCount) const;
+    bool IsOccluded(const glm::vec3& point, const glm::vec3& direction, float distance, uint64_t& raysCount) const;
+
+  private:
+    Settings m_settings;
+    std::vector<DirectLightSample> m_directLights;
+    std::vector<SphereLightSample> m_sphereLights;
+  };
+}
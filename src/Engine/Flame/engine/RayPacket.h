@@ -0,0 +1,234 @@
+#pragma once
+
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "MeshBvh.h"
+#include "Flame/math/Aabb.h"
+#include "Flame/math/Ray.h"
+#include "Flame/math/RayStream.h"
+#include "Flame/math/Simd.h"
+
+namespace Flame {
+  /**
+   * Width rays traversing a BVH together: every node box is tested against all of them at once.
+   * Pays off for coherent rays (e.g. primary rays of a tile), which visit mostly the same nodes.
+   * Lanes outside activeMask never hit anything
+   */
+  template <uint32_t Width>
+  struct RayPacket final {
+    using Float = SimdFloat<Width>;
+
+    /// Takes rays [begin; begin + count) of the stream, count <= Width
+    void Load(const RayStream& rays, uint32_t begin, uint32_t count) {
+      assert(count <= Width);
+      activeMask = 0;
+      for (uint32_t lane = 0; lane < Width; ++lane) {
+        if (lane >= count) {
+          SetInactive(lane);
+          continue;
+        }
+
+        uint32_t id = begin + lane;
+        SetRay(lane, rays.Get(id), rays.tMin[id], rays.tMax[id]);
+      }
+    }
+
+    /**
+     * Same rays in another space. Directions aren't normalized, so times stay the same
+     * \param laneMask Lanes to keep active, the others are disabled
+     */
+    RayPacket Transformed(const glm::mat4& mat, uint32_t laneMask) const {
+      RayPacket packet;
+      packet.activeMask = 0;
+      for (uint32_t lane = 0; lane < Width; ++lane) {
+        if ((laneMask & activeMask & (1u << lane)) == 0) {
+          packet.SetInactive(lane);
+          continue;
+        }
+
+        Ray r = GetRay(lane);
+        glm::vec4 origin = mat * glm::vec4(r.origin, 1.0f);
+        glm::vec3 direction = mat * glm::vec4(r.direction, 0.0f);
+        packet.SetRay(lane, Ray(origin / origin.w, direction), tMin[lane], tMax[lane]);
+      }
+
+      return packet;
+    }
+
+    /// Rays heading into one octant order children the same way, which is what packet traversal relies on
+    bool IsCoherent() const {
+      Float zero(0.0f);
+      uint32_t negativeX = (Float::Load(directionX) < zero).Mask() & activeMask;
+      uint32_t negativeY = (Float::Load(directionY) < zero).Mask() & activeMask;
+      uint32_t negativeZ = (Float::Load(directionZ) < zero).Mask() & activeMask;
+      return (negativeX == 0 || negativeX == activeMask)
+        && (negativeY == 0 || negativeY == activeMask)
+        && (negativeZ == 0 || negativeZ == activeMask);
+    }
+
+    /**
+     * Slab test of all lanes against one box
+     * \param nearestEntryTime Earliest entry time among the lanes that hit
+     * \return Mask of lanes entering the box within their [tMin; tMax]
+     */
+    uint32_t HitBox(const Aabb& box, float& nearestEntryTime) const {
+      Float originXs = Float::Load(originX);
+      Float originYs = Float::Load(originY);
+      Float originZs = Float::Load(originZ);
+      Float t1x = (Float(box.Min().x) - originXs) * Float::Load(invDirectionX);
+      Float t2x = (Float(box.Max().x) - originXs) * Float::Load(invDirectionX);
+      Float t1y = (Float(box.Min().y) - originYs) * Float::Load(invDirectionY);
+      Float t2y = (Float(box.Max().y) - originYs) * Float::Load(invDirectionY);
+      Float t1z = (Float(box.Min().z) - originZs) * Float::Load(invDirectionZ);
+      Float t2z = (Float(box.Max().z) - originZs) * Float::Load(invDirectionZ);
+
+      Float entryTimes = Float::Max(Float::Max(Float::Min(t1x, t2x), Float::Min(t1y, t2y)), Float::Max(Float::Min(t1z, t2z), Float::Load(tMin)));
+      Float exitTimes = Float::Min(Float::Min(Float::Max(t1x, t2x), Float::Max(t1y, t2y)), Float::Min(Float::Max(t1z, t2z), Float::Load(tMax)));
+      uint32_t mask = (entryTimes <= exitTimes).Mask() & activeMask;
+      if (mask == 0) {
+        return 0;
+      }
+
+      alignas(Width * sizeof(float)) float entryTimesArray[Width];
+      entryTimes.Store(entryTimesArray);
+      nearestEntryTime = std::numeric_limits<float>::infinity();
+      for (uint32_t bits = mask; bits != 0; bits &= bits - 1) {
+        nearestEntryTime = glm::min(nearestEntryTime, entryTimesArray[std::countr_zero(bits)]);
+      }
+
+      return mask;
+    }
+
+    /**
+     * Front-to-back traversal of a binary BVH. A node is visited while any lane still enters it,
+     * postponed nodes are tested again when popped, since hits may have shrunk tMax meanwhile
+     * \param hitLeaf void(const MeshBvh::MeshBvhNode& leaf, uint32_t laneMask), shrinks tMax of the lanes that hit
+     */
+    template <typename HitLeafFunc>
+    void Traverse(const std::vector<MeshBvh::MeshBvhNode>& nodes, HitLeafFunc&& hitLeaf) const {
+      float entryTime;
+      uint32_t mask = nodes.empty() ? 0 : HitBox(nodes[0].box, entryTime);
+      if (mask == 0) {
+        return;
+      }
+
+      uint32_t stack[MeshBvh::kMaxDepth];
+      uint32_t stackSize = 0;
+      uint32_t nodeId = 0;
+
+      while (true) {
+        const MeshBvh::MeshBvhNode& node = nodes[nodeId];
+
+        if (node.IsLeaf()) {
+          hitLeaf(node, mask);
+        } else {
+          uint32_t nearId = node.offset;
+          uint32_t farId = node.offset + 1;
+          float nearEntryTime;
+          float farEntryTime;
+          uint32_t nearMask = HitBox(nodes[nearId].box, nearEntryTime);
+          uint32_t farMask = HitBox(nodes[farId].box, farEntryTime);
+
+          if (farMask != 0 && (nearMask == 0 || farEntryTime < nearEntryTime)) {
+            std::swap(nearId, farId);
+            std::swap(nearMask, farMask);
+          }
+
+          if (nearMask != 0) {
+            if (farMask != 0) {
+              assert(stackSize < MeshBvh::kMaxDepth);
+              stack[stackSize++] = farId;
+            }
+
+            nodeId = nearId;
+            mask = nearMask;
+            continue;
+          }
+        }
+
+        mask = 0;
+        while (stackSize != 0 && mask == 0) {
+          nodeId = stack[--stackSize];
+          mask = HitBox(nodes[nodeId].box, entryTime);
+        }
+
+        if (mask == 0) {
+          break;
+        }
+      }
+    }
+
+    Ray GetRay(uint32_t lane) const {
+      return Ray(glm::vec3(originX[lane], originY[lane], originZ[lane]), glm::vec3(directionX[lane], directionY[lane], directionZ[lane]));
+    }
+
+  private:
+    void SetRay(uint32_t lane, const Ray& r, float rayTMin, float rayTMax) {
+      originX[lane] = r.origin.x;
+      originY[lane] = r.origin.y;
+      originZ[lane] = r.origin.z;
+      directionX[lane] = r.direction.x;
+      directionY[lane] = r.direction.y;
+      directionZ[lane] = r.direction.z;
+      invDirectionX[lane] = 1.0f / r.direction.x;
+      invDirectionY[lane] = 1.0f / r.direction.y;
+      invDirectionZ[lane] = 1.0f / r.direction.z;
+      tMin[lane] = rayTMin;
+      tMax[lane] = rayTMax;
+      activeMask |= 1u << lane;
+    }
+
+    void SetInactive(uint32_t lane) {
+      // Finite values keep the math NaN-free, the empty interval makes every test fail
+      originX[lane] = originY[lane] = originZ[lane] = 0.0f;
+      directionX[lane] = directionY[lane] = directionZ[lane] = 1.0f;
+      invDirectionX[lane] = invDirectionY[lane] = invDirectionZ[lane] = 1.0f;
+      tMin[lane] = std::numeric_limits<float>::infinity();
+      tMax[lane] = -std::numeric_limits<float>::infinity();
+    }
+
+  public:
+    alignas(Width * sizeof(float)) float originX[Width];
+    alignas(Width * sizeof(float)) float originY[Width];
+    alignas(Width * sizeof(float)) float originZ[Width];
+    alignas(Width * sizeof(float)) float directionX[Width];
+    alignas(Width * sizeof(float)) float directionY[Width];
+    alignas(Width * sizeof(float)) float directionZ[Width];
+    alignas(Width * sizeof(float)) float invDirectionX[Width];
+    alignas(Width * sizeof(float)) float invDirectionY[Width];
+    alignas(Width * sizeof(float)) float invDirectionZ[Width];
+    alignas(Width * sizeof(float)) float tMin[Width];
+    alignas(Width * sizeof(float)) float tMax[Width];
+    uint32_t activeMask = 0;
+  };
+
+  // Packet as wide as the widest vector of this build
+  using RayPacketWide = RayPacket<kSimdWidth>;
+
+  /**
+   * Splits the stream into packets of consecutive rays. Coherent packets go to hitPacket(RayPacketWide&, firstRayId),
+   * the others are traced ray by ray with hitRay(rayId), since their lanes would diverge right away
+   */
+  template <typename HitPacketFunc, typename HitRayFunc>
+  void ForEachRayPacket(const RayStream& rays, HitPacketFunc&& hitPacket, HitRayFunc&& hitRay) {
+    RayPacketWide packet;
+    for (uint32_t begin = 0; begin < rays.Size(); begin += kSimdWidth) {
+      uint32_t count = glm::min(kSimdWidth, rays.Size() - begin);
+      packet.Load(rays, begin, count);
+
+      if (count > 1 && packet.IsCoherent()) {
+        hitPacket(packet, begin);
+        continue;
+      }
+
+      for (uint32_t rayId = begin; rayId < begin + count; ++rayId) {
+        hitRay(rayId);
+      }
+    }
+  }
+}
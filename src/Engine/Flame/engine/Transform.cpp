@@ -1,5 +1,7 @@
 #include "Transform.h"
 
+#include <cassert>
+#include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/euler_angles.hpp>
 #include <glm/gtx/string_cast.hpp>
 
@@ -7,7 +9,7 @@ namespace Flame {
   Transform::Transform(const glm::vec3& position, const glm::vec3& scale, const glm::quat& rotation)
   : m_position(position)
   , m_scale(scale)
-  , m_rotation(rotation) {
+  , m_rotation(glm::normalize(rotation)) {
   }
 
   void Transform::SetPosition(const glm::vec3& position) {
@@ -35,7 +37,8 @@ namespace Flame {
   }
 
   void Transform::SetRotation(const glm::quat& rotation) {
-    m_rotation = rotation;
+    // GetInverseMat() relies on a unit quaternion
+    m_rotation = glm::normalize(rotation);
   }
 
   void Transform::Rotate(float pitch, float yaw, float roll) {
@@ -89,10 +92,11 @@ namespace Flame {
   }
 
   glm::mat4 Transform::GetMat() const {
-    glm::mat4 result = glm::translate(glm::mat4(1.0f), m_position)
-      * GetRotationMat()
-      * glm::scale(glm::mat4(1.0f), m_scale);
-    return result;
+    return CalculateMat(m_position, m_scale, m_rotation);
+  }
+
+  glm::mat4 Transform::GetInverseMat() const {
+    return CalculateInverseMat(m_position, m_scale, m_rotation);
   }
 
   float Transform::GetPitch() const {
@@ -107,6 +111,19 @@ namespace Flame {
     return GetRotationEuler().z;
   }
 
+  glm::mat4 Transform::CalculateMat(const glm::vec3& position, const glm::vec3& scale, const glm::quat& rotation) {
+    return glm::translate(glm::mat4(1.0f), position)
+      * glm::mat4(rotation)
+      * glm::scale(glm::mat4(1.0f), scale);
+  }
+
+  glm::mat4 Transform::CalculateInverseMat(const glm::vec3& position, const glm::vec3& scale, const glm::quat& rotation) {
+    assert(scale.x != 0.0f && scale.y != 0.0f && scale.z != 0.0f);
+    return glm::scale(glm::mat4(1.0f), 1.0f / scale)
+      * glm::mat4(glm::conjugate(rotation))
+      * glm::translate(glm::mat4(1.0f), -position);
+  }
+
   std::ostream& operator<<(std::ostream& out, const Transform& t) {
     out << "Transform { Position: " << glm::to_string(t.m_position)
         << ", Scale: " << glm::to_string(t.m_scale)
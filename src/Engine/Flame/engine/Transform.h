@@ -5,6 +5,7 @@
 #include <glm/detail/type_quat.hpp>
 
 namespace Flame {
+  /// Position, scale and rotation. Matrices are computed on request, TransformSystem keeps them for the transforms it owns
   struct Transform final {
     Transform(const glm::vec3& position = glm::vec3 { 0.0f }, const glm::vec3& scale = glm::vec3 { 1.0f }, const glm::quat& rotation = { 1.0f, 0.0f, 0.0f, 0.0f });
 
@@ -31,6 +32,8 @@ namespace Flame {
     glm::vec3 GetRotationEuler() const;
     glm::mat4 GetRotationMat() const;
     glm::mat4 GetMat() const;
+    /// Inverted piecewise, which is cheaper and more precise than a general inverse
+    glm::mat4 GetInverseMat() const;
     /// \return Pitch in degrees
     float GetPitch() const;
     /// \return Yaw in degrees
@@ -38,6 +41,11 @@ namespace Flame {
     /// \return Roll in degrees
     float GetRoll() const;
 
+    /// Translation * rotation * scale
+    static glm::mat4 CalculateMat(const glm::vec3& position, const glm::vec3& scale, const glm::quat& rotation);
+    /// Inverse of CalculateMat(): inverse scale * conjugate rotation * negated translation, the rotation has to be a unit quaternion
+    static glm::mat4 CalculateInverseMat(const glm::vec3& position, const glm::vec3& scale, const glm::quat& rotation);
+
     friend std::ostream& operator<<(std::ostream& out, const Transform& t);
   private:
     glm::vec3 m_position = glm::vec3 { 0.0f };
@@ -1,40 +1,369 @@
 #include "TransformSystem.h"
 
+#include <algorithm>
+#include <glm/gtx/euler_angles.hpp>
+
 namespace Flame {
-  void TransformSystem::Cleanup() {
-    m_transforms.clear();
+  namespace {
+    /// Same swap-with-last removal as SolidVector::erase()
+    template <typename T>
+    void EraseAt(std::vector<T>& values, uint32_t index) {
+      values[index] = values.back();
+      values.pop_back();
+    }
   }
 
-  TransformSystem::ID TransformSystem::Insert() {
-    return m_transforms.emplace(std::make_unique<TransformData>());
+  void TransformSystem::Cleanup() {
+    m_ids.clear();
+    m_positions.clear();
+    m_scales.clear();
+    m_rotations.clear();
+    m_parents.clear();
+    m_firstChildren.clear();
+    m_nextSiblings.clear();
+    m_prevSiblings.clear();
+    m_mats.clear();
+    m_inverseMats.clear();
+    m_isDirty.clear();
+    m_hasDirty = false;
+    m_changeIds.clear();
+    m_changedIds.clear();
+    m_order.clear();
+    m_orderParents.clear();
+    m_orderSubtreeEnds.clear();
+    m_isOrderDirty = false;
   }
 
-  TransformSystem::ID TransformSystem::Insert(const TransformData& data) {
-    return m_transforms.emplace(std::make_unique<TransformData>(data));
+  TransformSystem::ID TransformSystem::Insert(const Transform& transform, ID parentId) {
+    assert(parentId == kNoParent || m_ids.occupied(parentId));
+
+    // The new element always goes to the end of the dense storage
+    ID id = m_ids.insert(0);
+    m_ids[id] = id;
+    Index index = m_ids.index(id);
+    assert(index == m_positions.size());
+
+    m_positions.emplace_back(transform.GetPosition());
+    m_scales.emplace_back(transform.GetScale());
+    m_rotations.emplace_back(transform.GetRotation());
+    m_parents.emplace_back(kNoParent);
+    m_firstChildren.emplace_back(kNoLink);
+    m_nextSiblings.emplace_back(kNoLink);
+    m_prevSiblings.emplace_back(kNoLink);
+    LinkChild(id, parentId);
+    // Right for roots already, children get their world matrices in Update()
+    m_mats.emplace_back(transform.GetMat());
+    m_inverseMats.emplace_back(transform.GetInverseMat());
+    m_isDirty.emplace_back(false);
+    m_changeIds.emplace_back(0);
+    MarkDirty(index);
+
+    // A new root is a subtree of its own at the end of the order
+    if (parentId == kNoParent && !m_isOrderDirty) {
+      m_order.emplace_back(index);
+      m_orderParents.emplace_back(kNoParent);
+      m_orderSubtreeEnds.emplace_back(static_cast<uint32_t>(m_order.size()));
+    } else {
+      m_isOrderDirty = true;
+    }
+
+    return id;
   }
 
   void TransformSystem::Remove(ID id) {
-    m_transforms.erase(id);
+    ID parentId = m_parents[m_ids.index(id)];
+    UnlinkChild(id);
+    while (m_firstChildren[m_ids.index(id)] != kNoLink) {
+      ID childId = m_firstChildren[m_ids.index(id)];
+      UnlinkChild(childId);
+      LinkChild(childId, parentId);
+      MarkDirty(m_ids.index(childId));
+    }
+
+    // The ID may be reused by the next Insert()
+    std::erase(m_changedIds, id);
+
+    Index index = m_ids.index(id);
+    m_ids.erase(id);
+    EraseAt(m_positions, index);
+    EraseAt(m_scales, index);
+    EraseAt(m_rotations, index);
+    EraseAt(m_parents, index);
+    EraseAt(m_firstChildren, index);
+    EraseAt(m_nextSiblings, index);
+    EraseAt(m_prevSiblings, index);
+    EraseAt(m_mats, index);
+    EraseAt(m_inverseMats, index);
+    EraseAt(m_isDirty, index);
+    EraseAt(m_changeIds, index);
+    // Dense indices in m_order are stale now
+    m_isOrderDirty = true;
   }
 
   bool TransformSystem::Contains(ID id) const {
-    return m_transforms.occupied(id);
+    return m_ids.occupied(id);
+  }
+
+  uint32_t TransformSystem::Size() const {
+    return m_ids.size();
+  }
+
+  void TransformSystem::Update() {
+    if (!m_hasDirty) {
+      return;
+    }
+
+    if (m_isOrderDirty) {
+      UpdateOrder();
+    }
+
+    ++m_updateId;
+    m_changedIds.clear();
+
+    // Parents come first in m_order, so their world matrices are ready by the time children read them.
+    // A dirty transform drags its whole subtree along, which is the range up to its subtree end
+    uint32_t dirtyEnd = 0;
+    for (uint32_t slot = 0; slot < m_order.size(); ++slot) {
+      Index index = m_order[slot];
+      if (m_isDirty[index]) {
+        m_isDirty[index] = false;
+        dirtyEnd = std::max(dirtyEnd, m_orderSubtreeEnds[slot]);
+      }
+
+      if (slot >= dirtyEnd) {
+        continue;
+      }
+
+      // The inverse is composed the same way as the matrix, in reverse order, rather than inverted in general
+      glm::mat4 localMat = Transform::CalculateMat(m_positions[index], m_scales[index], m_rotations[index]);
+      glm::mat4 localInverseMat = Transform::CalculateInverseMat(m_positions[index], m_scales[index], m_rotations[index]);
+      uint32_t parentSlot = m_orderParents[slot];
+      m_mats[index] = parentSlot == kNoParent ? localMat : m_mats[m_order[parentSlot]] * localMat;
+      m_inverseMats[index] = parentSlot == kNoParent ? localInverseMat : localInverseMat * m_inverseMats[m_order[parentSlot]];
+      m_changeIds[index] = m_updateId;
+      m_changedIds.emplace_back(m_ids.at(index));
+    }
+
+    m_hasDirty = false;
+  }
+
+  void TransformSystem::SetParent(ID id, ID parentId) {
+    assert(parentId == kNoParent || m_ids.occupied(parentId));
+    // Walk up from the new parent, meeting the transform itself would make a cycle
+    for (ID ancestorId = parentId; ancestorId != kNoParent; ancestorId = m_parents[m_ids.index(ancestorId)]) {
+      assert(ancestorId != id);
+      if (ancestorId == id) {
+        return;
+      }
+    }
+
+    UnlinkChild(id);
+    LinkChild(id, parentId);
+    MarkDirty(m_ids.index(id));
+    m_isOrderDirty = true;
+  }
+
+  TransformSystem::ID TransformSystem::GetParent(ID id) const {
+    return m_parents[m_ids.index(id)];
+  }
+
+  Transform TransformSystem::Get(ID id) const {
+    Index index = m_ids.index(id);
+    return Transform(m_positions[index], m_scales[index], m_rotations[index]);
+  }
+
+  void TransformSystem::Set(ID id, const Transform& transform) {
+    Index index = m_ids.index(id);
+    m_positions[index] = transform.GetPosition();
+    m_scales[index] = transform.GetScale();
+    m_rotations[index] = transform.GetRotation();
+    MarkDirty(index);
+  }
+
+  void TransformSystem::SetPosition(ID id, const glm::vec3& position) {
+    Index index = m_ids.index(id);
+    m_positions[index] = position;
+    MarkDirty(index);
+  }
+
+  void TransformSystem::SetScale(ID id, const glm::vec3& scale) {
+    Index index = m_ids.index(id);
+    m_scales[index] = scale;
+    MarkDirty(index);
+  }
+
+  void TransformSystem::SetRotation(ID id, const glm::quat& rotation) {
+    Index index = m_ids.index(id);
+    m_rotations[index] = glm::normalize(rotation);
+    MarkDirty(index);
+  }
+
+  void TransformSystem::SetRotation(ID id, float pitch, float yaw, float roll) {
+    SetRotation(id, glm::quat(glm::eulerAngleYXZ(glm::radians(yaw), glm::radians(pitch), glm::radians(roll))));
+  }
+
+  void TransformSystem::Rotate(ID id, const glm::quat& rotation) {
+    Index index = m_ids.index(id);
+    m_rotations[index] = glm::normalize(m_rotations[index] * rotation);
+    MarkDirty(index);
+  }
+
+  const glm::vec3& TransformSystem::GetPosition(ID id) const {
+    return m_positions[m_ids.index(id)];
+  }
+
+  const glm::vec3& TransformSystem::GetScale(ID id) const {
+    return m_scales[m_ids.index(id)];
   }
 
-  TransformSystem::ID TransformSystem::Size() const {
-    return m_transforms.size();
+  const glm::quat& TransformSystem::GetRotation(ID id) const {
+    return m_rotations[m_ids.index(id)];
   }
 
-  const TransformSystem::TransformData* TransformSystem::At(ID id) const {
-    return m_transforms[id].get();
+  const glm::mat4& TransformSystem::GetMat(ID id) const {
+    return m_mats[m_ids.index(id)];
   }
 
-  TransformSystem::TransformData* TransformSystem::At(ID id) {
-    return m_transforms[id].get();
+  const glm::mat4& TransformSystem::GetInverseMat(ID id) const {
+    return m_inverseMats[m_ids.index(id)];
+  }
+
+  uint32_t TransformSystem::GetUpdateId() const {
+    return m_updateId;
+  }
+
+  uint32_t TransformSystem::GetChangeId(ID id) const {
+    return m_changeIds[m_ids.index(id)];
+  }
+
+  std::span<const TransformSystem::ID> TransformSystem::GetChangedIds() const {
+    return m_changedIds;
+  }
+
+  TransformSystem::Index TransformSystem::GetIndex(ID id) const {
+    return m_ids.index(id);
+  }
+
+  std::span<const glm::mat4> TransformSystem::GetMats() const {
+    return m_mats;
+  }
+
+  std::span<const glm::mat4> TransformSystem::GetInverseMats() const {
+    return m_inverseMats;
   }
 
   TransformSystem* TransformSystem::Get() {
     static TransformSystem m_instance;
     return &m_instance;
   }
+
+  void TransformSystem::MarkDirty(Index index) {
+    m_isDirty[index] = true;
+    m_hasDirty = true;
+  }
+
+  void TransformSystem::LinkChild(ID id, ID parentId) {
+    Index index = m_ids.index(id);
+    m_parents[index] = parentId;
+    if (parentId == kNoParent) {
+      return;
+    }
+
+    Index parentIndex = m_ids.index(parentId);
+    ID nextId = m_firstChildren[parentIndex];
+    m_nextSiblings[index] = nextId;
+    m_prevSiblings[index] = kNoLink;
+    if (nextId != kNoLink) {
+      m_prevSiblings[m_ids.index(nextId)] = id;
+    }
+    m_firstChildren[parentIndex] = id;
+  }
+
+  void TransformSystem::UnlinkChild(ID id) {
+    Index index = m_ids.index(id);
+    ID parentId = m_parents[index];
+    if (parentId == kNoParent) {
+      return;
+    }
+
+    ID prevId = m_prevSiblings[index];
+    ID nextId = m_nextSiblings[index];
+    if (prevId != kNoLink) {
+      m_nextSiblings[m_ids.index(prevId)] = nextId;
+    } else {
+      m_firstChildren[m_ids.index(parentId)] = nextId;
+    }
+    if (nextId != kNoLink) {
+      m_prevSiblings[m_ids.index(nextId)] = prevId;
+    }
+
+    m_parents[index] = kNoParent;
+    m_nextSiblings[index] = kNoLink;
+    m_prevSiblings[index] = kNoLink;
+  }
+
+  void TransformSystem::UpdateOrder() {
+    uint32_t count = static_cast<uint32_t>(m_parents.size());
+
+    // Children of every transform as ranges of one array, grouped by the dense index of the parent
+    std::vector<uint32_t> childOffsets(count + 1, 0);
+    for (Index index = 0; index < count; ++index) {
+      if (m_parents[index] != kNoParent) {
+        ++childOffsets[m_ids.index(m_parents[index]) + 1];
+      }
+    }
+    for (Index index = 0; index < count; ++index) {
+      childOffsets[index + 1] += childOffsets[index];
+    }
+
+    std::vector<Index> children(childOffsets[count]);
+    std::vector<uint32_t> childCursors(childOffsets.begin(), childOffsets.end() - 1);
+    for (Index index = 0; index < count; ++index) {
+      if (m_parents[index] != kNoParent) {
+        children[childCursors[m_ids.index(m_parents[index])]++] = index;
+      }
+    }
+
+    // Preorder depth-first walk from every root, so a subtree ends up right after its root
+    m_order.clear();
+    m_orderParents.clear();
+    std::vector<uint32_t> slots(count);
+    std::vector<Index> stack;
+    for (Index rootIndex = 0; rootIndex < count; ++rootIndex) {
+      if (m_parents[rootIndex] != kNoParent) {
+        continue;
+      }
+
+      stack.emplace_back(rootIndex);
+      while (!stack.empty()) {
+        Index index = stack.back();
+        stack.pop_back();
+
+        slots[index] = static_cast<uint32_t>(m_order.size());
+        m_order.emplace_back(index);
+        m_orderParents.emplace_back(m_parents[index] == kNoParent ? kNoParent : slots[m_ids.index(m_parents[index])]);
+
+        // Reversed, so that children keep their dense order
+        for (uint32_t i = childOffsets[index + 1]; i-- > childOffsets[index];) {
+          stack.emplace_back(children[i]);
+        }
+      }
+    }
+    assert(m_order.size() == count);
+
+    // Subtree sizes bottom-up: children always come after their parents
+    std::vector<uint32_t> subtreeSizes(count, 1);
+    for (uint32_t slot = count; slot-- > 0;) {
+      if (m_orderParents[slot] != kNoParent) {
+        subtreeSizes[m_orderParents[slot]] += subtreeSizes[slot];
+      }
+    }
+
+    m_orderSubtreeEnds.resize(count);
+    for (uint32_t slot = 0; slot < count; ++slot) {
+      m_orderSubtreeEnds[slot] = slot + subtreeSizes[slot];
+    }
+
+    m_isOrderDirty = false;
+  }
 }
@@ -2,34 +2,124 @@
 
 #include "Flame/engine/Transform.h"
 #include "Flame/utils/SolidVector.h"
-#include <memory>
+#include <glm/glm.hpp>
+#include <glm/detail/type_quat.hpp>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
 
 namespace Flame {
+  /**
+   * Owns all instance transforms. Components and cached matrices live in separate dense arrays,
+   * so passes over many transforms read only what they need. IDs stay stable, dense indices don't:
+   * removing a transform moves the last one into its place.
+   *
+   * Transforms may have a parent, then their components are relative to it. Setters only store components
+   * and mark the transform dirty, world matrices are recomputed by Update() for dirty subtrees at once
+   */
   struct TransformSystem final {
-    struct TransformData final {
-      Transform transform;
-      // InverseTransform, Parent, Childos, etc...
-    };
-
-    using Container = SolidVector<std::unique_ptr<TransformData>>;
-    using ID = Container::ID;
+    using ID = SolidVector<uint32_t>::ID;
+    using Index = SolidVector<uint32_t>::Index;
 
     void Cleanup();
-    ID Insert();
-    ID Insert(const TransformData& data);
+    /// \param parentId Transform the new one is relative to, or kNoParent
+    ID Insert(const Transform& transform = Transform(), ID parentId = kNoParent);
+    /// Children of the removed transform are attached to its parent, keeping their local components
     void Remove(ID id);
     bool Contains(ID id) const;
-    ID Size() const;
+    uint32_t Size() const;
+
+    /**
+     * Recomputes world matrices and their inverses of every dirty transform and all of its descendants,
+     * parents first. Called once per frame before matrices are read, does nothing if nothing changed
+     */
+    void Update();
+
+    /// Keeps local components, so the transform moves along with its new parent. Cycles aren't allowed
+    void SetParent(ID id, ID parentId);
+    /// \return Parent ID or kNoParent
+    ID GetParent(ID id) const;
+
+    /// \return Copy of the local transform, setters of the copy don't affect the stored one
+    Transform Get(ID id) const;
+    void Set(ID id, const Transform& transform);
 
-    const TransformData* At(ID id) const;
-    TransformData* At(ID id);
+    void SetPosition(ID id, const glm::vec3& position);
+    void SetScale(ID id, const glm::vec3& scale);
+    void SetRotation(ID id, const glm::quat& rotation);
+    /// Angles in degrees, same order as Transform::SetRotation()
+    void SetRotation(ID id, float pitch, float yaw, float roll);
+    void Rotate(ID id, const glm::quat& rotation);
+
+    const glm::vec3& GetPosition(ID id) const;
+    const glm::vec3& GetScale(ID id) const;
+    const glm::quat& GetRotation(ID id) const;
+    /// \return Local to world matrix as of the last Update()
+    const glm::mat4& GetMat(ID id) const;
+    /// \return World to local matrix as of the last Update()
+    const glm::mat4& GetInverseMat(ID id) const;
+
+    /// \return Number of Update() calls that changed anything, never goes back, even after Cleanup()
+    uint32_t GetUpdateId() const;
+    /**
+     * \return GetUpdateId() as of the last Update() that changed the world matrix of the transform.
+     * Consumers that remember the update ID they last synced at only need to revisit transforms with a greater one
+     */
+    uint32_t GetChangeId(ID id) const;
+    /// \return Transforms changed by the Update() that GetUpdateId() refers to and not removed since then
+    std::span<const ID> GetChangedIds() const;
+
+    /// \return Dense index of the transform, valid until the next Remove()
+    Index GetIndex(ID id) const;
+    /// Dense arrays, indexed by GetIndex()
+    std::span<const glm::mat4> GetMats() const;
+    std::span<const glm::mat4> GetInverseMats() const;
 
     static TransformSystem* Get();
 
+  public:
+    static constexpr ID kNoParent = std::numeric_limits<ID>::max();
+
+  private:
+    static constexpr ID kNoLink = std::numeric_limits<ID>::max();
+
   private:
     TransformSystem() = default;
 
-  public:
-    Container m_transforms;
+    void MarkDirty(Index index);
+    /// Adds the transform to the children of parentId, which may be kNoParent
+    void LinkChild(ID id, ID parentId);
+    void UnlinkChild(ID id);
+    /// Sorts transforms depth-first, so that every subtree takes a contiguous range of m_order after its root
+    void UpdateOrder();
+
+  private:
+    // Dense index -> ID, owns the ID scheme. Every array below is kept in the same order
+    SolidVector<ID> m_ids;
+    std::vector<glm::vec3> m_positions;
+    std::vector<glm::vec3> m_scales;
+    std::vector<glm::quat> m_rotations;
+    std::vector<ID> m_parents;
+    // Children of every transform as a doubly linked list of IDs, so that removal only visits the children
+    std::vector<ID> m_firstChildren;
+    std::vector<ID> m_nextSiblings;
+    std::vector<ID> m_prevSiblings;
+    std::vector<glm::mat4> m_mats;
+    std::vector<glm::mat4> m_inverseMats;
+    // Local components changed since the last Update()
+    std::vector<uint8_t> m_isDirty;
+    bool m_hasDirty = false;
+    std::vector<uint32_t> m_changeIds;
+    uint32_t m_updateId = 0;
+    std::vector<ID> m_changedIds;
+
+    // Dense indices in depth-first order, rebuilt by UpdateOrder() after the hierarchy changes
+    std::vector<Index> m_order;
+    // Position of the parent in m_order, or kNoParent
+    std::vector<uint32_t> m_orderParents;
+    // Position in m_order right after the last descendant
+    std::vector<uint32_t> m_orderSubtreeEnds;
+    bool m_isOrderDirty = false;
   };
 }
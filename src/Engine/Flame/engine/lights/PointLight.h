@@ -13,8 +13,7 @@ namespace Flame {
 
   public:
     glm::vec3 GetPositionWS() const {
-      auto m = TransformSystem::Get()->At(parentTransformId)->transform.GetMat();
-      return glm::vec3(position.x + m[3][0], position.y + m[3][1], position.z + m[3][2]);
+      return glm::vec3(TransformSystem::Get()->GetMat(parentTransformId) * glm::vec4(position, 1.0f));
     }
 
     ShaderData ToShaderData() const {
@@ -27,6 +26,7 @@ namespace Flame {
 
   public:
     uint32_t parentTransformId;
+    // Relative to the parent transform, so it's rotated and scaled along with it
     glm::vec3 position;
     glm::vec3 radiance;
     float radius;
@@ -1,6 +1,7 @@
 #include "DxRenderer.h"
 #include "Flame/engine/LightSystem.h"
 #include "Flame/engine/MeshSystem.h"
+#include "Flame/engine/TransformSystem.h"
 #include "Flame/math/HitRecord.h"
 #include "Flame/utils/PtrProxy.h"
 
@@ -173,6 +174,9 @@ namespace Flame {
     // Update Frame CBuffer
     UpdateFrameBuffer(time);
 
+    // Transforms may have moved since MeshSystem::Update(), lights and instances read their world matrices below
+    TransformSystem::Get()->Update();
+
     // Update light matrices
     UpdateMatricesDirect();
     UpdateMatricesSpot();
@@ -206,7 +210,7 @@ namespace Flame {
     // dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
     // dc->Draw(3, 0);
 
-    MeshSystem::Get()->Render(deltaTime);
+    MeshSystem::Get()->Render(deltaTime, Frustum::FromCorners(m_camera->GetFrustumCornersWS()));
     RenderSkybox();
 
     // Resolve HDR -> LDR
@@ -411,7 +415,7 @@ namespace Flame {
       dc->OMSetRenderTargets(1, PtrProxy<ID3D11RenderTargetView*>(nullptr).Ptr(), m_shadowMapDsvDirect[i].Get());
       dc->ClearDepthStencilView(m_shadowMapDsvDirect[i].Get(), D3D11_CLEAR_DEPTH, 0.0f, 0);
 
-      MeshSystem::Get()->RenderDepth2D();
+      MeshSystem::Get()->RenderDepth2D(Frustum::FromMatrix(light->projectionMat * light->viewMat));
     }
   }
 
@@ -521,7 +525,7 @@ namespace Flame {
       dc->OMSetRenderTargets(1, PtrProxy<ID3D11RenderTargetView*>(nullptr).Ptr(), m_shadowMapDsvSpot[i].Get());
       dc->ClearDepthStencilView(m_shadowMapDsvSpot[i].Get(), D3D11_CLEAR_DEPTH, 0.0f, 0);
 
-      MeshSystem::Get()->RenderDepth2D();
+      MeshSystem::Get()->RenderDepth2D(Frustum::FromMatrix(light->projectionMat * light->GetViewMatrix()));
     }
   }
 
@@ -598,7 +602,7 @@ namespace Flame {
     dc->OMSetRenderTargets(1, PtrProxy<ID3D11RenderTargetView*>(nullptr).Ptr(), m_shadowMapDsvPoint.Get());
     dc->ClearDepthStencilView(m_shadowMapDsvPoint.Get(), D3D11_CLEAR_DEPTH, 0.0f, 0);
 
-    MeshSystem::Get()->RenderDepthCubemaps(positions);
+    MeshSystem::Get()->RenderDepthCubemaps(positions, m_viewCBuffer.data.projectionMatrix);
   }
 
   void DxRenderer::RenderSkybox() {
@@ -8,5 +8,4 @@ namespace Flame {
   inline static const uint32_t kLightCBufferId = 2;
   // TODO Not used by some groups for now
   inline static const uint32_t kMeshCBufferId = 3;
-  inline static const uint32_t kDepthCubemapCBufferId = 4;
 }
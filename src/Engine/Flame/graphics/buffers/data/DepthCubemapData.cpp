@@ -1 +0,0 @@
-#include "DepthCubemapData.h"
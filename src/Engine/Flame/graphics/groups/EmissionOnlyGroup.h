@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 
 #include "Flame/engine/TransformSystem.h"
+#include "InstanceStaging.h"
 #include "ShaderGroup.h"
 #include "Flame/engine/Transform.h"
 #include "Flame/engine/Model.h"
@@ -20,7 +21,7 @@ namespace Flame {
 
     ShaderData GetShaderData() const {
       ShaderData data;
-      data.modelMatrix = TransformSystem::Get()->At(transformId)->transform.GetMat();
+      data.modelMatrix = TransformSystem::Get()->GetMat(transformId);
       data.emission = emission;
       return data;
     }
@@ -47,6 +48,7 @@ namespace Flame {
   private:
     ShaderPipeline m_pipeline;
     VertexBuffer<EmissionOnlyInstanceData::ShaderData> m_instanceBuffer;
+    InstanceStaging<EmissionOnlyInstanceData::ShaderData> m_instanceStaging;
     uint32_t m_instanceCount = 0;
 
     inline static const wchar_t* kShaderPath = L"Assets/Shaders/emission.hlsl";
@@ -24,29 +24,30 @@ namespace Flame {
     m_pipeline.Reset();
     m_instanceBuffer.Reset();
     m_instanceCount = 0;
-    GetModels().clear();
+    m_instanceStaging.Reset();
+    Clear();
   }
 
   void HologramGroup::UpdateInstanceBufferData() {
     auto mapping = m_instanceBuffer.Map(D3D11_MAP_WRITE_DISCARD);
-    auto destPtr = static_cast<HologramInstanceData::ShaderData*>(mapping.pData);
-    uint32_t numCopied = 0;
-
-    for (const auto& perModel : GetModels()) {
-      for (const auto & perMesh : perModel->GetMeshes()) {
-        for (const auto & perMaterial : perMesh->GetMaterials()) {
-          for (const auto & perInstance : perMaterial->GetInstances()) {
-            destPtr[numCopied++] = perInstance->GetData().GetShaderData();
-          }
-        }
-      }
-    }
-
+    m_instanceStaging.CopyTo(mapping.pData, TaskScheduler::Get());
     m_instanceBuffer.Unmap();
   }
 
   void HologramGroup::UpdateInstanceBuffer() {
-    uint32_t instanceCount = GetInstanceCount();
+    auto instances = GetInstances();
+    uint32_t instanceCount = static_cast<uint32_t>(instances.size());
+    bool isChanged = m_instanceStaging.Update(instanceCount, GetInstancesVersion(), [&](uint32_t i) {
+      return instances[i].GetData().transformId;
+    }, [&](uint32_t i) {
+      return instances[i].GetData().GetShaderData();
+    }, TaskScheduler::Get());
+
+    // Nothing moved since the last upload, the buffer is still valid
+    if (!isChanged) {
+      return;
+    }
+
     if (m_instanceCount != instanceCount) {
       m_instanceCount = instanceCount;
       HRESULT result = m_instanceBuffer.Init(m_instanceCount, D3D11_CPU_ACCESS_WRITE, D3D11_USAGE_DYNAMIC);
@@ -64,7 +65,6 @@ namespace Flame {
     m_pipeline.Bind();
     dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST);
 
-    uint32_t numRenderedInstances = 0;
     for (const auto & perModel : GetModels()) {
       const auto& model = perModel->GetModel();
 
@@ -94,13 +94,12 @@ namespace Flame {
         for (const auto & perMaterial : perMesh->GetMaterials()) {
           const auto& instances = perMaterial->GetInstances();
           const auto& range = model->m_ranges[meshId];
-          uint32_t numInstances = instances.size();
+          uint32_t numInstances = static_cast<uint32_t>(instances.size());
           if (numInstances == 0) {
             continue;
           }
 
-          dc->DrawIndexedInstanced(range.indexNum, numInstances, range.indexOffset, range.vertexOffset, numRenderedInstances);
-          numRenderedInstances += numInstances;
+          dc->DrawIndexedInstanced(range.indexNum, numInstances, range.indexOffset, range.vertexOffset, perMaterial->GetInstanceOffset());
         }
       }
     }
@@ -6,6 +6,7 @@
 
 #include "Flame/engine/TransformSystem.h"
 #include "Flame/utils/SolidVector.h"
+#include "InstanceStaging.h"
 #include "ShaderGroup.h"
 #include "Flame/engine/Transform.h"
 #include "Flame/engine/Model.h"
@@ -31,7 +32,7 @@ namespace Flame {
 
     ShaderData GetShaderData() const {
       ShaderData data;
-      data.modelMatrix = TransformSystem::Get()->At(transformId)->transform.GetMat();
+      data.modelMatrix = TransformSystem::Get()->GetMat(transformId);
       data.mainColor = mainColor;
       data.secondaryColor = secondaryColor;
       return data;
@@ -60,6 +61,7 @@ namespace Flame {
   private:
     ShaderPipeline m_pipeline;
     VertexBuffer<HologramInstanceData::ShaderData> m_instanceBuffer;
+    InstanceStaging<HologramInstanceData::ShaderData> m_instanceStaging;
     uint32_t m_instanceCount = 0;
 
     inline static const wchar_t* kShaderPath = L"Assets/Shaders/hologram.hlsl";
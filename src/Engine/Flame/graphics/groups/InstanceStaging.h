@@ -0,0 +1,203 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "Flame/engine/TransformSystem.h"
+#include "Flame/math/Simd.h"
+#include "Flame/utils/TaskScheduler.h"
+
+namespace Flame {
+  /**
+   * CPU copy of an instance buffer. Instead of packing every instance every frame, only instances whose
+   * transform changed since the last sync are packed again, and nothing at all if no transform changed.
+   * Knows nothing about D3D, the caller uploads with CopyTo() when Update() reports a change.
+   * With a scheduler, packing and copying are split into chunks run in parallel
+   */
+  template <typename ShaderDataType>
+  struct InstanceStaging final {
+    static_assert(sizeof(ShaderDataType) % sizeof(float) == 0);
+
+    /**
+     * \param instancesVersion Changes whenever instances are added, removed or edited, everything is packed again then
+     * \param transformIdOf uint32_t(uint32_t instanceIndex)
+     * \param pack ShaderDataType(uint32_t instanceIndex), called from several threads at once with a scheduler
+     * \return Whether the data changed and has to be uploaded
+     */
+    template <typename TransformIdFunc, typename PackFunc>
+    bool Update(uint32_t instancesCount, uint32_t instancesVersion, TransformIdFunc&& transformIdOf, PackFunc&& pack, TaskScheduler* scheduler = nullptr) {
+      const TransformSystem* transformSystem = TransformSystem::Get();
+      uint32_t updateId = transformSystem->GetUpdateId();
+
+      if (!m_isValid || instancesVersion != m_instancesVersion || instancesCount != m_data.size()) {
+        Rebuild(instancesCount, transformIdOf, pack, scheduler);
+        m_isValid = true;
+        m_instancesVersion = instancesVersion;
+        m_syncedUpdateId = updateId;
+        return true;
+      }
+
+      if (updateId == m_syncedUpdateId) {
+        return false;
+      }
+
+      std::atomic<bool> isChanged = false;
+      if (updateId == m_syncedUpdateId + 1) {
+        // Synced every update, which is the usual case: the system knows exactly what changed.
+        // Transforms in the list are unique, so no two chunks write the same instance
+        std::span<const TransformSystem::ID> changedIds = transformSystem->GetChangedIds();
+        ForEachChunk(scheduler, static_cast<uint32_t>(changedIds.size()), [&](uint32_t begin, uint32_t end) {
+          bool isChunkChanged = false;
+          for (uint32_t changedId = begin; changedId < end; ++changedId) {
+            TransformSystem::ID transformId = changedIds[changedId];
+            if (transformId >= m_firstInstanceIds.size()) {
+              continue;
+            }
+
+            for (uint32_t i = m_firstInstanceIds[transformId]; i != kNoInstance; i = m_nextInstanceIds[i]) {
+              m_data[i] = pack(i);
+              isChunkChanged = true;
+            }
+          }
+
+          if (isChunkChanged) {
+            isChanged.store(true, std::memory_order_relaxed);
+          }
+        });
+      } else {
+        ForEachChunk(scheduler, instancesCount, [&](uint32_t begin, uint32_t end) {
+          bool isChunkChanged = false;
+          for (uint32_t i = begin; i < end; ++i) {
+            if (transformSystem->GetChangeId(transformIdOf(i)) > m_syncedUpdateId) {
+              m_data[i] = pack(i);
+              isChunkChanged = true;
+            }
+          }
+
+          if (isChunkChanged) {
+            isChanged.store(true, std::memory_order_relaxed);
+          }
+        });
+      }
+
+      m_syncedUpdateId = updateId;
+      return isChanged.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Copies the data to a mapped buffer. Uses non-temporal stores, since the destination is usually
+     * write-combined memory that is never read back by the CPU
+     */
+    void CopyTo(void* destination, TaskScheduler* scheduler = nullptr) const {
+      using Simd = SimdFloat<4>;
+      const float* source = reinterpret_cast<const float*>(m_data.data());
+      float* dest = static_cast<float*>(destination);
+      size_t floatsCount = m_data.size() * sizeof(ShaderDataType) / sizeof(float);
+
+      if (reinterpret_cast<uintptr_t>(dest) % alignof(Simd) != 0) {
+        std::memcpy(dest, source, floatsCount * sizeof(float));
+        return;
+      }
+
+      uint32_t blocksCount = static_cast<uint32_t>(floatsCount / Simd::kWidth);
+      ForEachChunk(scheduler, blocksCount, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t blockId = begin; blockId < end; ++blockId) {
+          Simd::LoadUnaligned(source + blockId * Simd::kWidth).StoreStream(dest + blockId * Simd::kWidth);
+        }
+        _mm_sfence();
+      });
+
+      size_t tailOffset = static_cast<size_t>(blocksCount) * Simd::kWidth;
+      std::memcpy(dest + tailOffset, source + tailOffset, (floatsCount - tailOffset) * sizeof(float));
+    }
+
+    /// Copies the entries of the given instances one after another, e.g. only the visible ones
+    void CopyTo(void* destination, std::span<const uint32_t> instanceIds, TaskScheduler* scheduler = nullptr) const {
+      using Simd = SimdFloat<4>;
+      ShaderDataType* dest = static_cast<ShaderDataType*>(destination);
+      // Every entry starts aligned only if the first one does and the size is a multiple of the vector
+      bool isStreamed = sizeof(ShaderDataType) % sizeof(Simd) == 0 && reinterpret_cast<uintptr_t>(dest) % alignof(Simd) == 0;
+
+      ForEachChunk(scheduler, static_cast<uint32_t>(instanceIds.size()), [&](uint32_t begin, uint32_t end) {
+        if (!isStreamed) {
+          for (uint32_t i = begin; i < end; ++i) {
+            dest[i] = m_data[instanceIds[i]];
+          }
+          return;
+        }
+
+        for (uint32_t i = begin; i < end; ++i) {
+          const float* sourceFloats = reinterpret_cast<const float*>(&m_data[instanceIds[i]]);
+          float* destFloats = reinterpret_cast<float*>(dest + i);
+          for (uint32_t j = 0; j < sizeof(ShaderDataType) / sizeof(float); j += Simd::kWidth) {
+            Simd::LoadUnaligned(sourceFloats + j).StoreStream(destFloats + j);
+          }
+        }
+        _mm_sfence();
+      });
+    }
+
+    /// Forces the next Update() to pack everything
+    void Reset() {
+      m_data.clear();
+      m_firstInstanceIds.clear();
+      m_nextInstanceIds.clear();
+      m_isValid = false;
+    }
+
+    std::span<const ShaderDataType> GetData() const {
+      return m_data;
+    }
+
+  private:
+    template <typename TransformIdFunc, typename PackFunc>
+    void Rebuild(uint32_t instancesCount, TransformIdFunc&& transformIdOf, PackFunc&& pack, TaskScheduler* scheduler) {
+      m_data.resize(instancesCount);
+      ForEachChunk(scheduler, instancesCount, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+          m_data[i] = pack(i);
+        }
+      });
+
+      // Instances sharing a transform are chained
+      m_firstInstanceIds.clear();
+      m_nextInstanceIds.resize(instancesCount);
+      for (uint32_t i = 0; i < instancesCount; ++i) {
+        uint32_t transformId = transformIdOf(i);
+        if (transformId >= m_firstInstanceIds.size()) {
+          m_firstInstanceIds.resize(transformId + 1, kNoInstance);
+        }
+        m_nextInstanceIds[i] = m_firstInstanceIds[transformId];
+        m_firstInstanceIds[transformId] = i;
+      }
+    }
+
+    /// Calls func(chunkBegin, chunkEnd) for every kParallelChunkSize-long piece of [0; count)
+    template <typename Func>
+    static void ForEachChunk(TaskScheduler* scheduler, uint32_t count, Func&& func) {
+      if (scheduler == nullptr) {
+        func(0, count);
+      } else {
+        scheduler->ParallelFor(0, count, kParallelChunkSize, func);
+      }
+    }
+
+  public:
+    static constexpr uint32_t kNoInstance = std::numeric_limits<uint32_t>::max();
+    // Elements per parallel task, small enough to balance and big enough to outweigh the scheduling
+    static constexpr uint32_t kParallelChunkSize = 1 << 12;
+
+  private:
+    std::vector<ShaderDataType> m_data;
+    // Instances by transform ID, a list per transform
+    std::vector<uint32_t> m_firstInstanceIds;
+    std::vector<uint32_t> m_nextInstanceIds;
+    bool m_isValid = false;
+    uint32_t m_instancesVersion = 0;
+    uint32_t m_syncedUpdateId = 0;
+  };
+}
@@ -3,6 +3,8 @@
 #include <d3d11.h>
 #include <Flame/engine/Engine.h>
 #include <Flame/graphics/buffers/CBufferIndices.h>
+#include <Flame/math/MathUtils.h>
+#include <cstring>
 
 namespace Flame {
   void OpaqueGroup::Init() {
@@ -38,13 +40,28 @@ namespace Flame {
 
       m_pipelineDepth2D.Init(kDepth2DShaderPath, ShaderType::VERTEX_SHADER);
       m_pipelineDepth2D.CreateInputLayout(desc);
+    }
+
+    {
+      D3D11_INPUT_ELEMENT_DESC desc[] = {
+        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "BITANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "MODEL", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "MODEL", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "MODEL", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "MODEL", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "CUBEMAP_POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 2, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "ARRAY_ID", 0, DXGI_FORMAT_R32_UINT, 2, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+      };
 
       m_pipelineDepthCubemap.Init(kDepthCubemapShaderPath, ShaderType::VERTEX_SHADER | ShaderType::GEOMETRY_SHADER);
       m_pipelineDepthCubemap.CreateInputLayout(desc);
     }
 
     m_meshBuffer.Init();
-    m_cubemapDepthBuffer.Init();
 
     m_diffuseView = TextureManager::Get()->GetTexture(Engine::GetDirectory(L"Generated\\Textures\\IBL\\diffuse.dds"))->GetResourceView();
     m_specularView = TextureManager::Get()->GetTexture(Engine::GetDirectory(L"Generated\\Textures\\IBL\\specular.dds"))->GetResourceView();
@@ -61,11 +78,22 @@ namespace Flame {
     // Instance (vertex) buffers
     m_instanceBuffer.Reset();
     m_instanceBufferDepth.Reset();
+    m_instanceBufferFaces.Reset();
     m_instanceCount = 0;
+    m_instanceCountDepth = 0;
+    m_instanceCountFaces = 0;
+    m_instanceStaging.Reset();
+    m_instanceStagingDepth.Reset();
+    m_visibleInstances.ids.clear();
+    m_visibleInstances.bucketOffsets.clear();
+    m_uploadedVisibleIds.clear();
+    m_casters.ids.clear();
+    m_casters.bucketOffsets.clear();
+    m_faceCasters.clear();
+    m_casterFaces.clear();
 
     m_meshBuffer.Reset();
-    m_cubemapDepthBuffer.Reset();
-    GetModels().clear();
+    Clear();
   }
 
   void OpaqueGroup::SetShadowMapProvider(const std::shared_ptr<IShadowMapProvider>& provider) {
@@ -74,24 +102,26 @@ namespace Flame {
 
   void OpaqueGroup::UpdateInstanceBufferData() {
     auto mapping = m_instanceBuffer.Map(D3D11_MAP_WRITE_DISCARD);
-    auto destPtr = static_cast<OpaqueInstanceData::ShaderData*>(mapping.pData);
-    uint32_t numCopied = 0;
-
-    for (const auto& perModel : GetModels()) {
-      for (const auto & perMesh : perModel->GetMeshes()) {
-        for (const auto & perMaterial : perMesh->GetMaterials()) {
-          for (const auto & perInstance : perMaterial->GetInstances()) {
-            destPtr[numCopied++] = perInstance->GetData().GetShaderData();
-          }
-        }
-      }
-    }
-
+    m_instanceStaging.CopyTo(mapping.pData, m_visibleInstances.ids, TaskScheduler::Get());
     m_instanceBuffer.Unmap();
+    m_uploadedVisibleIds = m_visibleInstances.ids;
   }
 
   void OpaqueGroup::UpdateInstanceBuffer() {
-    uint32_t instanceCount = GetInstanceCount();
+    auto instances = GetInstances();
+    uint32_t instanceCount = static_cast<uint32_t>(instances.size());
+    bool isChanged = m_instanceStaging.Update(instanceCount, GetInstancesVersion(), [&](uint32_t i) {
+      return instances[i].GetData().transformId;
+    }, [&](uint32_t i) {
+      return instances[i].GetData().GetShaderData();
+    }, TaskScheduler::Get());
+
+    // Nothing moved and the same instances are visible, the buffer is still valid
+    if (!isChanged && m_visibleInstances.ids == m_uploadedVisibleIds) {
+      return;
+    }
+
+    // Sized for all instances, so that it isn't recreated whenever the number of visible ones changes
     if (m_instanceCount != instanceCount) {
       m_instanceCount = instanceCount;
       HRESULT result = m_instanceBuffer.Init(m_instanceCount, D3D11_CPU_ACCESS_WRITE, D3D11_USAGE_DYNAMIC);
@@ -103,26 +133,28 @@ namespace Flame {
 
   void OpaqueGroup::UpdateInstanceBufferDataDepth() {
     auto mapping = m_instanceBufferDepth.Map(D3D11_MAP_WRITE_DISCARD);
-    auto destPtr = static_cast<OpaqueInstanceData::DepthShaderData*>(mapping.pData);
-    uint32_t numCopied = 0;
-
-    for (const auto& perModel : GetModels()) {
-      for (const auto & perMesh : perModel->GetMeshes()) {
-        for (const auto & perMaterial : perMesh->GetMaterials()) {
-          for (const auto & perInstance : perMaterial->GetInstances()) {
-            destPtr[numCopied++] = perInstance->GetData().GetDepthShaderData();
-          }
-        }
-      }
-    }
-
+    m_instanceStagingDepth.CopyTo(mapping.pData, m_casters.ids, TaskScheduler::Get());
     m_instanceBufferDepth.Unmap();
   }
 
   void OpaqueGroup::UpdateInstanceBufferDepth() {
-    uint32_t instanceCount = GetInstanceCount();
-    if (m_instanceCountDepth != instanceCount) {
-      m_instanceCountDepth = instanceCount;
+    auto instances = GetInstances();
+    uint32_t instanceCount = static_cast<uint32_t>(instances.size());
+    m_instanceStagingDepth.Update(instanceCount, GetInstancesVersion(), [&](uint32_t i) {
+      return instances[i].GetData().transformId;
+    }, [&](uint32_t i) {
+      return instances[i].GetData().GetDepthShaderData();
+    }, TaskScheduler::Get());
+
+    // Casters differ from pass to pass, so unlike the main pass there is nothing to reuse
+    uint32_t castersCount = static_cast<uint32_t>(m_casters.ids.size());
+    if (castersCount == 0) {
+      return;
+    }
+
+    // Only grows, an instance may be a caster of several cubemap faces
+    if (m_instanceCountDepth < castersCount) {
+      m_instanceCountDepth = castersCount;
       HRESULT result = m_instanceBufferDepth.Init(m_instanceCountDepth, D3D11_CPU_ACCESS_WRITE, D3D11_USAGE_DYNAMIC);
       assert(SUCCEEDED(result));
     }
@@ -130,7 +162,47 @@ namespace Flame {
     UpdateInstanceBufferDataDepth();
   }
 
-  void OpaqueGroup::Render() {
+  void OpaqueGroup::MergeCasterFaces(std::span<glm::vec3> positions) {
+    uint32_t bucketsCount = GetBucketsCount();
+    m_casters.ids.clear();
+    m_casters.bucketOffsets.resize(bucketsCount + 1);
+    m_casterFaces.clear();
+
+    for (uint32_t bucketId = 0; bucketId < bucketsCount; ++bucketId) {
+      m_casters.bucketOffsets[bucketId] = static_cast<uint32_t>(m_casters.ids.size());
+      for (uint32_t passId = 0; passId < m_faceCasters.size(); ++passId) {
+        const InstanceList& casters = m_faceCasters[passId];
+        auto begin = casters.ids.begin() + casters.GetOffset(bucketId);
+        uint32_t count = casters.GetCount(bucketId);
+        m_casters.ids.insert(m_casters.ids.end(), begin, begin + count);
+
+        uint32_t cubemapId = passId / kCubeFacesCount;
+        m_casterFaces.insert(m_casterFaces.end(), count, OpaqueInstanceData::CubemapFaceData { positions[cubemapId], passId });
+      }
+    }
+    m_casters.bucketOffsets[bucketsCount] = static_cast<uint32_t>(m_casters.ids.size());
+  }
+
+  void OpaqueGroup::UpdateInstanceBufferFaces() {
+    uint32_t castersCount = static_cast<uint32_t>(m_casterFaces.size());
+    if (castersCount == 0) {
+      return;
+    }
+
+    // Only grows, same as m_instanceBufferDepth
+    if (m_instanceCountFaces < castersCount) {
+      m_instanceCountFaces = castersCount;
+      HRESULT result = m_instanceBufferFaces.Init(m_instanceCountFaces, D3D11_CPU_ACCESS_WRITE, D3D11_USAGE_DYNAMIC);
+      assert(SUCCEEDED(result));
+    }
+
+    auto mapping = m_instanceBufferFaces.Map(D3D11_MAP_WRITE_DISCARD);
+    std::memcpy(mapping.pData, m_casterFaces.data(), castersCount * sizeof(OpaqueInstanceData::CubemapFaceData));
+    m_instanceBufferFaces.Unmap();
+  }
+
+  void OpaqueGroup::Render(const Frustum& frustum) {
+    Cull(frustum, m_visibleInstances, TaskScheduler::Get());
     UpdateInstanceBuffer();
 
     ID3D11DeviceContext* dc = DxContext::Get()->d3d11DeviceContext.Get();
@@ -153,7 +225,6 @@ namespace Flame {
     };
     dc->PSSetShaderResources(5, ARRAYSIZE(iblTextures), iblTextures);
 
-    uint32_t numRenderedInstances = 0;
     for (const auto & perModel : GetModels()) {
       const auto& model = perModel->GetModel();
 
@@ -189,9 +260,9 @@ namespace Flame {
         m_meshBuffer.ApplyChanges();
 
         for (const auto & perMaterial : perMesh->GetMaterials()) {
-          const auto& instances = perMaterial->GetInstances();
           const auto& range = model->m_ranges[meshId];
-          uint32_t numInstances = instances.size();
+          uint32_t bucketId = perMaterial->GetBucketId();
+          uint32_t numInstances = m_visibleInstances.GetCount(bucketId);
           if (numInstances == 0) {
             continue;
           }
@@ -205,8 +276,7 @@ namespace Flame {
           };
           dc->PSSetShaderResources(1, 4, srvs);
 
-          dc->DrawIndexedInstanced(range.indexNum, numInstances, range.indexOffset, range.vertexOffset, numRenderedInstances);
-          numRenderedInstances += numInstances;
+          dc->DrawIndexedInstanced(range.indexNum, numInstances, range.indexOffset, range.vertexOffset, m_visibleInstances.GetOffset(bucketId));
         }
       }
     }
@@ -215,16 +285,16 @@ namespace Flame {
     dc->PSSetShaderResources(0, ARRAYSIZE(srvs), srvs);
   }
 
-  void OpaqueGroup::RenderDepth2D() {
+  void OpaqueGroup::RenderDepth2D(const Frustum& frustum) {
     ID3D11DeviceContext* dc = DxContext::Get()->d3d11DeviceContext.Get();
 
+    Cull(frustum, m_casters, TaskScheduler::Get());
     UpdateInstanceBufferDepth();
 
     m_pipelineDepth2D.Bind();
     dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
     dc->VSSetConstantBuffers(kMeshCBufferId, 1, m_meshBuffer.GetAddressOf());
 
-    uint32_t numRenderedInstances = 0;
     for (const auto & perModel : GetModels()) {
       const auto& model = perModel->GetModel();
 
@@ -260,51 +330,61 @@ namespace Flame {
         m_meshBuffer.ApplyChanges();
 
         for (const auto & perMaterial : perMesh->GetMaterials()) {
-          const auto& instances = perMaterial->GetInstances();
           const auto& range = model->m_ranges[meshId];
-          uint32_t numInstances = instances.size();
+          uint32_t bucketId = perMaterial->GetBucketId();
+          uint32_t numInstances = m_casters.GetCount(bucketId);
           if (numInstances == 0) {
             continue;
           }
 
-          dc->DrawIndexedInstanced(range.indexNum, numInstances, range.indexOffset, range.vertexOffset, numRenderedInstances);
-          numRenderedInstances += numInstances;
+          dc->DrawIndexedInstanced(range.indexNum, numInstances, range.indexOffset, range.vertexOffset, m_casters.GetOffset(bucketId));
         }
       }
     }
   }
 
-  void OpaqueGroup::RenderDepthCubemaps(std::span<glm::vec3> positions) {
+  void OpaqueGroup::RenderDepthCubemaps(std::span<glm::vec3> positions, const glm::mat4& projection) {
     ID3D11DeviceContext* dc = DxContext::Get()->d3d11DeviceContext.Get();
 
+    // Pass per face, most instances are casters of a single face at most
+    m_faceCasters.resize(positions.size() * kCubeFacesCount);
+    for (uint32_t cubemapId = 0; cubemapId < positions.size(); ++cubemapId) {
+      for (uint32_t faceId = 0; faceId < kCubeFacesCount; ++faceId) {
+        Frustum frustum = Frustum::FromMatrix(projection * MathUtils::CubeFaceView(faceId, positions[cubemapId]));
+        Cull(frustum, m_faceCasters[cubemapId * kCubeFacesCount + faceId], TaskScheduler::Get());
+      }
+    }
+    MergeCasterFaces(positions);
     UpdateInstanceBufferDepth();
+    UpdateInstanceBufferFaces();
 
     m_pipelineDepthCubemap.Bind();
     dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
     dc->VSSetConstantBuffers(kMeshCBufferId, 1, m_meshBuffer.GetAddressOf());
-    dc->GSSetConstantBuffers(kDepthCubemapCBufferId, 1, m_cubemapDepthBuffer.GetAddressOf());
 
-    uint32_t numRenderedInstances = 0;
     for (const auto & perModel : GetModels()) {
       const auto& model = perModel->GetModel();
 
       // Set buffers
       ID3D11Buffer* buffers[] = {
         perModel->GetModel()->m_vertices.Get(),
-        m_instanceBufferDepth.Get()
+        m_instanceBufferDepth.Get(),
+        m_instanceBufferFaces.Get(),
       };
 
       UINT strides[] = {
         perModel->GetModel()->m_vertices.GetStride(),
         m_instanceBufferDepth.GetStride(),
+        m_instanceBufferFaces.GetStride(),
       };
 
       UINT offsets[] = {
         0,
         0,
+        0,
       };
 
-      dc->IASetVertexBuffers(0, 2, buffers, strides, offsets);
+      dc->IASetVertexBuffers(0, 3, buffers, strides, offsets);
       dc->IASetIndexBuffer(perModel->GetModel()->m_indices.Get(), DXGI_FORMAT_R32_UINT, 0);
 
       const auto& perMeshArray = perModel->GetMeshes();
@@ -320,22 +400,15 @@ namespace Flame {
         m_meshBuffer.ApplyChanges();
 
         for (const auto & perMaterial : perMesh->GetMaterials()) {
-          const auto& instances = perMaterial->GetInstances();
           const auto& range = model->m_ranges[meshId];
-          uint32_t numInstances = instances.size();
+          uint32_t bucketId = perMaterial->GetBucketId();
+          uint32_t numInstances = m_casters.GetCount(bucketId);
           if (numInstances == 0) {
             continue;
           }
 
-          for (uint32_t cubemapId = 0; cubemapId < positions.size(); ++cubemapId) {
-            m_cubemapDepthBuffer.data.position = positions[cubemapId];
-            m_cubemapDepthBuffer.data.cubemapIndex = cubemapId;
-            m_cubemapDepthBuffer.ApplyChanges();
-
-            dc->DrawIndexedInstanced(range.indexNum, numInstances, range.indexOffset, range.vertexOffset, numRenderedInstances);
-          }
-
-          numRenderedInstances += numInstances;
+          // Casters of every face of every cubemap at once, each one carries its face
+          dc->DrawIndexedInstanced(range.indexNum, numInstances, range.indexOffset, range.vertexOffset, m_casters.GetOffset(bucketId));
         }
       }
     }
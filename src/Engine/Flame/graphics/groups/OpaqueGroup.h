@@ -4,11 +4,11 @@
 #include <vector>
 #include <Flame/engine/IShadowMapProvider.h>
 #include <Flame/engine/ShaderPipeline.h>
-#include <Flame/graphics/buffers/data/DepthCubemapData.h>
 #include <glm/glm.hpp>
 
 #include "Flame/engine/TransformSystem.h"
 #include "Flame/graphics/buffers/ConstantBuffer.h"
+#include "InstanceStaging.h"
 #include "ShaderGroup.h"
 #include "Flame/engine/Transform.h"
 #include "Flame/engine/Model.h"
@@ -25,15 +25,22 @@ namespace Flame {
       glm::mat4 modelMatrix;
     };
 
+    /// Second instance stream of cubemap depth passes: the single face a caster is rendered into
+    struct CubemapFaceData final {
+      glm::vec3 cubemapPosition;
+      // cubemapIndex * 6 + faceIndex
+      uint32_t arrayIndex;
+    };
+
     ShaderData GetShaderData() const {
       return ShaderData {
-        TransformSystem::Get()->At(transformId)->transform.GetMat()
+        TransformSystem::Get()->GetMat(transformId)
       };
     }
 
     DepthShaderData GetDepthShaderData() const {
       return DepthShaderData {
-        TransformSystem::Get()->At(transformId)->transform.GetMat()
+        TransformSystem::Get()->GetMat(transformId)
       };
     }
 
@@ -57,9 +64,16 @@ namespace Flame {
     void Init();
     void Cleanup();
 
-    void Render();
-    void RenderDepth2D();
-    void RenderDepthCubemaps(std::span<glm::vec3> positions);
+    /// Draws the instances intersecting the view frustum
+    void Render(const Frustum& frustum);
+    /// Draws the instances intersecting the light volume, e.g. an orthographic box or a spot frustum
+    void RenderDepth2D(const Frustum& frustum);
+    /**
+     * Draws every face of every cubemap with only the instances intersecting the frustum of that face.
+     * Casters carry their face, so every material takes a single draw for all faces of all cubemaps
+     * \param projection Projection of a single face, shared by all cubemaps
+     */
+    void RenderDepthCubemaps(std::span<glm::vec3> positions, const glm::mat4& projection);
 
     void SetShadowMapProvider(const std::shared_ptr<IShadowMapProvider>& provider);
 
@@ -67,19 +81,34 @@ namespace Flame {
     void UpdateInstanceBufferData();
     void UpdateInstanceBuffer();
     void UpdateInstanceBufferDataDepth();
+    /// Uploads m_casters
     void UpdateInstanceBufferDepth();
+    /// Concatenates the casters of every face bucket by bucket into m_casters, along with the face of each one
+    void MergeCasterFaces(std::span<glm::vec3> positions);
+    void UpdateInstanceBufferFaces();
 
   private:
     ShaderPipeline m_pipeline;
     ShaderPipeline m_pipelineDepth2D;
     ShaderPipeline m_pipelineDepthCubemap;
     VertexBuffer<OpaqueInstanceData::ShaderData> m_instanceBuffer;
+    InstanceStaging<OpaqueInstanceData::ShaderData> m_instanceStaging;
     VertexBuffer<OpaqueInstanceData::DepthShaderData> m_instanceBufferDepth;
+    InstanceStaging<OpaqueInstanceData::DepthShaderData> m_instanceStagingDepth;
+    VertexBuffer<OpaqueInstanceData::CubemapFaceData> m_instanceBufferFaces;
     uint32_t m_instanceCount = 0;
     uint32_t m_instanceCountDepth = 0;
+    uint32_t m_instanceCountFaces = 0;
+    // Main pass draws only these, m_instanceBuffer holds them compacted
+    InstanceList m_visibleInstances;
+    std::vector<uint32_t> m_uploadedVisibleIds;
+    // Shadow casters of the current depth pass, m_instanceBufferDepth holds them compacted. For cubemaps
+    // these are the casters of every face merged, so ids of a bucket aren't sorted and may repeat
+    InstanceList m_casters;
+    // Casters of every cubemap face, and the face of every one of m_casters
+    std::vector<InstanceList> m_faceCasters;
+    std::vector<OpaqueInstanceData::CubemapFaceData> m_casterFaces;
     ConstantBuffer<OpaqueMeshData> m_meshBuffer;
-    // TODO make some global structure to use in different groups
-    ConstantBuffer<DepthCubemapData> m_cubemapDepthBuffer;
 
     // IBL
     ID3D11ShaderResourceView* m_diffuseView = nullptr;
@@ -93,5 +122,7 @@ namespace Flame {
     inline static const wchar_t* kDepth2DShaderPath = L"Assets/Shaders/Depth2D.hlsl";
     inline static const wchar_t* kDepthCubemapShaderPath = L"Assets/Shaders/DepthCubemap.hlsl";
     inline static const wchar_t* kFlashlightTexturePath = L"Assets/Textures/flashlight_1.dds";
+
+    static constexpr uint32_t kCubeFacesCount = 6;
   };
 }
@@ -1,13 +1,47 @@
 #pragma once
 
+#include "Flame/engine/FrustumCuller.h"
 #include "Flame/engine/Model.h"
 #include "Flame/engine/TransformSystem.h"
+#include "Flame/math/Frustum.h"
 #include "Flame/utils/SolidVector.h"
+#include "Flame/utils/TaskScheduler.h"
 
+#include <algorithm>
+#include <cassert>
+#include <iterator>
 #include <memory>
 #include <span>
+#include <vector>
 
 namespace Flame {
+  /// Subset of the instances of a group, e.g. the visible ones: indices into GetInstances(), grouped by material bucket
+  struct InstanceList final {
+    /// \return Position of the first instance of the bucket in ids
+    uint32_t GetOffset(uint32_t bucketId) const {
+      return bucketOffsets[bucketId];
+    }
+
+    uint32_t GetCount(uint32_t bucketId) const {
+      return bucketOffsets[bucketId + 1] - bucketOffsets[bucketId];
+    }
+
+  public:
+    // In increasing order, so every bucket takes a contiguous range
+    std::vector<uint32_t> ids;
+    std::vector<uint32_t> bucketOffsets;
+  };
+
+  /**
+   * Instances grouped by model, mesh and material. The hierarchy itself only holds models, meshes and materials,
+   * instances of the whole group live in a single array: every material owns a contiguous bucket of it,
+   * found through an offset table. So per-frame passes over instances are linear scans, and the array order
+   * is the instance buffer order, with GetInstanceOffset() of a material as the first instance of its draw.
+   * Adding and removing instances only queues the change, the array is rebuilt once on the next read,
+   * so a frame of any number of changes costs a single pass over it.
+   * Instances move whenever instances are added or removed, so they are referred to by material and instance ID,
+   * see PerMaterial::GetInstance()
+   */
   template <typename InstanceDataType, typename MaterialDataType>
   struct ShaderGroup {
 
@@ -33,10 +67,15 @@ namespace Flame {
     // PerMaterial
 
     struct PerMaterial final {
-      PerMaterial(MaterialDataType data)
-      : m_data(std::move(data)) {
+      PerMaterial(ShaderGroup* group, MaterialDataType data)
+      : m_group(group)
+      , m_bucketId(group->AddBucket())
+      , m_data(std::move(data)) {
       }
 
+      PerMaterial(const PerMaterial&) = delete;
+      PerMaterial& operator=(const PerMaterial&) = delete;
+
       MaterialDataType& GetData() {
         return m_data;
       }
@@ -45,27 +84,81 @@ namespace Flame {
         return m_data;
       }
 
-      SolidVector<std::shared_ptr<PerInstance>>& GetInstances() {
-        return m_instances;
+      /// Instances of this material, in no particular order
+      std::span<PerInstance> GetInstances() const {
+        return m_group->GetBucket(m_bucketId);
+      }
+
+      /// \return Index of the first instance in the group-wide array
+      uint32_t GetInstanceOffset() const {
+        m_group->CommitInstances();
+        return m_group->m_bucketOffsets[m_bucketId];
+      }
+
+      /// \return Bucket of the instances of this material, see InstanceList
+      uint32_t GetBucketId() const {
+        return m_bucketId;
       }
 
-      const SolidVector<std::shared_ptr<PerInstance>>& GetInstances() const {
-        return m_instances;
+      /// \return Instance by the ID from AddInstance(), looked up anew on every call since instances move
+      PerInstance& GetInstance(uint32_t id) const {
+        return GetInstances()[m_instanceIds.index(id)];
       }
 
+      /// \return ID of the instance at the position in GetInstances()
+      uint32_t GetInstanceId(uint32_t index) const {
+        return m_instanceIds.at(index);
+      }
+
+      /// \return ID that stays valid until the instance is removed
       uint32_t AddInstance(InstanceDataType data) {
-        return m_instances.emplace(std::make_shared<PerInstance>(std::move(data)));
+        uint32_t id = InsertInstanceId();
+        m_group->InsertInstances(m_bucketId, std::span<InstanceDataType>(&data, 1));
+        return id;
+      }
+
+      void AddInstances(std::span<InstanceDataType> dataSpan) {
+        for (size_t i = 0; i < dataSpan.size(); ++i) {
+          InsertInstanceId();
+        }
+        m_group->InsertInstances(m_bucketId, dataSpan);
+      }
+
+      /// Moves the last instance of the material into place of the removed one
+      void RemoveInstance(uint32_t id) {
+        // SolidVector does the same swap with the last element, so its index stays the position in the bucket
+        uint32_t index = m_instanceIds.index(id);
+        m_instanceIds.erase(id);
+        m_group->EraseInstance(m_bucketId, index);
+      }
+
+      void RemoveInstances() {
+        m_instanceIds.clear();
+        m_group->ClearBucket(m_bucketId);
+      }
+
+    private:
+      /// Every element holds its own ID, so that the ID of a position can be looked up
+      uint32_t InsertInstanceId() {
+        uint32_t id = m_instanceIds.insert(0);
+        m_instanceIds[id] = id;
+        return id;
       }
 
     private:
+      ShaderGroup* m_group;
+      uint32_t m_bucketId;
       MaterialDataType m_data;
-      SolidVector<std::shared_ptr<PerInstance>> m_instances;
+      // Positions in it match positions in the bucket
+      SolidVector<uint32_t> m_instanceIds;
     };
 
     // PerMesh
 
     struct PerMesh final {
-      PerMesh() = default;
+      PerMesh(ShaderGroup* group)
+      : m_group(group) {
+      }
 
       SolidVector<std::shared_ptr<PerMaterial>>& GetMaterials() {
         return m_materials;
@@ -76,20 +169,28 @@ namespace Flame {
       }
 
       uint32_t AddMaterial(MaterialDataType data) {
-        return m_materials.emplace(std::make_shared<PerMaterial>(std::move(data)));
+        return m_materials.emplace(std::make_shared<PerMaterial>(m_group, std::move(data)));
+      }
+
+      /// Removes the material along with its instances, its bucket goes to the next added material
+      void RemoveMaterial(uint32_t id) {
+        m_materials[id]->RemoveInstances();
+        m_group->FreeBucket(m_materials[id]->GetBucketId());
+        m_materials.erase(id);
       }
 
     private:
+      ShaderGroup* m_group;
       SolidVector<std::shared_ptr<PerMaterial>> m_materials;
     };
 
     // PerModel
 
     struct PerModel final {
-      PerModel(std::shared_ptr<Model> model)
+      PerModel(ShaderGroup* group, std::shared_ptr<Model> model)
       : m_model(std::move(model)) {
         for (uint32_t i = 0; i < m_model->m_meshes.size(); ++i) {
-          m_meshes.emplace(std::make_shared<PerMesh>());
+          m_meshes.emplace(std::make_shared<PerMesh>(group));
         }
       }
 
@@ -122,8 +223,13 @@ namespace Flame {
 
     // ShaderGroup
 
+    ShaderGroup() = default;
     virtual ~ShaderGroup() = default;
 
+    // Per-level objects point back to the group
+    ShaderGroup(const ShaderGroup&) = delete;
+    ShaderGroup& operator=(const ShaderGroup&) = delete;
+
     SolidVector<std::shared_ptr<PerModel>>& GetModels() {
       return m_models;
     }
@@ -132,21 +238,125 @@ namespace Flame {
       return m_models;
     }
 
-    size_t GetInstanceCount() const {
-      size_t numInstances = 0;
-      for (const auto& perModel : GetModels()) {
-        for (const auto& perMesh : perModel->GetMeshes()) {
-          for (const auto& perMaterial : perMesh->GetMaterials()) {
-            numInstances += perMaterial->GetInstances().size();
+    /// All instances of the group, bucket after bucket
+    std::span<const PerInstance> GetInstances() {
+      CommitInstances();
+      return m_instances;
+    }
+
+    size_t GetInstanceCount() {
+      CommitInstances();
+      return m_instances.size();
+    }
+
+    /// \return Counter that changes whenever instances are added, removed or marked as changed
+    uint32_t GetInstancesVersion() const {
+      return m_instancesVersion;
+    }
+
+    /// Transforms are tracked by TransformSystem, but other instance data edited in place has to be reported
+    void MarkInstancesChanged() {
+      ++m_instancesVersion;
+    }
+
+    uint32_t GetBucketsCount() const {
+      return static_cast<uint32_t>(m_bucketOffsets.size() - 1);
+    }
+
+    /**
+     * \return World space bounds of GetInstances(). Everything is recomputed only if instances changed
+     * since the last call, otherwise only the bounds of instances whose transform changed or whose mesh box changed
+     */
+    std::span<const Aabb> UpdateInstanceBoxes(TaskScheduler* scheduler = nullptr) {
+      CommitInstances();
+
+      const TransformSystem* transformSystem = TransformSystem::Get();
+      uint32_t updateId = transformSystem->GetUpdateId();
+      bool isIncremental = m_hasInstanceBoxes && m_boxesInstancesVersion == m_instancesVersion;
+
+      if (!isIncremental) {
+        // Mesh of every bucket, so that instances can be processed in flat chunks. Buckets only get
+        // another mesh while empty, so the list stays right until instances change
+        m_bucketMeshes.assign(GetBucketsCount(), nullptr);
+        for (const auto& perModel : GetModels()) {
+          const auto& model = perModel->GetModel();
+          for (uint32_t meshId = 0; meshId < perModel->GetMeshes().size(); ++meshId) {
+            for (const auto& perMaterial : perModel->GetMeshes()[meshId]->GetMaterials()) {
+              m_bucketMeshes[perMaterial->GetBucketId()] = &model->m_meshes[meshId];
+            }
+          }
+        }
+        m_bucketBoxVersions.assign(GetBucketsCount(), 0);
+      }
+
+      // Refitted meshes make their whole buckets stale
+      bool hasStaleBuckets = false;
+      for (uint32_t bucketId = 0; bucketId < m_bucketMeshes.size(); ++bucketId) {
+        hasStaleBuckets |= m_bucketMeshes[bucketId] != nullptr && m_bucketMeshes[bucketId]->boxVersion != m_bucketBoxVersions[bucketId];
+      }
+
+      if (isIncremental && m_boxesUpdateId == updateId && !hasStaleBuckets) {
+        return m_instanceBoxes;
+      }
+
+      m_instanceBoxes.resize(m_instances.size());
+      if (!isIncremental) {
+        // Only sizes the culler, every box is set by the task below
+        m_culler.SetBoxes(m_instanceBoxes, scheduler);
+      }
+
+      auto task = [this, transformSystem, isIncremental](uint32_t begin, uint32_t end) {
+        uint32_t bucketId = static_cast<uint32_t>(std::upper_bound(m_bucketOffsets.begin(), m_bucketOffsets.end(), begin) - m_bucketOffsets.begin() - 1);
+        for (uint32_t i = begin; i < end; ++i) {
+          while (i >= m_bucketOffsets[bucketId + 1]) {
+            ++bucketId;
           }
+
+          const Mesh* mesh = m_bucketMeshes[bucketId];
+          uint32_t transformId = m_instances[i].GetData().transformId;
+          if (isIncremental && mesh->boxVersion == m_bucketBoxVersions[bucketId]
+            && transformSystem->GetChangeId(transformId) <= m_boxesUpdateId) {
+            continue;
+          }
+
+          m_instanceBoxes[i] = mesh->box.Transformed(mesh->GetMeshToWorld(transformSystem->GetMat(transformId)));
+          m_culler.SetBox(i, m_instanceBoxes[i]);
+        }
+      };
+
+      uint32_t instancesCount = static_cast<uint32_t>(m_instances.size());
+      if (scheduler == nullptr) {
+        task(0, instancesCount);
+      } else {
+        scheduler->ParallelFor(0, instancesCount, kParallelChunkSize, task);
+      }
+
+      for (uint32_t bucketId = 0; bucketId < m_bucketMeshes.size(); ++bucketId) {
+        if (m_bucketMeshes[bucketId] != nullptr) {
+          m_bucketBoxVersions[bucketId] = m_bucketMeshes[bucketId]->boxVersion;
         }
       }
 
-      return numInstances;
+      m_hasInstanceBoxes = true;
+      m_boxesInstancesVersion = m_instancesVersion;
+      m_boxesUpdateId = updateId;
+      return m_instanceBoxes;
+    }
+
+    /// Fills the list with instances whose world bounds intersect the frustum, see FrustumCuller
+    void Cull(const Frustum& frustum, InstanceList& list, TaskScheduler* scheduler = nullptr) {
+      UpdateInstanceBoxes(scheduler);
+      m_culler.Cull(frustum, list.ids, scheduler);
+
+      // Buckets are contiguous and ids are sorted, so the first id of a bucket is found by its first instance
+      list.bucketOffsets.resize(m_bucketOffsets.size());
+      for (uint32_t bucketId = 0; bucketId < m_bucketOffsets.size(); ++bucketId) {
+        list.bucketOffsets[bucketId] = static_cast<uint32_t>(std::lower_bound(list.ids.begin(), list.ids.end(), m_bucketOffsets[bucketId]) - list.ids.begin());
+      }
     }
 
     uint32_t AddModel(std::shared_ptr<Model> model) {
-      return m_models.emplace(std::make_shared<PerModel>(std::move(model)));
+      return m_models.emplace(std::make_shared<PerModel>(this, std::move(model)));
     }
 
     void AddInstance(std::shared_ptr<Model> model, MaterialDataType mData, InstanceDataType iData) {
@@ -167,9 +377,7 @@ namespace Flame {
       for (auto& perMesh : perModel->GetMeshes()) {
         uint32_t materialId = perMesh->AddMaterial(mData);
         auto& perMaterial = perMesh->GetMaterials()[materialId];
-        for (auto& iData : iDataSpan) {
-          perMaterial->AddInstance(iData);
-        }
+        perMaterial->AddInstances(iDataSpan);
       }
     }
 
@@ -177,56 +385,138 @@ namespace Flame {
       return m_models[id];
     }
 
-    bool HitInstance(const Ray& ray, HitRecord<PerInstance*>& record, float tMin, float tMax) const {
-      HitRecord<const Mesh*> record0;
-
-      // Go through all instances and find the closest one
-      for (const auto& perModel : GetModels()) {
-        const auto& model = perModel->GetModel();
-
-        for (uint32_t meshId = 0; meshId < perModel->GetMeshes().size(); ++meshId) {
-          const auto& perMesh = perModel->GetMeshes()[meshId];
-
-          for (const auto& perMaterial : perMesh->GetMaterials()) {
-            for (const auto& perInstance : perMaterial->GetInstances()) {
-              // Transform ray
-              glm::mat4 modelMat = TransformSystem::Get()->At(perInstance->GetData().transformId)->transform.GetMat();
-              glm::mat4 modelMatInv = glm::inverse(modelMat);
-
-              // Transform meshToModel
-              // TODO: Ok, there may be zero. If we can have more than 1 then we should multiply them all
-              // TODO: Another fix: add identity if zero after parsing.
-              assert(model->m_meshes[meshId].transforms.size() <= 1);
-              assert(model->m_meshes[meshId].transformsInv.size() <= 1);
-              if (model->m_meshes[meshId].transforms.size() != 0) {
-                modelMat *= model->m_meshes[meshId].transforms[0];
-                modelMatInv = model->m_meshes[meshId].transformsInv[0] * modelMatInv;
-              }
-
-
-              glm::vec4 position = modelMatInv * glm::vec4(ray.origin, 1.0f);
-              glm::vec3 direction = modelMatInv * glm::vec4(ray.direction, 0.0f);
-              Ray rayModel { position / position.w, direction };
-
-              // Hit model in model space
-              if (model->m_meshes[meshId].Hit(rayModel, record0, tMin, tMax)) {
-                // If hit - update tMax and InvTransform the results
-                tMax = record0.time;
-                position = modelMat * glm::vec4(record0.point, 1.0f);
-                record.time = tMax;
-                record.point = position / position.w;
-                record.normal = glm::normalize(modelMat * glm::vec4(record0.normal, 0.0f));
-                record.data = perInstance.get();
-              }
-            }
-          }
-        }
+    /// Removes all models along with their instances
+    void Clear() {
+      m_models.clear();
+      m_instances.clear();
+      m_bucketOffsets.assign(1, 0);
+      m_bucketSizes.clear();
+      m_pendingInstances.clear();
+      m_freeBucketIds.clear();
+      m_hasPendingInstances = false;
+      ++m_instancesVersion;
+    }
+
+  private:
+    /// Reuses an empty bucket of a removed material if there is one
+    uint32_t AddBucket() {
+      if (!m_freeBucketIds.empty()) {
+        uint32_t bucketId = m_freeBucketIds.back();
+        m_freeBucketIds.pop_back();
+        return bucketId;
+      }
+
+      m_bucketOffsets.emplace_back(m_bucketOffsets.back());
+      m_bucketSizes.emplace_back(0);
+      m_pendingInstances.emplace_back();
+      return static_cast<uint32_t>(m_bucketOffsets.size() - 2);
+    }
+
+    /// The bucket has to be empty already
+    void FreeBucket(uint32_t bucketId) {
+      assert(m_bucketSizes[bucketId] == 0 && m_pendingInstances[bucketId].empty());
+      m_freeBucketIds.emplace_back(bucketId);
+    }
+
+    std::span<PerInstance> GetBucket(uint32_t bucketId) {
+      CommitInstances();
+      return std::span<PerInstance>(m_instances).subspan(m_bucketOffsets[bucketId], m_bucketSizes[bucketId]);
+    }
+
+    /// Instance at the position in the bucket, counting the queued ones after the ones in the array
+    PerInstance& GetBucketInstance(uint32_t bucketId, uint32_t index) {
+      if (index < m_bucketSizes[bucketId]) {
+        return m_instances[m_bucketOffsets[bucketId] + index];
       }
+      return m_pendingInstances[bucketId][index - m_bucketSizes[bucketId]];
+    }
+
+    /// Queues the instances to the end of the bucket
+    void InsertInstances(uint32_t bucketId, std::span<InstanceDataType> dataSpan) {
+      m_pendingInstances[bucketId].insert(m_pendingInstances[bucketId].end(), dataSpan.begin(), dataSpan.end());
+      m_hasPendingInstances = true;
+      ++m_instancesVersion;
+    }
 
-      return record.data != nullptr;
+    /// Moves the last instance of the bucket into place of the removed one, leaving a gap in the array until the next commit
+    void EraseInstance(uint32_t bucketId, uint32_t index) {
+      std::vector<PerInstance>& pending = m_pendingInstances[bucketId];
+      uint32_t lastIndex = m_bucketSizes[bucketId] + static_cast<uint32_t>(pending.size()) - 1;
+      if (index != lastIndex) {
+        GetBucketInstance(bucketId, index) = std::move(GetBucketInstance(bucketId, lastIndex));
+      }
+
+      if (pending.empty()) {
+        --m_bucketSizes[bucketId];
+      } else {
+        pending.pop_back();
+      }
+      m_hasPendingInstances = true;
+      ++m_instancesVersion;
+    }
+
+    void ClearBucket(uint32_t bucketId) {
+      m_bucketSizes[bucketId] = 0;
+      m_pendingInstances[bucketId].clear();
+      m_hasPendingInstances = true;
+      ++m_instancesVersion;
+    }
+
+    /// Rebuilds the array with the queued changes, closing the gaps of removed instances
+    void CommitInstances() {
+      if (!m_hasPendingInstances) {
+        return;
+      }
+
+      size_t instancesCount = 0;
+      for (uint32_t bucketId = 0; bucketId < m_bucketSizes.size(); ++bucketId) {
+        instancesCount += m_bucketSizes[bucketId] + m_pendingInstances[bucketId].size();
+      }
+
+      std::vector<PerInstance> instances;
+      instances.reserve(instancesCount);
+      for (uint32_t bucketId = 0; bucketId < m_bucketSizes.size(); ++bucketId) {
+        auto begin = m_instances.begin() + m_bucketOffsets[bucketId];
+        std::vector<PerInstance>& pending = m_pendingInstances[bucketId];
+
+        m_bucketOffsets[bucketId] = static_cast<uint32_t>(instances.size());
+        instances.insert(instances.end(), std::make_move_iterator(begin), std::make_move_iterator(begin + m_bucketSizes[bucketId]));
+        instances.insert(instances.end(), std::make_move_iterator(pending.begin()), std::make_move_iterator(pending.end()));
+        m_bucketSizes[bucketId] = static_cast<uint32_t>(instances.size()) - m_bucketOffsets[bucketId];
+        pending.clear();
+      }
+      m_bucketOffsets.back() = static_cast<uint32_t>(instances.size());
+
+      m_instances = std::move(instances);
+      m_hasPendingInstances = false;
     }
 
   private:
+    std::vector<PerInstance> m_instances;
+    // Bucket b takes [m_bucketOffsets[b]; m_bucketOffsets[b + 1]) of m_instances, of which the first m_bucketSizes[b]
+    // are live: removals leave gaps at the end of buckets until the next commit
+    std::vector<uint32_t> m_bucketOffsets = { 0 };
+    std::vector<uint32_t> m_bucketSizes;
+    // Instances added to every bucket since the last commit
+    std::vector<std::vector<PerInstance>> m_pendingInstances;
+    bool m_hasPendingInstances = false;
+    // Empty buckets of removed materials, so that adding and removing materials doesn't grow every per-bucket pass
+    std::vector<uint32_t> m_freeBucketIds;
+    uint32_t m_instancesVersion = 0;
     SolidVector<std::shared_ptr<PerModel>> m_models;
+
+    // Culling state, see UpdateInstanceBoxes()
+    std::vector<Aabb> m_instanceBoxes;
+    std::vector<const Mesh*> m_bucketMeshes;
+    // Mesh::boxVersion of every bucket as of the last bounds update
+    std::vector<uint32_t> m_bucketBoxVersions;
+    FrustumCuller m_culler;
+    bool m_hasInstanceBoxes = false;
+    uint32_t m_boxesInstancesVersion = 0;
+    uint32_t m_boxesUpdateId = 0;
+
+  public:
+    // Instances per parallel task
+    static constexpr uint32_t kParallelChunkSize = 1 << 12;
   };
 }
@@ -22,29 +22,30 @@ namespace Flame {
     m_pipeline.Reset();
     m_instanceBuffer.Reset();
     m_instanceCount = 0;
-    GetModels().clear();
+    m_instanceStaging.Reset();
+    Clear();
   }
 
   void TextureOnlyGroup::UpdateInstanceBufferData() {
     auto mapping = m_instanceBuffer.Map(D3D11_MAP_WRITE_DISCARD);
-    auto destPtr = static_cast<TextureOnlyInstanceData::ShaderData*>(mapping.pData);
-    uint32_t numCopied = 0;
-
-    for (const auto& perModel : GetModels()) {
-      for (const auto & perMesh : perModel->GetMeshes()) {
-        for (const auto & perMaterial : perMesh->GetMaterials()) {
-          for (const auto & perInstance : perMaterial->GetInstances()) {
-            destPtr[numCopied++] = perInstance->GetData().GetShaderData();
-          }
-        }
-      }
-    }
-
+    m_instanceStaging.CopyTo(mapping.pData, TaskScheduler::Get());
     m_instanceBuffer.Unmap();
   }
 
   void TextureOnlyGroup::UpdateInstanceBuffer() {
-    uint32_t instanceCount = GetInstanceCount();
+    auto instances = GetInstances();
+    uint32_t instanceCount = static_cast<uint32_t>(instances.size());
+    bool isChanged = m_instanceStaging.Update(instanceCount, GetInstancesVersion(), [&](uint32_t i) {
+      return instances[i].GetData().transformId;
+    }, [&](uint32_t i) {
+      return instances[i].GetData().GetShaderData();
+    }, TaskScheduler::Get());
+
+    // Nothing moved since the last upload, the buffer is still valid
+    if (!isChanged) {
+      return;
+    }
+
     if (m_instanceCount != instanceCount) {
       m_instanceCount = instanceCount;
       HRESULT result = m_instanceBuffer.Init(m_instanceCount, D3D11_CPU_ACCESS_WRITE, D3D11_USAGE_DYNAMIC);
@@ -62,7 +63,6 @@ namespace Flame {
     m_pipeline.Bind();
     dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-    uint32_t numRenderedInstances = 0;
     for (const auto & perModel : GetModels()) {
       const auto& model = perModel->GetModel();
 
@@ -92,7 +92,7 @@ namespace Flame {
         for (const auto & perMaterial : perMesh->GetMaterials()) {
           const auto& instances = perMaterial->GetInstances();
           const auto& range = model->m_ranges[meshId];
-          uint32_t numInstances = instances.size();
+          uint32_t numInstances = static_cast<uint32_t>(instances.size());
           if (numInstances == 0) {
             continue;
           }
@@ -100,8 +100,7 @@ namespace Flame {
           // Set texture
           dc->PSSetShaderResources(0, 1, &perMaterial->GetData().textureView);
 
-          dc->DrawIndexedInstanced(range.indexNum, numInstances, range.indexOffset, range.vertexOffset, numRenderedInstances);
-          numRenderedInstances += numInstances;
+          dc->DrawIndexedInstanced(range.indexNum, numInstances, range.indexOffset, range.vertexOffset, perMaterial->GetInstanceOffset());
         }
       }
     }
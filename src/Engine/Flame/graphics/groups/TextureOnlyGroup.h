@@ -2,6 +2,7 @@
 
 #include "Flame/engine/TransformSystem.h"
 #include "Flame/engine/Transform.h"
+#include "Flame/graphics/groups/InstanceStaging.h"
 #include "Flame/graphics/groups/ShaderGroup.h"
 #include "Flame/graphics/shaders/PixelShader.h"
 #include "Flame/graphics/shaders/VertexShader.h"
@@ -16,7 +17,7 @@ namespace Flame {
 
     ShaderData GetShaderData() const {
       ShaderData data;
-      data.modelMatrix = TransformSystem::Get()->At(transformId)->transform.GetMat();
+      data.modelMatrix = TransformSystem::Get()->GetMat(transformId);
       return data;
     }
 
@@ -41,6 +42,7 @@ namespace Flame {
   private:
     ShaderPipeline m_pipeline;
     VertexBuffer<TextureOnlyInstanceData::ShaderData> m_instanceBuffer;
+    InstanceStaging<TextureOnlyInstanceData::ShaderData> m_instanceStaging;
     uint32_t m_instanceCount = 0;
 
     inline static const wchar_t* kShaderPath = L"Assets/Shaders/texture_only.hlsl";
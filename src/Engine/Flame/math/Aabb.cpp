@@ -35,6 +35,15 @@ namespace Flame {
     }
   }
 
+  void Aabb::Union(const glm::vec3& point) {
+    m_min = glm::min(m_min, point);
+    m_max = glm::max(m_max, point);
+  }
+
+  Aabb Aabb::Intersection(const Aabb& other) const {
+    return Aabb(glm::max(m_min, other.m_min), glm::min(m_max, other.m_max));
+  }
+
   void Aabb::Expand(const glm::vec3& size) {
     m_min -= size;
     m_max += size;
@@ -56,6 +65,32 @@ namespace Flame {
     return m_max - m_min;
   }
 
+  float Aabb::SurfaceArea() const {
+    glm::vec3 size = Size();
+    if (size.x < 0.0f || size.y < 0.0f || size.z < 0.0f) {
+      // Empty box
+      return 0.0f;
+    }
+
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+  }
+
+  Aabb Aabb::Transformed(const glm::mat4& mat) const {
+    // Arvo's method: project every axis of the matrix instead of transforming 8 corners
+    glm::vec3 min = glm::vec3(mat[3]);
+    glm::vec3 max = min;
+    for (int column = 0; column < 3; ++column) {
+      for (int row = 0; row < 3; ++row) {
+        float a = mat[column][row] * m_min[column];
+        float b = mat[column][row] * m_max[column];
+        min[row] += glm::min(a, b);
+        max[row] += glm::max(a, b);
+      }
+    }
+
+    return Aabb(min, max);
+  }
+
   uint32_t Aabb::GetBiggestSideIndex() const {
     glm::vec3 size = Size();
 
@@ -18,17 +18,39 @@ namespace Flame {
 
     bool Hit(const Ray& r, HitRecord<const Aabb*>& record, float tMin, float tMax) const;
 
+    /**
+     * Slab test for traversal loops, where the inverse direction is computed once per ray
+     * \param entryTime Time at which the ray enters the box (clamped to tMin)
+     */
+    bool Hit(const glm::vec3& origin, const glm::vec3& invDirection, float tMin, float tMax, float& entryTime) const {
+      for (int d = 0; d < 3; ++d) {
+        float t1 = (m_min[d] - origin[d]) * invDirection[d];
+        float t2 = (m_max[d] - origin[d]) * invDirection[d];
+        tMin = glm::max(glm::min(t1, t2), tMin);
+        tMax = glm::min(glm::max(t1, t2), tMax);
+      }
+
+      entryTime = tMin;
+      return tMin <= tMax;
+    }
+
     bool Intersects(const Aabb& other) const;
 
     void SetMin(const glm::vec3& min);
     void SetMax(const glm::vec3& max);
     void Union(const Aabb& other);
+    void Union(const glm::vec3& point);
+    /// \return Overlap of both boxes, inverted (with zero surface area) if they don't overlap
+    Aabb Intersection(const Aabb& other) const;
     void Expand(const glm::vec3& size);
 
     const glm::vec3& Min() const;
     const glm::vec3& Max() const;
     glm::vec3 Centroid() const;
     glm::vec3 Size() const;
+    float SurfaceArea() const;
+    /// \return Box enclosing this one after the affine transform
+    Aabb Transformed(const glm::mat4& mat) const;
     uint32_t GetBiggestSideIndex() const;
 
     template <typename It>
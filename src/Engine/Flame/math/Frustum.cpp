@@ -0,0 +1,70 @@
+#include "Frustum.h"
+
+namespace Flame {
+  namespace {
+    glm::vec4 Normalized(const glm::vec4& plane) {
+      return plane / glm::length(glm::vec3(plane));
+    }
+
+    /// Plane through 3 points, facing the inner point
+    glm::vec4 PlaneThrough(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& inner) {
+      glm::vec3 normal = glm::normalize(glm::cross(b - a, c - a));
+      glm::vec4 plane(normal, -glm::dot(normal, a));
+      return glm::dot(normal, inner) + plane.w >= 0.0f ? plane : -plane;
+    }
+  }
+
+  Frustum Frustum::FromMatrix(const glm::mat4& viewProjection) {
+    // Gribb-Hartmann: -w <= x <= w, -w <= y <= w, 0 <= z <= w in clip space
+    glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+    glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+    glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+    glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+    Frustum frustum;
+    frustum.planes[kLeft] = Normalized(row3 + row0);
+    frustum.planes[kRight] = Normalized(row3 - row0);
+    frustum.planes[kBottom] = Normalized(row3 + row1);
+    frustum.planes[kTop] = Normalized(row3 - row1);
+    frustum.planes[kNear] = Normalized(row2);
+    frustum.planes[kFar] = Normalized(row3 - row2);
+    return frustum;
+  }
+
+  Frustum Frustum::FromCorners(std::span<const glm::vec4, 8> corners) {
+    std::array<glm::vec3, 8> points;
+    glm::vec3 center(0.0f);
+    for (uint32_t i = 0; i < 8; ++i) {
+      points[i] = glm::vec3(corners[i]);
+      center += points[i];
+    }
+    center /= 8.0f;
+
+    // Which end is near doesn't matter, planes are oriented towards the center either way
+    Frustum frustum;
+    frustum.planes[kLeft] = PlaneThrough(points[0], points[3], points[7], center);
+    frustum.planes[kRight] = PlaneThrough(points[1], points[2], points[6], center);
+    frustum.planes[kBottom] = PlaneThrough(points[3], points[2], points[6], center);
+    frustum.planes[kTop] = PlaneThrough(points[0], points[1], points[5], center);
+    frustum.planes[kNear] = PlaneThrough(points[4], points[5], points[6], center);
+    frustum.planes[kFar] = PlaneThrough(points[0], points[1], points[2], center);
+    return frustum;
+  }
+
+  bool Frustum::Intersects(const Aabb& box) const {
+    glm::vec3 center = box.Centroid();
+    glm::vec3 extent = box.Max() - center;
+    for (const glm::vec4& plane : planes) {
+      // Signed distance of the box corner farthest along the normal.
+      // Same order of operations as FrustumCuller, so both agree on boxes touching a plane
+      float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z
+        + glm::abs(plane.x) * extent.x + glm::abs(plane.y) * extent.y + glm::abs(plane.z) * extent.z
+        + plane.w;
+      if (!(distance >= 0.0f)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include <glm/glm.hpp>
+
+#include "Aabb.h"
+
+namespace Flame {
+  /**
+   * Convex volume bounded by 6 planes. Every plane is (normal, distance) with the normal pointing inside and
+   * normalized, so a point is inside when dot(normal, point) + distance >= 0 for all of them
+   */
+  struct Frustum final {
+    enum PlaneId : uint32_t {
+      kLeft,
+      kRight,
+      kBottom,
+      kTop,
+      kNear,
+      kFar,
+      kPlanesCount
+    };
+
+    /// Planes of the clip volume of a view-projection matrix, with D3D depth range [0; 1]
+    static Frustum FromMatrix(const glm::mat4& viewProjection);
+    /**
+     * Planes through the corners in the order of AlignedCamera::GetFrustumCornersWS():
+     * top left, top right, bottom right, bottom left of one end, then the same of the other end
+     */
+    static Frustum FromCorners(std::span<const glm::vec4, 8> corners);
+
+    /// Conservative test: boxes outside near the edges of the frustum may be reported as intersecting
+    bool Intersects(const Aabb& box) const;
+
+  public:
+    std::array<glm::vec4, kPlanesCount> planes;
+  };
+}
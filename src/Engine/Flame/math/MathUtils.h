@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cassert>
+
 #include "Ray.h"
 #include "glm/exponential.hpp"
 
@@ -41,6 +43,37 @@ namespace Flame {
       return irradiance / SolidAngle(radius, distance);
     }
 
+    /// \param unit Point inside [0; 1]^3
+    /// \return 30-bit Morton code, 10 bits per axis interleaved as ...zyxzyx
+    static uint32_t MortonCode30(const glm::vec3& unit) {
+      auto expand = [](float value) {
+        uint32_t x = static_cast<uint32_t>(glm::clamp(value * 1024.0f, 0.0f, 1023.0f));
+        x = (x | x << 16) & 0x030000FF;
+        x = (x | x << 8) & 0x0300F00F;
+        x = (x | x << 4) & 0x030C30C3;
+        x = (x | x << 2) & 0x09249249;
+        return x;
+      };
+
+      return expand(unit.x) | expand(unit.y) << 1 | expand(unit.z) << 2;
+    }
+
+    /// \param unit Point inside [0; 1]^3
+    /// \return 63-bit Morton code, 21 bits per axis
+    static uint64_t MortonCode63(const glm::vec3& unit) {
+      auto expand = [](float value) {
+        uint64_t x = static_cast<uint64_t>(glm::clamp(value * 2097152.0f, 0.0f, 2097151.0f));
+        x = (x | x << 32) & 0x001F00000000FFFF;
+        x = (x | x << 16) & 0x001F0000FF0000FF;
+        x = (x | x << 8) & 0x100F00F00F00F00F;
+        x = (x | x << 4) & 0x10C30C30C30C30C3;
+        x = (x | x << 2) & 0x1249249249249249;
+        return x;
+      };
+
+      return expand(unit.x) | expand(unit.y) << 1 | expand(unit.z) << 2;
+    }
+
     static glm::vec3 HsvToRgb(const glm::vec3& hsv) {
       int i = int(std::floor(hsv.x * 6));
       float f = hsv.x * 6 - i;
@@ -92,6 +125,30 @@ namespace Flame {
       );
     }
 
+    /// Same as GetViewMatrix(faceId, position) of CubemapUtils.hlsli, faces are in +X -X +Y -Y +Z -Z order
+    static glm::mat4 CubeFaceView(uint32_t faceId, glm::vec3 position) {
+      static const glm::vec3 kFronts[] = {
+        { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+      };
+      static const glm::vec3 kUps[] = {
+        { 0, 1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 }, { 0, 1, 0 }, { 0, 1, 0 }
+      };
+      static const glm::vec3 kRights[] = {
+        { 0, 0, -1 }, { 0, 0, 1 }, { 1, 0, 0 }, { 1, 0, 0 }, { 1, 0, 0 }, { -1, 0, 0 }
+      };
+
+      assert(faceId < 6);
+      const glm::vec3& front = kFronts[faceId];
+      const glm::vec3& up = kUps[faceId];
+      const glm::vec3& right = kRights[faceId];
+      return glm::mat4(
+        right.x, up.x, front.x, 0,
+        right.y, up.y, front.y, 0,
+        right.z, up.z, front.z, 0,
+        -dot(position, right), -dot(position, up), -dot(position, front), 1.0f
+      );
+    }
+
     // GLM temporary replacement
     static glm::mat4 Perspective(float fov, float aspect, float near, float far) {
       float ctgHalfFov = glm::cot(fov * 0.5f);
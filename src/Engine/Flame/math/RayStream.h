@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Ray.h"
+
+namespace Flame {
+  /// Batch of rays stored as SoA, each with its own [tMin; tMax] interval
+  struct RayStream final {
+    RayStream() = default;
+
+    explicit RayStream(uint32_t count) {
+      Resize(count);
+    }
+
+    void Resize(uint32_t count) {
+      originX.resize(count);
+      originY.resize(count);
+      originZ.resize(count);
+      directionX.resize(count);
+      directionY.resize(count);
+      directionZ.resize(count);
+      tMin.resize(count);
+      tMax.resize(count);
+    }
+
+    void Set(uint32_t id, const Ray& r, float rayTMin, float rayTMax) {
+      originX[id] = r.origin.x;
+      originY[id] = r.origin.y;
+      originZ[id] = r.origin.z;
+      directionX[id] = r.direction.x;
+      directionY[id] = r.direction.y;
+      directionZ[id] = r.direction.z;
+      tMin[id] = rayTMin;
+      tMax[id] = rayTMax;
+    }
+
+    Ray Get(uint32_t id) const {
+      return Ray(glm::vec3(originX[id], originY[id], originZ[id]), glm::vec3(directionX[id], directionY[id], directionZ[id]));
+    }
+
+    uint32_t Size() const {
+      return static_cast<uint32_t>(tMin.size());
+    }
+
+  public:
+    std::vector<float> originX;
+    std::vector<float> originY;
+    std::vector<float> originZ;
+    std::vector<float> directionX;
+    std::vector<float> directionY;
+    std::vector<float> directionZ;
+    std::vector<float> tMin;
+    std::vector<float> tMax;
+  };
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+
+namespace Flame {
+  /**
+   * Thin wrapper over SSE/AVX registers. Comparisons return lane masks (all bits set or cleared),
+   * which are combined with &, | and read back with Mask()
+   */
+  template <uint32_t Width>
+  struct SimdFloat;
+
+  template <>
+  struct SimdFloat<4> final {
+    static constexpr uint32_t kWidth = 4;
+
+    SimdFloat() = default;
+
+    SimdFloat(__m128 value)
+    : value(value) {
+    }
+
+    explicit SimdFloat(float scalar)
+    : value(_mm_set1_ps(scalar)) {
+    }
+
+    static SimdFloat Load(const float* data) {
+      return _mm_load_ps(data);
+    }
+
+    static SimdFloat LoadUnaligned(const float* data) {
+      return _mm_loadu_ps(data);
+    }
+
+    void Store(float* data) const {
+      _mm_store_ps(data, value);
+    }
+
+    /// Non-temporal store, bypasses the cache. Needs an _mm_sfence() before other threads may read the data
+    void StoreStream(float* data) const {
+      _mm_stream_ps(data, value);
+    }
+
+    uint32_t Mask() const {
+      return static_cast<uint32_t>(_mm_movemask_ps(value));
+    }
+
+    static SimdFloat Min(SimdFloat a, SimdFloat b) {
+      return _mm_min_ps(a.value, b.value);
+    }
+
+    static SimdFloat Max(SimdFloat a, SimdFloat b) {
+      return _mm_max_ps(a.value, b.value);
+    }
+
+    static SimdFloat Select(SimdFloat mask, SimdFloat a, SimdFloat b) {
+      return _mm_or_ps(_mm_and_ps(mask.value, a.value), _mm_andnot_ps(mask.value, b.value));
+    }
+
+    friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm_add_ps(a.value, b.value); }
+    friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a.value, b.value); }
+    friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a.value, b.value); }
+    friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm_div_ps(a.value, b.value); }
+    friend SimdFloat operator<(SimdFloat a, SimdFloat b) { return _mm_cmplt_ps(a.value, b.value); }
+    friend SimdFloat operator<=(SimdFloat a, SimdFloat b) { return _mm_cmple_ps(a.value, b.value); }
+    friend SimdFloat operator>(SimdFloat a, SimdFloat b) { return _mm_cmpgt_ps(a.value, b.value); }
+    friend SimdFloat operator>=(SimdFloat a, SimdFloat b) { return _mm_cmpge_ps(a.value, b.value); }
+    friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm_and_ps(a.value, b.value); }
+    friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm_or_ps(a.value, b.value); }
+
+  public:
+    __m128 value;
+  };
+
+#if defined(__AVX__)
+  template <>
+  struct SimdFloat<8> final {
+    static constexpr uint32_t kWidth = 8;
+
+    SimdFloat() = default;
+
+    SimdFloat(__m256 value)
+    : value(value) {
+    }
+
+    explicit SimdFloat(float scalar)
+    : value(_mm256_set1_ps(scalar)) {
+    }
+
+    static SimdFloat Load(const float* data) {
+      return _mm256_load_ps(data);
+    }
+
+    static SimdFloat LoadUnaligned(const float* data) {
+      return _mm256_loadu_ps(data);
+    }
+
+    void Store(float* data) const {
+      _mm256_store_ps(data, value);
+    }
+
+    void StoreStream(float* data) const {
+      _mm256_stream_ps(data, value);
+    }
+
+    uint32_t Mask() const {
+      return static_cast<uint32_t>(_mm256_movemask_ps(value));
+    }
+
+    static SimdFloat Min(SimdFloat a, SimdFloat b) {
+      return _mm256_min_ps(a.value, b.value);
+    }
+
+    static SimdFloat Max(SimdFloat a, SimdFloat b) {
+      return _mm256_max_ps(a.value, b.value);
+    }
+
+    static SimdFloat Select(SimdFloat mask, SimdFloat a, SimdFloat b) {
+      return _mm256_blendv_ps(b.value, a.value, mask.value);
+    }
+
+    friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a.value, b.value); }
+    friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a.value, b.value); }
+    friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a.value, b.value); }
+    friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm256_div_ps(a.value, b.value); }
+    friend SimdFloat operator<(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.value, b.value, _CMP_LT_OQ); }
+    friend SimdFloat operator<=(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.value, b.value, _CMP_LE_OQ); }
+    friend SimdFloat operator>(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.value, b.value, _CMP_GT_OQ); }
+    friend SimdFloat operator>=(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.value, b.value, _CMP_GE_OQ); }
+    friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm256_and_ps(a.value, b.value); }
+    friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm256_or_ps(a.value, b.value); }
+
+  public:
+    __m256 value;
+  };
+
+  // Widest vector available in this build
+  inline constexpr uint32_t kSimdWidth = 8;
+#else
+  inline constexpr uint32_t kSimdWidth = 4;
+#endif
+}
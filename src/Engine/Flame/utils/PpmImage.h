@@ -1,10 +1,13 @@
 #pragma once
 
+#include "glm/common.hpp"
 #include "glm/detail/qualifier.hpp"
 #include "glm/ext/vector_bool3.hpp"
 #include "glm/vec2.hpp"
 #include "glm/vec3.hpp"
 #include <algorithm>
+#include <bit>
+#include <filesystem>
 #include <ios>
 #include <string>
 #include <vector>
@@ -58,7 +61,7 @@ namespace Flame {
       return Get(coord.x, coord.y);
     }
 
-    void SaveToFile(const std::wstring& path, uint32_t maxColor = 255) {
+    void SaveToFile(const std::filesystem::path& path, uint32_t maxColor = 255) {
       std::ofstream file(path);
       if (!file.is_open()) {
         return;
@@ -70,7 +73,7 @@ namespace Flame {
 
       for (uint32_t row = 0; row < m_height; ++row) {
         for (uint32_t col = 0; col < m_width; ++col) {
-          const glm::vec3& color = m_framebuffer[row * m_width + col];
+          glm::vec3 color = glm::clamp(m_framebuffer[row * m_width + col], 0.0f, 1.0f);
           file
             << uint32_t(color.r * float(maxColor)) << ' '
             << uint32_t(color.g * float(maxColor)) << ' '
@@ -81,8 +84,8 @@ namespace Flame {
       file.close();
     }
 
-    void SaveToFileBinary(const std::wstring& path, uint32_t maxColor = 255) {
-      std::ofstream file(path);
+    void SaveToFileBinary(const std::filesystem::path& path, uint32_t maxColor = 255) {
+      std::ofstream file(path, std::ios::binary);
       if (!file.is_open()) {
         return;
       }
@@ -94,7 +97,7 @@ namespace Flame {
       for (uint32_t row = 0; row < m_height; ++row) {
         for (uint32_t col = 0; col < m_width; ++col) {
           static_assert(sizeof(glm::vec<3, uint8_t>) == 3);
-          glm::vec<3, uint8_t> color(m_framebuffer[row * m_width + col] * float(maxColor));
+          glm::vec<3, uint8_t> color(glm::clamp(m_framebuffer[row * m_width + col], 0.0f, 1.0f) * float(maxColor));
           file.write(reinterpret_cast<const char*>(&color), 3);
         }
       }
@@ -102,6 +105,26 @@ namespace Flame {
       file.close();
     }
 
+    /// Portable float map: unclamped linear colors, rows stored bottom to top
+    void SaveToFilePfm(const std::filesystem::path& path) {
+      std::ofstream file(path, std::ios::binary);
+      if (!file.is_open()) {
+        return;
+      }
+
+      file << "PF\n";
+      file << m_width << ' ' << m_height << '\n';
+      // Negative scale means little-endian
+      file << (std::endian::native == std::endian::little ? "-1.0" : "1.0") << '\n';
+
+      for (uint32_t row = m_height; row-- > 0;) {
+        static_assert(sizeof(glm::vec3) == 3 * sizeof(float));
+        file.write(reinterpret_cast<const char*>(&m_framebuffer[row * m_width]), m_width * sizeof(glm::vec3));
+      }
+
+      file.close();
+    }
+
     uint32_t Width() const {
       return m_width;
     }
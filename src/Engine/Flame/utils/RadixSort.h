@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "TaskScheduler.h"
+
+namespace Flame {
+  /**
+   * Stable LSD radix sort of keys, with values reordered along. Sorts 8 bits per pass and skips passes
+   * where every key has the same digit, so small keys in wide types stay cheap.
+   * With a scheduler, every pass counts and scatters fixed-size chunks of keys in parallel
+   */
+  template <typename Key, typename Value>
+  void RadixSort(std::vector<Key>& keys, std::vector<Value>& values, TaskScheduler* scheduler = nullptr) {
+    static_assert(std::is_unsigned_v<Key>);
+    static constexpr uint32_t kDigitBits = 8;
+    static constexpr uint32_t kDigitsCount = 1 << kDigitBits;
+    static constexpr uint32_t kChunkSize = 1 << 14;
+    using Histogram = std::array<uint32_t, kDigitsCount>;
+
+    assert(keys.size() == values.size());
+    uint32_t count = static_cast<uint32_t>(keys.size());
+    uint32_t chunksCount = (count + kChunkSize - 1) / kChunkSize;
+    auto forEachChunk = [&](auto&& func) {
+      auto task = [&func, count](uint32_t firstChunkId, uint32_t lastChunkId) {
+        for (uint32_t chunkId = firstChunkId; chunkId < lastChunkId; ++chunkId) {
+          uint32_t begin = chunkId * kChunkSize;
+          func(chunkId, begin, std::min(begin + kChunkSize, count));
+        }
+      };
+
+      if (scheduler == nullptr) {
+        task(0, chunksCount);
+      } else {
+        scheduler->ParallelFor(0, chunksCount, 1, task);
+      }
+    };
+
+    std::vector<Key> keysTemp(count);
+    std::vector<Value> valuesTemp(count);
+    // Per chunk: digit counts, then turned into the output offsets of the chunk's first key with each digit
+    std::vector<Histogram> histograms(chunksCount);
+
+    for (uint32_t shift = 0; shift < sizeof(Key) * 8; shift += kDigitBits) {
+      forEachChunk([&](uint32_t chunkId, uint32_t begin, uint32_t end) {
+        Histogram& histogram = histograms[chunkId];
+        histogram.fill(0);
+        for (uint32_t i = begin; i < end; ++i) {
+          ++histogram[(keys[i] >> shift) & (kDigitsCount - 1)];
+        }
+      });
+
+      // Digit-major prefix sum, so chunks keep their relative order within a digit and the sort stays stable
+      uint32_t offset = 0;
+      bool isSingleDigit = false;
+      for (uint32_t digit = 0; digit < kDigitsCount; ++digit) {
+        uint32_t digitBegin = offset;
+        for (Histogram& histogram : histograms) {
+          uint32_t digitCount = histogram[digit];
+          histogram[digit] = offset;
+          offset += digitCount;
+        }
+
+        isSingleDigit |= offset - digitBegin == count;
+      }
+
+      if (isSingleDigit) {
+        continue;
+      }
+
+      forEachChunk([&](uint32_t chunkId, uint32_t begin, uint32_t end) {
+        Histogram& offsets = histograms[chunkId];
+        for (uint32_t i = begin; i < end; ++i) {
+          uint32_t target = offsets[(keys[i] >> shift) & (kDigitsCount - 1)]++;
+          keysTemp[target] = keys[i];
+          valuesTemp[target] = std::move(values[i]);
+        }
+      });
+
+      keys.swap(keysTemp);
+      values.swap(valuesTemp);
+    }
+  }
+}
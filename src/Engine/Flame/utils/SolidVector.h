@@ -36,6 +36,12 @@ namespace Flame {
       return m_data[index];
     }
 
+    /// \return Current position of the element in the dense storage, changes when other elements are erased
+    Index index(ID id) const {
+      assertId(id);
+      return m_forwardMap[id];
+    }
+
     const T& operator[](ID id) const {
       assertId(id);
       return m_data[m_forwardMap[id]];
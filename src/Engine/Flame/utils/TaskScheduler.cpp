@@ -0,0 +1,204 @@
+#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace Flame {
+  TaskScheduler::TaskScheduler(uint32_t threadsCount)
+  : m_threadsCount(threadsCount) {
+    m_queues.reserve(threadsCount + 1);
+    for (uint32_t i = 0; i < threadsCount + 1; ++i) {
+      m_queues.emplace_back(std::make_unique<Queue>());
+    }
+
+    m_threads.reserve(threadsCount);
+    for (uint32_t i = 0; i < threadsCount; ++i) {
+      m_threads.emplace_back([this, i] {
+        WorkLoop(i);
+      });
+    }
+  }
+
+  TaskScheduler::~TaskScheduler() {
+    // Queued tasks still run, workers only leave once the queues are empty
+    Job job;
+    while (TryPop(job)) {
+      Run(job);
+    }
+
+    {
+      std::lock_guard lock(m_sleepMutex);
+      m_isRunning = false;
+    }
+    m_sleepCv.notify_all();
+
+    for (auto& t : m_threads) {
+      t.join();
+    }
+    assert(m_queuedCount.load() == 0);
+  }
+
+  TaskHandle TaskScheduler::Submit(Task task) {
+    auto pending = std::make_shared<std::atomic<uint32_t>>(1);
+    Push({ std::move(task), pending });
+    NotifyWorkers(1);
+    return TaskHandle(std::move(pending));
+  }
+
+  TaskHandle TaskScheduler::ParallelForAsync(uint32_t begin, uint32_t end, uint32_t grainSize, RangeTask task) {
+    assert(grainSize != 0);
+    if (begin >= end) {
+      return TaskHandle();
+    }
+
+    uint32_t rangesCount = (end - begin + grainSize - 1) / grainSize;
+    auto pending = std::make_shared<std::atomic<uint32_t>>(rangesCount);
+    // Shared by all ranges instead of being copied into each of them
+    auto sharedTask = std::make_shared<RangeTask>(std::move(task));
+
+    // Pushed back to front, so the owner pops the ranges in order and thieves take the far end
+    for (uint32_t rangeId = rangesCount; rangeId-- > 0;) {
+      uint32_t rangeBegin = begin + rangeId * grainSize;
+      uint32_t rangeEnd = std::min(rangeBegin + grainSize, end);
+      Push({ [sharedTask, rangeBegin, rangeEnd] {
+        (*sharedTask)(rangeBegin, rangeEnd);
+      }, pending });
+    }
+
+    NotifyWorkers(rangesCount);
+    return TaskHandle(std::move(pending));
+  }
+
+  void TaskScheduler::Wait(const TaskHandle& handle) {
+    // Helping instead of blocking is what makes nested waits deadlock-free
+    while (!handle.IsDone()) {
+      Job job;
+      if (TryPop(job)) {
+        Run(job);
+        continue;
+      }
+
+      // The remaining tasks are being run by other threads: sleep until they finish or there is something to help with
+      std::unique_lock lock(m_sleepMutex);
+      m_sleepCv.wait(lock, [this, &handle] {
+        return handle.IsDone() || m_queuedCount.load(std::memory_order_acquire) != 0;
+      });
+    }
+  }
+
+  uint32_t TaskScheduler::GetThreadsCount() const {
+    return m_threadsCount;
+  }
+
+  TaskScheduler* TaskScheduler::Get() {
+    // The thread that waits works too, so it takes one of the hardware threads
+    static TaskScheduler instance(std::max(2U, std::thread::hardware_concurrency()) - 1);
+    return &instance;
+  }
+
+  TaskHandle TaskScheduler::SubmitCopies(const Task& task, uint32_t copiesCount) {
+    if (copiesCount == 0) {
+      return TaskHandle();
+    }
+
+    auto pending = std::make_shared<std::atomic<uint32_t>>(copiesCount);
+    for (uint32_t i = 0; i < copiesCount; ++i) {
+      Push({ task, pending });
+    }
+
+    NotifyWorkers(copiesCount);
+    return TaskHandle(std::move(pending));
+  }
+
+  void TaskScheduler::Push(Job job) {
+    Queue& queue = *m_queues[GetQueueId()];
+    std::lock_guard lock(queue.mutex);
+    // Counted under the lock, so a pop can never make the counter go below zero
+    m_queuedCount.fetch_add(1, std::memory_order_release);
+    queue.jobs.push_back(std::move(job));
+  }
+
+  void TaskScheduler::NotifyWorkers(uint32_t jobsCount) {
+    // Empty critical section orders the push before a worker's check-then-sleep, so a wakeup can't be lost
+    {
+      std::lock_guard lock(m_sleepMutex);
+    }
+
+    if (jobsCount == 1) {
+      m_sleepCv.notify_one();
+    } else {
+      m_sleepCv.notify_all();
+    }
+  }
+
+  bool TaskScheduler::TryPop(Job& job) {
+    if (m_queuedCount.load(std::memory_order_acquire) == 0) {
+      return false;
+    }
+
+    // Own queue first, newest task - its data is still in cache
+    uint32_t ownId = GetQueueId();
+    {
+      Queue& queue = *m_queues[ownId];
+      std::lock_guard lock(queue.mutex);
+      if (!queue.jobs.empty()) {
+        job = std::move(queue.jobs.back());
+        queue.jobs.pop_back();
+        m_queuedCount.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+
+    // Steal the oldest task of someone else, starting from the neighbour to spread the contention
+    uint32_t queuesCount = static_cast<uint32_t>(m_queues.size());
+    for (uint32_t i = 1; i < queuesCount; ++i) {
+      Queue& queue = *m_queues[(ownId + i) % queuesCount];
+      std::lock_guard lock(queue.mutex);
+      if (!queue.jobs.empty()) {
+        job = std::move(queue.jobs.front());
+        queue.jobs.pop_front();
+        m_queuedCount.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void TaskScheduler::Run(Job& job) {
+    job.task();
+    if (job.pending->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      // Last task of the handle, someone may sleep in Wait(). Same empty critical section as in NotifyWorkers()
+      {
+        std::lock_guard lock(m_sleepMutex);
+      }
+      m_sleepCv.notify_all();
+    }
+  }
+
+  void TaskScheduler::WorkLoop(uint32_t workerId) {
+    t_scheduler = this;
+    t_workerId = workerId;
+
+    while (true) {
+      Job job;
+      if (TryPop(job)) {
+        Run(job);
+        continue;
+      }
+
+      std::unique_lock lock(m_sleepMutex);
+      m_sleepCv.wait(lock, [this] {
+        return m_queuedCount.load(std::memory_order_acquire) != 0 || !m_isRunning;
+      });
+
+      if (!m_isRunning && m_queuedCount.load(std::memory_order_acquire) == 0) {
+        return;
+      }
+    }
+  }
+
+  uint32_t TaskScheduler::GetQueueId() const {
+    return t_scheduler == this ? t_workerId : m_threadsCount;
+  }
+}
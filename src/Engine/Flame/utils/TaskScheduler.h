@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Flame {
+  struct TaskScheduler;
+
+  /// Tracks completion of a submitted task or a whole parallel loop. Default-constructed handle is always done
+  struct TaskHandle final {
+    TaskHandle() = default;
+
+    bool IsDone() const {
+      return m_pending == nullptr || m_pending->load(std::memory_order_acquire) == 0;
+    }
+
+  private:
+    friend struct TaskScheduler;
+
+    explicit TaskHandle(std::shared_ptr<std::atomic<uint32_t>> pending)
+    : m_pending(std::move(pending)) {
+    }
+
+  private:
+    std::shared_ptr<std::atomic<uint32_t>> m_pending;
+  };
+
+  template <typename T>
+  struct TaskFuture final {
+    bool IsDone() const {
+      return m_handle.IsDone();
+    }
+
+    /// Waits for the task, running other tasks meanwhile
+    T& Get();
+
+  private:
+    friend struct TaskScheduler;
+
+    TaskFuture(TaskScheduler* scheduler, TaskHandle handle, std::shared_ptr<std::optional<T>> result)
+    : m_scheduler(scheduler)
+    , m_handle(std::move(handle))
+    , m_result(std::move(result)) {
+    }
+
+  private:
+    TaskScheduler* m_scheduler;
+    TaskHandle m_handle;
+    std::shared_ptr<std::optional<T>> m_result;
+  };
+
+  /**
+   * Work-stealing thread pool. Every worker owns a deque: it pushes and pops its own tasks at the back,
+   * idle workers steal from the front of the others. Tasks submitted from outside go to a shared queue.
+   * Waiting on a handle runs queued tasks and only sleeps once there is nothing left to take, so tasks may submit
+   * and wait for nested tasks, and any number of jobs can be in flight at once. Workers and waiters share one
+   * condition variable, woken by new tasks and by finished handles
+   */
+  struct TaskScheduler final {
+    using Task = std::function<void()>;
+    using RangeTask = std::function<void(uint32_t begin, uint32_t end)>;
+
+    explicit TaskScheduler(uint32_t threadsCount);
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    TaskHandle Submit(Task task);
+    /// Splits [begin; end) into ranges of grainSize elements, each one is a separate task
+    TaskHandle ParallelForAsync(uint32_t begin, uint32_t end, uint32_t grainSize, RangeTask task);
+    void Wait(const TaskHandle& handle);
+
+    /**
+     * Calls func(rangeBegin, rangeEnd) for consecutive ranges of grainSize elements and waits for all of them.
+     * The body isn't type-erased: a few helper tasks claim ranges from a shared counter and call it directly,
+     * and the calling thread takes part too
+     */
+    template <typename Func>
+    void ParallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, Func&& func) {
+      assert(grainSize != 0);
+      if (begin >= end) {
+        return;
+      }
+
+      uint32_t rangesCount = (end - begin + grainSize - 1) / grainSize;
+      if (rangesCount == 1 || m_threadsCount == 0) {
+        func(begin, end);
+        return;
+      }
+
+      std::atomic<uint32_t> nextRangeId = 0;
+      auto runRanges = [&] {
+        while (true) {
+          uint32_t rangeId = nextRangeId.fetch_add(1, std::memory_order_relaxed);
+          if (rangeId >= rangesCount) {
+            return;
+          }
+
+          uint32_t rangeBegin = begin + rangeId * grainSize;
+          func(rangeBegin, std::min(rangeBegin + grainSize, end));
+        }
+      };
+
+      // Locals are captured by reference, which is fine since helpers are waited for below
+      TaskHandle handle = SubmitCopies([&runRanges] {
+        runRanges();
+      }, std::min(rangesCount - 1, m_threadsCount));
+      runRanges();
+      Wait(handle);
+    }
+
+    template <typename Func>
+    requires (!std::is_void_v<std::invoke_result_t<Func>>)
+    TaskFuture<std::invoke_result_t<Func>> Async(Func func) {
+      using Result = std::invoke_result_t<Func>;
+      auto result = std::make_shared<std::optional<Result>>();
+      TaskHandle handle = Submit([result, func = std::move(func)]() mutable {
+        result->emplace(func());
+      });
+
+      return TaskFuture<Result>(this, std::move(handle), std::move(result));
+    }
+
+    uint32_t GetThreadsCount() const;
+
+    /// Shared scheduler with a worker per hardware thread but the calling one, at least one worker
+    static TaskScheduler* Get();
+
+  private:
+    struct Job final {
+      Task task;
+      std::shared_ptr<std::atomic<uint32_t>> pending;
+    };
+
+    struct Queue final {
+      std::mutex mutex;
+      std::deque<Job> jobs;
+    };
+
+    /// Queues the same task copiesCount times under one handle
+    TaskHandle SubmitCopies(const Task& task, uint32_t copiesCount);
+    void Push(Job job);
+    void NotifyWorkers(uint32_t jobsCount);
+    bool TryPop(Job& job);
+    void Run(Job& job);
+    void WorkLoop(uint32_t workerId);
+    /// \return Index of the calling worker's queue, or of the shared queue for outside threads
+    uint32_t GetQueueId() const;
+
+  private:
+    // One per worker, the last one is shared by outside threads
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    uint32_t m_threadsCount;
+
+    std::mutex m_sleepMutex;
+    std::condition_variable m_sleepCv;
+    std::atomic<uint32_t> m_queuedCount = 0;
+    bool m_isRunning = true;
+
+    inline static thread_local const TaskScheduler* t_scheduler = nullptr;
+    inline static thread_local uint32_t t_workerId = 0;
+  };
+
+  /// ParallelFor() on the shared scheduler
+  template <typename Func>
+  void ParallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, Func&& func) {
+    TaskScheduler::Get()->ParallelFor(begin, end, grainSize, std::forward<Func>(func));
+  }
+
+  template <typename T>
+  T& TaskFuture<T>::Get() {
+    m_scheduler->Wait(m_handle);
+    return **m_result;
+  }
+}
@@ -13,76 +13,84 @@ namespace Flame {
 
   struct OpaqueInstanceDragger final : IDragger {
     explicit OpaqueInstanceDragger(const HitRecord<MeshSystem::HitResult>& record, const glm::vec3& cameraPosition, const glm::vec3& cameraDirection)
-    : m_draggable(record.data.perInstanceOpaque)
-    , m_offset(TransformSystem::Get()->At(m_draggable->GetData().transformId)->transform.GetPosition() - record.point)
+    : m_material(record.data.perMaterialOpaque)
+    , m_instanceId(record.data.instanceId)
+    , m_offset(TransformSystem::Get()->GetPosition(m_material->GetInstance(m_instanceId).GetData().transformId) - record.point)
     , m_distanceToPlane(glm::dot(cameraDirection, record.point - cameraPosition)) {
     }
 
     void Drag(const Ray& r, const glm::vec3& cameraDirection) override {
       float approachToPlane = glm::dot(r.direction, cameraDirection);
       float approachTime = m_distanceToPlane / approachToPlane;
-      TransformSystem::Get()->At(m_draggable->GetData().transformId)->transform.SetPosition(r.AtParameter(approachTime) + m_offset);
+      TransformSystem::Get()->SetPosition(m_material->GetInstance(m_instanceId).GetData().transformId, r.AtParameter(approachTime) + m_offset);
     }
 
   private:
-    OpaqueGroup::PerInstance* m_draggable;
+    OpaqueGroup::PerMaterial* m_material;
+    uint32_t m_instanceId;
     glm::vec3 m_offset;
     float m_distanceToPlane;
   };
 
   struct HologramInstanceDragger final : IDragger {
     explicit HologramInstanceDragger(const HitRecord<MeshSystem::HitResult>& record, const glm::vec3& cameraPosition, const glm::vec3& cameraDirection)
-    : m_draggable(record.data.perInstanceHologram)
-    , m_offset(TransformSystem::Get()->At(m_draggable->GetData().transformId)->transform.GetPosition() - record.point)
+    : m_material(record.data.perMaterialHologram)
+    , m_instanceId(record.data.instanceId)
+    , m_offset(TransformSystem::Get()->GetPosition(m_material->GetInstance(m_instanceId).GetData().transformId) - record.point)
     , m_distanceToPlane(glm::dot(cameraDirection, record.point - cameraPosition)) {
     }
 
     void Drag(const Ray& r, const glm::vec3& cameraDirection) override {
       float approachToPlane = glm::dot(r.direction, cameraDirection);
       float approachTime = m_distanceToPlane / approachToPlane;
-      TransformSystem::Get()->At(m_draggable->GetData().transformId)->transform.SetPosition(r.AtParameter(approachTime) + m_offset);
+      TransformSystem::Get()->SetPosition(m_material->GetInstance(m_instanceId).GetData().transformId, r.AtParameter(approachTime) + m_offset);
     }
 
   private:
-    HologramGroup::PerInstance* m_draggable;
+    HologramGroup::PerMaterial* m_material;
+    uint32_t m_instanceId;
     glm::vec3 m_offset;
     float m_distanceToPlane;
   };
 
   struct TextureOnlyInstanceDragger final : IDragger {
     explicit TextureOnlyInstanceDragger(const HitRecord<MeshSystem::HitResult>& record, const glm::vec3& cameraPosition, const glm::vec3& cameraDirection)
-    : m_draggable(record.data.perInstanceTextureOnly)
-    , m_offset(TransformSystem::Get()->At(m_draggable->GetData().transformId)->transform.GetPosition() - record.point)
+    : m_material(record.data.perMaterialTextureOnly)
+    , m_instanceId(record.data.instanceId)
+    , m_offset(TransformSystem::Get()->GetPosition(m_material->GetInstance(m_instanceId).GetData().transformId) - record.point)
     , m_distanceToPlane(glm::dot(cameraDirection, record.point - cameraPosition)) {
     }
 
     void Drag(const Ray& r, const glm::vec3& cameraDirection) override {
       float approachToPlane = glm::dot(r.direction, cameraDirection);
       float approachTime = m_distanceToPlane / approachToPlane;
-      TransformSystem::Get()->At(m_draggable->GetData().transformId)->transform.SetPosition(r.AtParameter(approachTime) + m_offset);
+      TransformSystem::Get()->SetPosition(m_material->GetInstance(m_instanceId).GetData().transformId, r.AtParameter(approachTime) + m_offset);
     }
 
   private:
-    TextureOnlyGroup::PerInstance* m_draggable;
+    TextureOnlyGroup::PerMaterial* m_material;
+    uint32_t m_instanceId;
     glm::vec3 m_offset;
     float m_distanceToPlane;
   };
 
   struct EmissionOnlyInstanceDragger final : IDragger {
     explicit EmissionOnlyInstanceDragger(const HitRecord<MeshSystem::HitResult>& record, const glm::vec3& cameraPosition, const glm::vec3& cameraDirection)
-    : m_draggable(record.data.perInstanceEmissionOnly)
-    , m_offset(TransformSystem::Get()->At(m_draggable->GetData().transformId)->transform.GetPosition() - record.point)
+    : m_material(record.data.perMaterialEmissionOnly)
+    , m_instanceId(record.data.instanceId)
+    , m_offset(TransformSystem::Get()->GetPosition(m_material->GetInstance(m_instanceId).GetData().transformId) - record.point)
     , m_distanceToPlane(glm::dot(cameraDirection, record.point - cameraPosition)) {
     }
 
     void Drag(const Ray& r, const glm::vec3& cameraDirection) override {
       float approachToPlane = glm::dot(r.direction, cameraDirection);
       float approachTime = m_distanceToPlane / approachToPlane;
-      TransformSystem::Get()->At(m_draggable->GetData().transformId)->transform.SetPosition(r.AtParameter(approachTime) + m_offset);
+      TransformSystem::Get()->SetPosition(m_material->GetInstance(m_instanceId).GetData().transformId, r.AtParameter(approachTime) + m_offset);
     }
 
   private:
-    EmissionOnlyGroup::PerInstance* m_draggable;
+    EmissionOnlyGroup::PerMaterial* m_material;
+    uint32_t m_instanceId;
     glm::vec3 m_offset;
     float m_distanceToPlane;
   };
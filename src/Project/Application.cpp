@@ -1,6 +1,8 @@
 ﻿#include "Application.h"
+#include "Flame/engine/Engine.h"
 #include "Flame/engine/LightSystem.h"
 #include "Flame/engine/ModelManager.h"
+#include "Flame/engine/PathTracer.h"
 #include "Flame/engine/TextureManager.h"
 #include "Flame/engine/Transform.h"
 #include "Flame/engine/lights/PointLight.h"
@@ -10,6 +12,7 @@
 #include "glm/trigonometric.hpp"
 #include <Flame/engine/MeshSystem.h>
 #include <cmath>
+#include <filesystem>
 #include <winuser.h>
 #include <backends/imgui_impl_dx11.h>
 #include <backends/imgui_impl_win32.h>
@@ -256,6 +259,8 @@ void Application::Update(float deltaTime) {
     PostQuitMessage(0);
   }
 
+  // Picking below needs the instance BVH to match the current transforms
+  Flame::MeshSystem::Get()->Update(deltaTime);
   UpdateCamera(deltaTime);
   UpdateGrabbing(deltaTime);
   m_dxRenderer->Update(deltaTime);
@@ -293,8 +298,8 @@ void Application::Update(float deltaTime) {
 
   if (m_input->IsKeyPressed('R')) {
     m_rotation += rotationSpeed * deltaTime;
-    Flame::TransformSystem::Get()->At(m_planeTransformId)->transform.SetRotation(0, m_rotation, 0);
-    Flame::TransformSystem::Get()->At(m_cubeTransformId)->transform.SetRotation(m_rotation, 12.0f, m_rotation);
+    Flame::TransformSystem::Get()->SetRotation(m_planeTransformId, 0, m_rotation, 0);
+    Flame::TransformSystem::Get()->SetRotation(m_cubeTransformId, m_rotation, 12.0f, m_rotation);
   }
 }
 
@@ -322,6 +327,10 @@ void Application::HandleEvent(const Flame::WindowEvent& e) {
     if (event.vkCode == 'F' && event.isPressed && !event.wasPressed) {
       m_flashlightGrabbed = !m_flashlightGrabbed;
     }
+
+    if (event.vkCode == 'P' && event.isPressed && !event.wasPressed) {
+      RenderPathTraced();
+    }
   }
 }
 
@@ -415,6 +424,28 @@ void Application::UpdateGrabbing(float deltaTime) {
   }
 }
 
+void Application::RenderPathTraced() const {
+  Flame::PpmImage image(m_window->GetFramebuffer().GetWidth(), m_window->GetFramebuffer().GetHeight());
+  Flame::PathTracer pathTracer;
+  Flame::PathTracer::Stats stats = pathTracer.Render(*m_camera, image);
+  std::cout << "Path tracer: " << image.Width() << "x" << image.Height() << ", " << pathTracer.GetSettings().samplesPerPixel << " spp in "
+    << stats.renderTime << " s, " << stats.GetSamplesPerSecond() / 1e6f << " Msamples/s, "
+    << stats.GetRaysPerSecond() / 1e6f << " Mrays/s" << '\n';
+
+  std::filesystem::path directory = Flame::Engine::GetDirectory(L"Generated\\Renders");
+  std::filesystem::create_directories(directory);
+  image.SaveToFilePfm(directory / "render.pfm");
+
+  // PPM is for a quick look: gamma-corrected and clamped, without the post-process exposure
+  for (uint32_t y = 0; y < image.Height(); ++y) {
+    for (uint32_t x = 0; x < image.Width(); ++x) {
+      image.Set(x, y, glm::pow(image.Get(x, y), glm::vec3(1.0f / 2.2f)));
+    }
+  }
+  image.SaveToFileBinary(directory / "render.ppm");
+  std::wcout << "Saved path traced render to \"" << directory.wstring() << '\"' << '\n';
+}
+
 void Application::CountFps(float deltaTime) {
   m_fpsTimer += deltaTime;
   if (m_fpsTimer >= 1.0) {
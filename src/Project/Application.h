@@ -26,6 +26,8 @@ private:
   void UpdateCamera(float deltaTime);
   void UpdateGrabbing(float deltaTime);
   void CountFps(float deltaTime);
+  /// Path traces the current view on the CPU into Generated/Renders
+  void RenderPathTraced() const;
 
 private:
   std::shared_ptr<Flame::Window> m_window;